@@ -48,6 +48,9 @@
 #define CMD_READ_SECTOR_RETRY 0x20      /* READ SECTOR with retries. */
 #define CMD_WRITE_SECTOR_RETRY 0x30     /* WRITE SECTOR with retries. */
 
+/* Timer ticks to wait for a command's completion interrupt. */
+#define CMD_TIMEOUT (30 * TIMER_FREQ)
+
 /* An ATA device. */
 struct disk {
 	char name[8];               /* Name, e.g. "hd0:1". */
@@ -86,6 +89,7 @@ static void identify_ata_device (struct disk *);
 
 static void select_sector (struct disk *, disk_sector_t);
 static void issue_pio_command (struct channel *, uint8_t command);
+static bool wait_for_completion (struct channel *);
 static void input_sector (struct channel *, void *);
 static void output_sector (struct channel *, const void *);
 
@@ -119,7 +123,7 @@ disk_init (void) {
 			default:
 				NOT_REACHED ();
 		}
-		lock_init (&c->lock);
+		lock_init_named (&c->lock, c->name);
 		c->expecting_interrupt = false;
 		sema_init (&c->completion_wait, 0);
 
@@ -215,8 +219,7 @@ disk_read (struct disk *d, disk_sector_t sec_no, void *buffer) {
 	lock_acquire (&c->lock);
 	select_sector (d, sec_no);
 	issue_pio_command (c, CMD_READ_SECTOR_RETRY);
-	sema_down (&c->completion_wait);
-	if (!wait_while_busy (d))
+	if (!wait_for_completion (c) || !wait_while_busy (d))
 		PANIC ("%s: disk read failed, sector=%"PRDSNu, d->name, sec_no);
 	input_sector (c, buffer);
 	d->read_cnt++;
@@ -242,7 +245,8 @@ disk_write (struct disk *d, disk_sector_t sec_no, const void *buffer) {
 	if (!wait_while_busy (d))
 		PANIC ("%s: disk write failed, sector=%"PRDSNu, d->name, sec_no);
 	output_sector (c, buffer);
-	sema_down (&c->completion_wait);
+	if (!wait_for_completion (c))
+		PANIC ("%s: disk write timed out, sector=%"PRDSNu, d->name, sec_no);
 	d->write_cnt++;
 	lock_release (&c->lock);
 }
@@ -351,8 +355,7 @@ identify_ata_device (struct disk *d) {
 	   into our buffer. */
 	select_device_wait (d);
 	issue_pio_command (c, CMD_IDENTIFY_DEVICE);
-	sema_down (&c->completion_wait);
-	if (!wait_while_busy (d)) {
+	if (!wait_for_completion (c) || !wait_while_busy (d)) {
 		d->is_ata = false;
 		return;
 	}
@@ -429,6 +432,30 @@ issue_pio_command (struct channel *c, uint8_t command) {
 	outb (reg_command (c), command);
 }
 
+/* Waits for the interrupt that signals completion of the command
+   last issued on channel C, for at most CMD_TIMEOUT ticks.
+   Returns true if it arrived, false on timeout, in which case a
+   late interrupt is reported as unexpected instead of
+   completing a later command. */
+static bool
+wait_for_completion (struct channel *c) {
+	enum intr_level old_level;
+	bool completed;
+
+	if (sema_down_timeout (&c->completion_wait, CMD_TIMEOUT))
+		return true;
+
+	/* The interrupt may have raced with the timeout. */
+	old_level = intr_disable ();
+	c->expecting_interrupt = false;
+	completed = sema_try_down (&c->completion_wait);
+	intr_set_level (old_level);
+
+	if (!completed)
+		printf ("%s: command timed out\n", c->name);
+	return completed;
+}
+
 /* Reads a sector from channel C's data register in PIO mode into
    SECTOR, which must have room for DISK_SECTOR_SIZE bytes. */
 static void
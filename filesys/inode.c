@@ -5,7 +5,14 @@
 #include <string.h>
 #include "filesys/filesys.h"
 #include "filesys/free-map.h"
+#include "threads/interrupt.h"
 #include "threads/malloc.h"
+#include "threads/rcu.h"
+#include "threads/slab.h"
+#include "threads/synch.h"
+#ifdef VM
+#include "vm/pagecache.h"
+#endif
 
 /* Identifies an inode. */
 #define INODE_MAGIC 0x494e4f44
@@ -29,6 +36,7 @@ bytes_to_sectors (off_t size) {
 /* In-memory inode. */
 struct inode {
 	struct list_elem elem;              /* Element in inode list. */
+	struct rcu_head rcu;                /* Deferred free after close. */
 	disk_sector_t sector;               /* Sector number of disk location. */
 	int open_cnt;                       /* Number of openers. */
 	bool removed;                       /* True if deleted, false otherwise. */
@@ -50,13 +58,57 @@ byte_to_sector (const struct inode *inode, off_t pos) {
 }
 
 /* List of open inodes, so that opening a single inode twice
- * returns the same `struct inode'. */
+ * returns the same `struct inode'.
+ * Lookups traverse it under RCU; insertions and removals are
+ * serialized by OPEN_INODES_LOCK. */
 static struct list open_inodes;
+static struct lock open_inodes_lock;
+
+/* Cache for `struct inode'. */
+static struct kmem_cache *inode_cache;
 
 /* Initializes the inode module. */
 void
 inode_init (void) {
 	list_init (&open_inodes);
+	lock_init_named (&open_inodes_lock, "open_inodes");
+	inode_cache = kmem_cache_create ("inode", sizeof (struct inode), 0, NULL);
+	if (inode_cache == NULL)
+		PANIC ("inode_init: cannot create inode cache");
+}
+
+/* Returns the open inode for SECTOR with its open count
+ * incremented, or a null pointer if there is none.
+ * An inode whose open count already dropped to zero is being
+ * closed and is treated as absent. */
+static struct inode *
+lookup_open_inode (disk_sector_t sector) {
+	struct inode *found = NULL;
+	struct list_elem *e;
+
+	rcu_read_lock ();
+	for (e = rcu_list_begin (&open_inodes); e != list_end (&open_inodes);
+			e = rcu_list_next (e)) {
+		struct inode *inode = list_entry (e, struct inode, elem);
+		if (inode->sector == sector) {
+			/* A reader cannot be preempted, so on a uniprocessor this
+			 * check-and-increment is atomic with respect to
+			 * inode_close(). */
+			if (inode->open_cnt > 0) {
+				inode->open_cnt++;
+				found = inode;
+			}
+			break;
+		}
+	}
+	rcu_read_unlock ();
+	return found;
+}
+
+/* Frees an inode once no reader can still see it. */
+static void
+free_inode_rcu (struct rcu_head *head) {
+	kmem_cache_free (inode_cache, rcu_entry (head, struct inode, rcu));
 }
 
 /* Initializes an inode with LENGTH bytes of data and
@@ -101,39 +153,61 @@ inode_create (disk_sector_t sector, off_t length) {
  * Returns a null pointer if memory allocation fails. */
 struct inode *
 inode_open (disk_sector_t sector) {
-	struct list_elem *e;
 	struct inode *inode;
 
 	/* Check whether this inode is already open. */
-	for (e = list_begin (&open_inodes); e != list_end (&open_inodes);
-			e = list_next (e)) {
-		inode = list_entry (e, struct inode, elem);
-		if (inode->sector == sector) {
-			inode_reopen (inode);
-			return inode; 
-		}
-	}
+	inode = lookup_open_inode (sector);
+	if (inode != NULL)
+		return inode;
 
-	/* Allocate memory. */
-	inode = malloc (sizeof *inode);
+	/* Allocate memory and read the inode before taking the lock,
+	 * so that the disk access does not serialize other opens. */
+	inode = kmem_cache_alloc (inode_cache);
 	if (inode == NULL)
 		return NULL;
-
-	/* Initialize. */
-	list_push_front (&open_inodes, &inode->elem);
 	inode->sector = sector;
 	inode->open_cnt = 1;
 	inode->deny_write_cnt = 0;
 	inode->removed = false;
 	disk_read (filesys_disk, inode->sector, &inode->data);
+
+	/* Someone else may have opened it meanwhile. */
+	lock_acquire (&open_inodes_lock);
+	struct inode *other = lookup_open_inode (sector);
+	if (other == NULL)
+		rcu_list_push_front (&open_inodes, &inode->elem);
+	lock_release (&open_inodes_lock);
+
+	if (other != NULL) {
+		kmem_cache_free (inode_cache, inode);
+		return other;
+	}
 	return inode;
 }
 
 /* Reopens and returns INODE. */
 struct inode *
 inode_reopen (struct inode *inode) {
-	if (inode != NULL)
+	if (inode != NULL) {
+		enum intr_level old_level = intr_disable ();
 		inode->open_cnt++;
+		intr_set_level (old_level);
+	}
+	return inode;
+}
+
+/* Reopens and returns INODE if it is still open, like
+ * lookup_open_inode().  Returns a null pointer if its last
+ * opener is already closing it. */
+struct inode *
+inode_try_reopen (struct inode *inode) {
+	enum intr_level old_level = intr_disable ();
+
+	if (inode->open_cnt > 0)
+		inode->open_cnt++;
+	else
+		inode = NULL;
+	intr_set_level (old_level);
 	return inode;
 }
 
@@ -153,9 +227,23 @@ inode_close (struct inode *inode) {
 		return;
 
 	/* Release resources if this was the last opener. */
-	if (--inode->open_cnt == 0) {
-		/* Remove from inode list and release lock. */
-		list_remove (&inode->elem);
+	lock_acquire (&open_inodes_lock);
+	enum intr_level old_level = intr_disable ();
+	bool last = --inode->open_cnt == 0;
+	intr_set_level (old_level);
+	if (last) {
+#ifdef VM
+		/* Nothing maps it any more; drop its cached pages.  This
+		 * happens while INODE is still on the list, so that an
+		 * inode_open() of the same sector waits for the dirty pages
+		 * to reach the disk before reading them. */
+		pagecache_purge (inode, !inode->removed);
+#endif
+
+		/* Remove from inode list and release lock.  Lookups may
+		 * still be looking at INODE, so defer freeing it. */
+		rcu_list_remove (&inode->elem);
+		lock_release (&open_inodes_lock);
 
 		/* Deallocate blocks if removed. */
 		if (inode->removed) {
@@ -164,8 +252,9 @@ inode_close (struct inode *inode) {
 					bytes_to_sectors (inode->data.length)); 
 		}
 
-		free (inode); 
-	}
+		call_rcu (&inode->rcu, free_inode_rcu);
+	} else
+		lock_release (&open_inodes_lock);
 }
 
 /* Marks INODE to be deleted when it is closed by the last caller who
@@ -0,0 +1,59 @@
+#ifndef THREADS_HEAPPROF_H
+#define THREADS_HEAPPROF_H
+
+#include <stdbool.h>
+#include <stddef.h>
+
+/* Allocation-site heap profiling.
+
+   Once heapprof_start(N) has been called, every Nth allocation
+   made through malloc(), calloc(), realloc(), palloc_get_page(),
+   or palloc_get_multiple() is recorded, with the return address
+   of the allocator call as its call site, until the block is
+   freed.  heapprof_print_stats() reports the bytes and blocks
+   attributed to each site.  While profiling is off, the hooks
+   below cost one test of a global. */
+
+/* Which allocator a block came from. */
+enum heapprof_kind {
+	HEAPPROF_MALLOC,            /* malloc() and friends. */
+	HEAPPROF_PALLOC             /* Page allocator. */
+};
+
+/* Sampled counts for one call site. */
+struct heapprof_site {
+	const void *addr;           /* Return address of allocator call. */
+	size_t live_cnt;            /* Sampled blocks not yet freed. */
+	size_t live_bytes;          /* Bytes in those blocks. */
+	size_t total_cnt;           /* Sampled blocks allocated. */
+	size_t total_bytes;         /* Bytes in those blocks. */
+};
+
+/* Sampling period, or 0 if profiling is off. */
+extern unsigned heapprof_period;
+
+void heapprof_start (unsigned period);
+void heapprof_record_alloc (enum heapprof_kind, const void *, size_t size,
+		const void *site);
+void heapprof_record_free (enum heapprof_kind, const void *);
+bool heapprof_lookup (enum heapprof_kind, const void *,
+		struct heapprof_site *);
+void heapprof_print_stats (void);
+
+/* Notes that BLOCK, of SIZE bytes, was allocated by the caller
+   at SITE.  BLOCK may be null. */
+static inline void
+heapprof_alloc (enum heapprof_kind kind, const void *block, size_t size,
+		const void *site) {
+	if (heapprof_period != 0 && block != NULL)
+		heapprof_record_alloc (kind, block, size, site);
+}
+
+/* Notes that BLOCK was freed. */
+static inline void
+heapprof_free (enum heapprof_kind kind, const void *block) {
+	if (heapprof_period != 0)
+		heapprof_record_free (kind, block);
+}
+
+#endif /* threads/heapprof.h */
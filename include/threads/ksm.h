@@ -0,0 +1,45 @@
+#ifndef THREADS_KSM_H
+#define THREADS_KSM_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+/* Kernel same-page merging.
+
+   A process registers ranges of its anonymous memory as
+   mergeable with ksm_register().  A background "ksm" thread then
+   scans them, a batch of pages at a time, and merges pages with
+   identical contents into one shared frame that every one of
+   them maps read-only.  Writing to a merged page faults; the
+   page fault handler then calls ksm_fault(), which gives the
+   writer a private copy again.
+
+   Each mapping of a page in a registered range must own one
+   reference to its frame, in the sense of page_get() and
+   page_put(), and must drop it with page_put() when the page is
+   unmapped, since after merging the frame may be shared.
+
+   Under VM, pages whose frames are in the frame table are merged
+   only with each other, and they share the merged frame
+   copy-on-write just as fork shares frames: the VM page fault
+   handler gives a writer its copy, and supplemental page table
+   teardown drops the references. */
+
+/* Merging statistics. */
+struct ksm_stats {
+	size_t shared_cnt;          /* Frames currently shared. */
+	size_t sharing_cnt;         /* Mappings of those frames. */
+	size_t merge_cnt;           /* Pages merged so far. */
+	size_t unmerge_cnt;         /* Pages unmerged on write so far. */
+	size_t scan_cnt;            /* Full passes over every range. */
+};
+
+bool ksm_register (uint64_t *pml4, void *upage, size_t page_cnt);
+void ksm_unregister (uint64_t *pml4);
+void ksm_scan (size_t page_cnt);
+bool ksm_fault (uint64_t *pml4, void *upage);
+void ksm_get_stats (struct ksm_stats *);
+void ksm_print_stats (void);
+
+#endif /* threads/ksm.h */
@@ -2,19 +2,30 @@
 #define THREAD_MMU_H
 
 #include <stdbool.h>
+#include <stddef.h>
 #include <stdint.h>
 #include "threads/pte.h"
 
 typedef void pte_for_each_func (uint64_t *pte, void *aux);
 
 uint64_t *pml4e_walk (uint64_t *pml4, const uint64_t va, int create);
+uint64_t *pml4e_walk_large (uint64_t *pml4, const uint64_t va);
 uint64_t *pml4_create (void);
 void pml4_for_each (uint64_t *, pte_for_each_func *, void *);
 void pml4_destroy (uint64_t *pml4);
+void pcid_init (void);
 void pml4_activate (uint64_t *pml4);
 void *pml4_get_page (uint64_t *pml4, const void *upage);
 bool pml4_set_page (uint64_t *pml4, void *upage, void *kpage, bool rw);
 void pml4_clear_page (uint64_t *pml4, void *upage);
+bool pml4_map_range (uint64_t *pml4, void *upage, void *kpage,
+		size_t page_cnt, bool rw);
+void pml4_unmap_range (uint64_t *pml4, void *upage, size_t page_cnt);
+void pml4_protect_range (uint64_t *pml4, void *upage, size_t page_cnt,
+		bool rw);
+bool kernel_map_page (void *kva, void *kpage);
+void *kernel_clear_page (void *kva);
+void kernel_tlb_flush (void *kva, size_t page_cnt);
 bool pml4_is_dirty (uint64_t *pml4, const void *upage);
 void pml4_set_dirty (uint64_t *pml4, const void *upage, bool dirty);
 bool pml4_is_accessed (uint64_t *pml4, const void *upage);
@@ -1,6 +1,8 @@
 #ifndef THREADS_PALLOC_H
 #define THREADS_PALLOC_H
 
+#include <list.h>
+#include <stdbool.h>
 #include <stdint.h>
 #include <stddef.h>
 
@@ -11,6 +13,36 @@ enum palloc_flags {
 	PAL_USER = 004              /* User page. */
 };
 
+/* Descriptor of a physical frame in one of the pools.
+   palloc_get_multiple() gives each page it returns a reference
+   count of 1, no flags but PAGE_USER, and no mapping; the rest is
+   up to whoever allocated the page. */
+struct page {
+	struct list_elem lru;       /* LRU list; buddy free list if free. */
+	void *mapping;              /* Owner or reverse mapping, or null. */
+	int32_t refcnt;             /* References, 0 if free. */
+	int16_t order;              /* Order of free block starting here,
+	                               or -1.  Private to palloc.c. */
+	uint16_t flags;             /* PAGE_* flags. */
+};
+
+/* Page flags. */
+#define PAGE_USER 0x1               /* From the user pool. */
+#define PAGE_LRU 0x2                /* LRU is in use by the owner. */
+#define PAGE_LOAN 0x4               /* Lent by the other class's pool. */
+#define PAGE_MOVABLE 0x8            /* MAPPING is a struct page_owner. */
+#define PAGE_KSM 0x10               /* Shared by same-page merging. */
+
+/* Owner of movable pages; see palloc_set_movable(). */
+struct page_owner {
+	/* Copies the contents of PAGE to the free page at NEW_KVA,
+	   redirects every reference to PAGE to NEW_KVA, makes NEW_KVA
+	   movable if it likes, and drops its reference to PAGE with
+	   page_put().  Returns true if successful, false to leave PAGE
+	   where it is. */
+	bool (*migrate) (struct page *, void *new_kva);
+};
+
 /* Maximum number of pages to put in user pool. */
 extern size_t user_page_limit;
 
@@ -19,5 +51,15 @@ void *palloc_get_page (enum palloc_flags);
 void *palloc_get_multiple (enum palloc_flags, size_t page_cnt);
 void palloc_free_page (void *);
 void palloc_free_multiple (void *, size_t page_cnt);
+void palloc_set_owner (void *, size_t page_cnt, void *owner);
+void *palloc_get_owner (const void *);
+void palloc_zero_idle (void);
+void palloc_print_stats (void);
+
+struct page *kva_to_page (const void *kva);
+void *page_to_kva (const struct page *);
+void palloc_set_movable (void *, struct page_owner *);
+void page_get (struct page *);
+void page_put (struct page *);
 
 #endif /* threads/palloc.h */
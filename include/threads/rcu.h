@@ -0,0 +1,66 @@
+#ifndef THREADS_RCU_H
+#define THREADS_RCU_H
+
+#include <list.h>
+#include <stddef.h>
+#include <stdint.h>
+#include "threads/synch.h"
+
+struct thread;
+
+/* Read-copy-update.
+
+   Readers bracket their traversal of an RCU-protected structure
+   with rcu_read_lock() and rcu_read_unlock().  These only touch
+   the running thread's own `struct thread', so concurrent
+   readers never write to any shared memory.  A reader must not
+   sleep inside its read-side critical section; preemption is
+   deferred until the outermost rcu_read_unlock().
+
+   Writers still serialize among themselves with an ordinary lock.
+   After unlinking an element, a writer either waits for all
+   pre-existing readers with synchronize_rcu() and then frees the
+   element itself, or hands the element to call_rcu(), which
+   frees it asynchronously once a grace period has elapsed. */
+
+/* Embedded in an object that is reclaimed with call_rcu(). */
+struct rcu_head {
+	struct list_elem elem;              /* Element in callback list. */
+	void (*func) (struct rcu_head *);   /* Reclaims the object. */
+};
+
+typedef void rcu_callback_func (struct rcu_head *);
+
+/* Converts pointer to rcu_head RCU_HEAD into a pointer to the
+   structure that RCU_HEAD is embedded inside. */
+#define rcu_entry(RCU_HEAD, STRUCT, MEMBER)           \
+	((STRUCT *) ((uint8_t *) (RCU_HEAD)               \
+		- offsetof (STRUCT, MEMBER)))
+
+void rcu_init (void);
+void rcu_read_lock (void);
+void rcu_read_unlock (void);
+void synchronize_rcu (void);
+void call_rcu (struct rcu_head *, rcu_callback_func *);
+void rcu_note_context_switch (struct thread *prev);
+
+/* Loads P exactly once, for following RCU-protected pointers. */
+#define rcu_dereference(P) (*(__typeof__ (P) volatile *) &(P))
+
+/* Stores V into P only after all prior initialization of *V is
+   visible to readers. */
+#define rcu_assign_pointer(P, V) \
+	do { barrier (); *(__typeof__ (P) volatile *) &(P) = (V); } while (0)
+
+/* RCU variants of list operations.  Writers must hold the lock
+   that protects the list; readers may traverse it locklessly
+   with rcu_list_begin() and rcu_list_next() inside
+   rcu_read_lock(). */
+void rcu_list_insert (struct list_elem *before, struct list_elem *);
+void rcu_list_push_front (struct list *, struct list_elem *);
+void rcu_list_push_back (struct list *, struct list_elem *);
+void rcu_list_remove (struct list_elem *);
+struct list_elem *rcu_list_begin (struct list *);
+struct list_elem *rcu_list_next (struct list_elem *);
+
+#endif /* threads/rcu.h */
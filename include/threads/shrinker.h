@@ -0,0 +1,37 @@
+#ifndef THREADS_SHRINKER_H
+#define THREADS_SHRINKER_H
+
+#include <list.h>
+#include <stddef.h>
+
+/* Memory-pressure callbacks.
+
+   A cache that holds on to memory it could give back registers a
+   shrinker.  When the page allocator cannot satisfy a request, it
+   calls shrink_memory(), which asks each shrinker in turn to free
+   pages until enough have been freed, and then retries.
+
+   Shrinkers run in the context of the failing allocation, which
+   may hold any lock, including the shrinker's own cache's.  They
+   must therefore never block: they take their locks with
+   lock_try_acquire(), skip whatever they cannot lock, and must
+   not allocate memory. */
+
+struct shrinker {
+	/* Returns roughly how many pages the cache could free now. */
+	size_t (*count) (struct shrinker *);
+
+	/* Frees up to PAGE_CNT pages and returns how many it freed. */
+	size_t (*scan) (struct shrinker *, size_t page_cnt);
+
+	const char *name;           /* For statistics. */
+	size_t freed_cnt;           /* Pages freed so far. */
+	struct list_elem elem;      /* Element in list of shrinkers. */
+};
+
+void shrinker_register (struct shrinker *);
+void shrinker_unregister (struct shrinker *);
+size_t shrink_memory (size_t page_cnt);
+void shrinker_print_stats (void);
+
+#endif /* threads/shrinker.h */
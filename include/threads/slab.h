@@ -0,0 +1,28 @@
+#ifndef THREADS_SLAB_H
+#define THREADS_SLAB_H
+
+#include <stddef.h>
+
+/* Object caches.
+
+   A cache hands out objects of one fixed size, packed into
+   single-page "slabs" without rounding the size up to a power of
+   two.  If the cache has a constructor, each object is
+   constructed once, when its slab is created, and the cache
+   never writes to a freed object, so an object returned by
+   kmem_cache_alloc() is in whatever state it was last freed in.
+   Callers must therefore free objects only in their constructed
+   state. */
+
+struct kmem_cache;
+
+typedef void kmem_ctor_func (void *);
+
+struct kmem_cache *kmem_cache_create (const char *name, size_t size,
+		size_t align, kmem_ctor_func *);
+void kmem_cache_destroy (struct kmem_cache *);
+void *kmem_cache_alloc (struct kmem_cache *);
+void kmem_cache_free (struct kmem_cache *, void *);
+void kmem_cache_print_stats (void);
+
+#endif /* threads/slab.h */
@@ -3,15 +3,33 @@
 
 #include <list.h>
 #include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+/* Contention statistics of a named semaphore or lock.
+   Only recorded while lock profiling is on; see
+   lock_profile_start(). */
+struct sync_stats {
+	const char *name;           /* Name. */
+	struct list_elem elem;      /* Element in list of named objects. */
+	uint64_t acquire_cnt;       /* Number of downs or acquires. */
+	uint64_t contend_cnt;       /* Number of those that had to wait. */
+	uint64_t wait_total;        /* Total cycles spent waiting. */
+	uint64_t wait_max;          /* Longest single wait, in cycles. */
+	uint64_t hold_max;          /* Longest hold, in cycles (locks only). */
+};
 
 /* A counting semaphore. */
 struct semaphore {
 	unsigned value;             /* Current value. */
 	struct list waiters;        /* List of waiting threads. */
+	struct sync_stats *stats;   /* Statistics, if named, else null. */
 };
 
 void sema_init (struct semaphore *, unsigned value);
+void sema_init_named (struct semaphore *, unsigned value, const char *name);
 void sema_down (struct semaphore *);
+bool sema_down_timeout (struct semaphore *, int64_t ticks);
 bool sema_try_down (struct semaphore *);
 void sema_up (struct semaphore *);
 void sema_self_test (void);
@@ -20,10 +38,13 @@ void sema_self_test (void);
 struct lock {
 	struct thread *holder;      /* Thread holding lock (for debugging). */
 	struct semaphore semaphore; /* Binary semaphore controlling access. */
+	uint64_t hold_start;        /* Cycle count at acquire, if profiled. */
 };
 
 void lock_init (struct lock *);
+void lock_init_named (struct lock *, const char *name);
 void lock_acquire (struct lock *);
+bool lock_acquire_timeout (struct lock *, int64_t ticks);
 bool lock_try_acquire (struct lock *);
 void lock_release (struct lock *);
 bool lock_held_by_current_thread (const struct lock *);
@@ -35,9 +56,14 @@ struct condition {
 
 void cond_init (struct condition *);
 void cond_wait (struct condition *, struct lock *);
+bool cond_timedwait (struct condition *, struct lock *, int64_t ticks);
 void cond_signal (struct condition *, struct lock *);
 void cond_broadcast (struct condition *, struct lock *);
 
+/* Lock profiling. */
+void lock_profile_start (size_t top_cnt);
+void lock_print_stats (void);
+
 /* Optimization barrier.
  *
  * The compiler will not reorder operations across an
@@ -5,6 +5,9 @@
 #include <list.h>
 #include <stdint.h>
 #include "threads/interrupt.h"
+#ifdef VM
+#include "vm/vm.h"
+#endif
 
 /* States in a thread's life cycle. */
 enum thread_status {
@@ -88,14 +91,25 @@ struct thread {
 	char name[16];                      /* Name (for debugging purposes). */
 	int priority;                       /* Priority. */
 	int64_t alarm;						/* Used for alarm ticks. */
+	int rcu_nesting;                    /* Depth of RCU read-side sections. */
 
 	/* Shared between thread.c and synch.c. */
 	struct list_elem elem;              /* List element. */
+	struct list_elem sleep_elem;        /* Element in sleep list. */
+	bool timed_wait;                    /* Blocked on `elem' with a deadline? */
+	bool timed_out;                     /* Did the last timed wait expire? */
+
+	/* Owned by threads/malloc.c. */
+	struct malloc_cache *malloc_cache;  /* Free blocks for this thread. */
 
-#ifdef USERPROG
+#if defined USERPROG || defined VM
 	/* Owned by userprog/process.c. */
 	uint64_t *pml4;                     /* Page map level 4 */
 #endif
+#ifdef VM
+	/* Owned by vm/vm.c. */
+	struct supplemental_page_table spt; /* User pages, by address. */
+#endif
 
 	/* Owned by thread.c. */
 	struct intr_frame tf;               /* Information for switching */
@@ -117,12 +131,14 @@ void thread_init (void);
 void thread_start (void);
 
 void thread_tick (void);
+bool thread_slice_expired (void);
 void thread_print_stats (void);
 
 typedef void thread_func (void *aux);
 tid_t thread_create (const char *name, int priority, thread_func *, void *);
 
 void thread_block (void);
+bool thread_block_timeout (int64_t ticks);
 void thread_unblock (struct thread *);
 
 struct thread *thread_current (void);
@@ -0,0 +1,34 @@
+#ifndef THREADS_VMALLOC_H
+#define THREADS_VMALLOC_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+/* Virtually contiguous kernel allocations.
+
+   vmalloc() backs a request with individual pages from the
+   kernel pool, which need not be physically contiguous, and maps
+   them at consecutive addresses in a reserved range of kernel
+   virtual memory.  It suits large buffers that are only accessed
+   through their virtual addresses; the memory cannot be handed
+   to a device or converted with vtop(). */
+
+/* Reserved kernel virtual address range: 1 GB, starting 256 GB
+   into the PML4 slot that holds the kernel's direct map, so that
+   every pml4 shares its page tables. */
+#define VMALLOC_START ((uint8_t *) 0xc000000000)
+#define VMALLOC_END (VMALLOC_START + (1UL << 30))
+
+void vmalloc_init (void);
+void *vmalloc (size_t size);
+void vfree (void *);
+
+/* Returns true if VADDR lies in the vmalloc() range. */
+static inline bool
+is_vmalloc_vaddr (const void *vaddr) {
+	return (const uint8_t *) vaddr >= VMALLOC_START
+		&& (const uint8_t *) vaddr < VMALLOC_END;
+}
+
+#endif /* threads/vmalloc.h */
@@ -0,0 +1,20 @@
+#ifndef VM_FRAME_H
+#define VM_FRAME_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include "threads/synch.h"
+
+struct vm_entry;
+
+/* Held while a user page is brought in, evicted, or freed, so
+   that no page is ever seen half loaded or half evicted. */
+extern struct lock frame_lock;
+
+void frame_init (void);
+void *frame_alloc (struct vm_entry *, bool zero);
+void frame_free (void *kpage);
+size_t frame_evict_count (void);
+void frame_print_stats (void);
+
+#endif /* vm/frame.h */
@@ -0,0 +1,13 @@
+#ifndef VM_MMAP_H
+#define VM_MMAP_H
+
+#include <stddef.h>
+#include "filesys/off_t.h"
+
+struct file;
+
+void *do_mmap (void *addr, size_t length, int writable, struct file *,
+		off_t offset);
+void do_munmap (void *addr);
+
+#endif /* vm/mmap.h */
@@ -0,0 +1,35 @@
+#ifndef VM_PAGECACHE_H
+#define VM_PAGECACHE_H
+
+#include <stdbool.h>
+#include <stddef.h>
+
+struct inode;
+struct vm_entry;
+
+/* Page cache.
+
+   Holds file pages, keyed by inode and page index, for shared
+   file mappings.  Every mapping of a page maps the cached frame
+   itself, so mappings of one file share frames, and file data is
+   read and written straight between the frame and the disk.
+
+   The cache maps and unmaps VM_MMAP pages itself, and keeps track
+   of the mappings of each page, so that it can take frames back
+   from them.  A mapping learns whether it wrote to a page only
+   from its PTE's dirty bit, which is folded into the page's own
+   when the mapping goes away.  Dirty pages are written back by
+   pagecache_writeback(), when the inode is closed for the last
+   time, and when their frames are reclaimed.  Under memory
+   pressure, the cache's shrinker unmaps and frees clean pages
+   that their mappings have not used lately. */
+
+void pagecache_init (void);
+bool pagecache_map (struct vm_entry *);
+bool pagecache_map_cached (struct vm_entry *);
+bool pagecache_unmap (struct vm_entry *);
+void pagecache_writeback (struct inode *, size_t idx);
+void pagecache_purge (struct inode *, bool writeback);
+void pagecache_print_stats (void);
+
+#endif /* vm/pagecache.h */
@@ -0,0 +1,123 @@
+#ifndef VM_VM_H
+#define VM_VM_H
+
+#include <hash.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include "filesys/off_t.h"
+
+struct file;
+struct inode;
+struct intr_frame;
+
+/* Demand paging.
+
+   A process's user pages are not given frames when they are set
+   up.  Instead, each one is recorded in the process's
+   supplemental page table, which says where its contents come
+   from, and is loaded by the page fault handler the first time
+   it is touched.  Pages that are never touched are never read.
+
+   Resident pages are tracked in the frame table (see frame.h),
+   which evicts them when user memory runs out: a clean file page
+   is dropped, to be read again, and any other page goes to swap
+   and becomes VM_ANON.
+
+   Fork shares the parent's resident frames with the child
+   instead of copying them: both map each frame read-only, and
+   the frame's reference count counts its sharers.  A write to a
+   shared page faults, and vm_try_handle_fault() gives the writer
+   its own copy, or, if it is the last sharer, just makes the
+   page writable again.  Shared frames are not evicted.  Pages
+   merged by KSM (see threads/ksm.h) share frames the same way,
+   except that KSM holds a reference of its own to each of them.
+
+   File mappings made with mmap() are VM_MMAP pages, which map
+   frames of the page cache (see pagecache.h) instead of frames
+   of their own, so they are shared with every other mapping of
+   the same file and are never in the frame table; the page cache
+   takes them back itself (see pagecache.h).  Read-only
+   whole pages of a lazily loaded segment are VM_MMAP pages too,
+   so processes running one executable share its text.
+
+   A fault on a VM_MMAP page also maps the pages around it that
+   are already in the page cache, up to vm_fault_around pages in
+   all, so that a sequential scan takes one fault per window
+   instead of one per page. */
+
+/* Where a page's contents come from. */
+enum vm_type {
+	VM_ZERO,                    /* All zeros: bss, stack. */
+	VM_FILE,                    /* Read from a file, rest zeroed. */
+	VM_ANON,                    /* In its frame or in swap. */
+	VM_MMAP                     /* Shared mapping of a file. */
+};
+
+/* One user page in a supplemental page table. */
+struct vm_entry {
+	struct hash_elem elem;      /* Element in the table. */
+	uint64_t *pml4;             /* Page map that maps it. */
+	void *upage;                /* User virtual page. */
+	enum vm_type type;          /* Where the contents come from. */
+	bool writable;              /* Mapped read/write? */
+	void *kpage;                /* Frame, or null if not resident. */
+	struct vm_entry *sharer;    /* Next entry sharing KPAGE, in a ring. */
+
+	/* VM_FILE and VM_MMAP only. */
+	struct inode *inode;        /* File, held open. */
+	off_t ofs;                  /* Offset in the file. */
+	size_t read_bytes;          /* VM_FILE: bytes to read; rest zero. */
+	size_t mmap_cnt;            /* VM_MMAP: pages in the mapping, if
+	                               this is its first page, else 0. */
+	struct list_elem pc_elem;   /* VM_MMAP, if mapped: element in its
+	                               cached page's list of mappings. */
+
+	/* VM_ANON only. */
+	size_t swap_slot;           /* Swap slot, if not resident. */
+};
+
+/* Size of the aligned window of pages mapped around a fault, a
+   power of two.  1 turns fault-around off. */
+extern unsigned vm_fault_around;
+
+/* Paging statistics. */
+struct vm_stats {
+	size_t fault_cnt;           /* Page faults handled. */
+	size_t file_cnt;            /* Pages read from files. */
+	size_t zero_cnt;            /* Zero pages given frames. */
+	size_t share_cnt;           /* Frames shared by fork. */
+	size_t cow_cnt;             /* Pages copied on write. */
+	size_t mmap_cnt;            /* Mapped file pages faulted in. */
+	size_t around_cnt;          /* Pages mapped around faults. */
+	size_t evict_cnt;           /* Pages evicted from frames. */
+};
+
+/* The pages of one process, keyed by user virtual address. */
+struct supplemental_page_table {
+	struct hash entries;
+};
+
+void vm_init (void);
+void supplemental_page_table_init (struct supplemental_page_table *);
+bool supplemental_page_table_copy (struct supplemental_page_table *dst,
+		struct supplemental_page_table *src);
+void supplemental_page_table_kill (struct supplemental_page_table *);
+void vm_merge_frame (void *kpage, void *shared);
+struct vm_entry *spt_find_page (struct supplemental_page_table *,
+		void *va);
+
+bool vm_alloc_zero (void *upage, bool writable);
+bool vm_alloc_file (void *upage, bool writable, struct file *, off_t ofs,
+		size_t read_bytes);
+bool vm_alloc_mmap (void *upage, bool writable, struct inode *, off_t ofs);
+void vm_free_page (void *upage);
+bool vm_load_segment (struct file *, off_t ofs, uint8_t *upage,
+		size_t read_bytes, size_t zero_bytes, bool writable);
+bool vm_claim_page (void *upage);
+bool vm_try_handle_fault (struct intr_frame *, void *addr, bool user,
+		bool write, bool not_present);
+void vm_get_stats (struct vm_stats *);
+void vm_print_stats (void);
+
+#endif /* vm/vm.h */
@@ -0,0 +1,98 @@
+/* Tests the allocation-site heap profiler: with every allocation
+   sampled, blocks are charged to the site that allocated them,
+   freeing a block uncharges it, an in-place realloc() moves the
+   block to the realloc() site, and pages are profiled apart from
+   malloc() blocks. */
+
+#include <stdint.h>
+#include <stdio.h>
+#include "tests/threads/tests.h"
+#include "threads/heapprof.h"
+#include "threads/malloc.h"
+#include "threads/palloc.h"
+#include "threads/vaddr.h"
+
+#define BLOCK_CNT 3             /* Blocks allocated at one site. */
+#define BLOCK_SIZE 100          /* Bytes in each block. */
+
+/* Returns true if BLOCK, of KIND, is in the profiler's table
+   of live blocks. */
+static bool
+sampled (enum heapprof_kind kind, const void *block) 
+{
+  struct heapprof_site s;
+
+  return heapprof_lookup (kind, block, &s);
+}
+
+/* Checks that BLOCK, of KIND, was charged to a site with
+   LIVE_CNT blocks of LIVE_BYTES live, out of TOTAL_CNT
+   allocated, and returns the site's address. */
+static const void *
+check_site (enum heapprof_kind kind, const void *block, size_t live_cnt,
+            size_t live_bytes, size_t total_cnt) 
+{
+  struct heapprof_site s;
+
+  if (!heapprof_lookup (kind, block, &s))
+    fail ("block %p was not sampled", block);
+  if (s.live_cnt != live_cnt || s.live_bytes != live_bytes
+      || s.total_cnt != total_cnt)
+    fail ("site %p has %zu live blocks of %zu bytes out of %zu, "
+          "expected %zu of %zu out of %zu", s.addr, s.live_cnt,
+          s.live_bytes, s.total_cnt, live_cnt, live_bytes, total_cnt);
+  return s.addr;
+}
+
+void
+test_heapprof (void) 
+{
+  char *blocks[BLOCK_CNT], *resized;
+  const void *malloc_site, *realloc_site;
+  uintptr_t old;
+  void *page;
+  size_t i;
+
+  heapprof_start (1);
+
+  for (i = 0; i < BLOCK_CNT; i++) 
+    {
+      blocks[i] = malloc (BLOCK_SIZE);
+      if (blocks[i] == NULL)
+        fail ("out of memory");
+    }
+  malloc_site = check_site (HEAPPROF_MALLOC, blocks[0], BLOCK_CNT,
+                            BLOCK_CNT * BLOCK_SIZE, BLOCK_CNT);
+  msg ("%d blocks charged to one site.", BLOCK_CNT);
+
+  free (blocks[1]);
+  check_site (HEAPPROF_MALLOC, blocks[0], BLOCK_CNT - 1,
+              (BLOCK_CNT - 1) * BLOCK_SIZE, BLOCK_CNT);
+  msg ("free() uncharged the block.");
+
+  old = (uintptr_t) blocks[2];
+  resized = realloc (blocks[2], BLOCK_SIZE / 2);
+  if ((uintptr_t) resized != old)
+    fail ("shrinking realloc() moved the block");
+  blocks[2] = resized;
+  realloc_site = check_site (HEAPPROF_MALLOC, blocks[2], 1, BLOCK_SIZE / 2, 1);
+  if (realloc_site == malloc_site)
+    fail ("realloc() charged to the malloc() site");
+  check_site (HEAPPROF_MALLOC, blocks[0], 1, BLOCK_SIZE, BLOCK_CNT);
+  msg ("in-place realloc() moved the block to its own site.");
+
+  page = palloc_get_page (0);
+  if (page == NULL)
+    fail ("out of memory");
+  check_site (HEAPPROF_PALLOC, page, 1, PGSIZE, 1);
+  if (sampled (HEAPPROF_MALLOC, page))
+    fail ("page profiled as a malloc() block");
+  palloc_free_page (page);
+  if (sampled (HEAPPROF_PALLOC, page))
+    fail ("freed page still profiled");
+  msg ("page profiled apart from malloc() blocks.");
+
+  free (blocks[0]);
+  free (blocks[2]);
+  pass ();
+}
@@ -0,0 +1,14 @@
+# -*- perl -*-
+use strict;
+use warnings;
+use tests::tests;
+check_expected ([<<'EOF']);
+(heapprof) begin
+(heapprof) 3 blocks charged to one site.
+(heapprof) free() uncharged the block.
+(heapprof) in-place realloc() moved the block to its own site.
+(heapprof) page profiled apart from malloc() blocks.
+(heapprof) PASS
+(heapprof) end
+EOF
+pass;
@@ -0,0 +1,106 @@
+/* Tests same-page merging: identical pages in a registered range
+   end up sharing one read-only frame, a write fault gives the
+   writer its own copy back, and shared frames are freed once
+   nothing maps them. */
+
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+#include "tests/threads/tests.h"
+#include "threads/ksm.h"
+#include "threads/mmu.h"
+#include "threads/palloc.h"
+#include "threads/vaddr.h"
+
+#define PAGE_CNT 8              /* Pages in the range. */
+#define UPAGE ((uint8_t *) 0x10000000)
+
+/* Contents of each page: pages 0 to 3 are zeroed, pages 4 and 5
+   are filled with 'a', and pages 6 and 7 are unique. */
+static const char fill[PAGE_CNT] = {0, 0, 0, 0, 'a', 'a', 'b', 'c'};
+
+static void *
+frame (uint64_t *pml4, size_t idx) 
+{
+  return pml4_get_page (pml4, UPAGE + idx * PGSIZE);
+}
+
+static bool
+writable (uint64_t *pml4, size_t idx) 
+{
+  return (*pml4e_walk (pml4, (uint64_t) (UPAGE + idx * PGSIZE), 0)
+          & PTE_W) != 0;
+}
+
+void
+test_ksm (void) 
+{
+  struct ksm_stats before, after;
+  uint64_t *pml4;
+  size_t i;
+
+  pml4 = pml4_create ();
+  if (pml4 == NULL)
+    fail ("out of memory");
+  for (i = 0; i < PAGE_CNT; i++) 
+    {
+      uint8_t *kpage = palloc_get_page (PAL_USER | PAL_ZERO);
+      if (kpage == NULL || !pml4_set_page (pml4, UPAGE + i * PGSIZE,
+                                           kpage, true))
+        fail ("out of memory");
+      memset (kpage, fill[i], PGSIZE);
+    }
+  if (!ksm_register (pml4, UPAGE, PAGE_CNT))
+    fail ("ksm_register() failed");
+  ksm_get_stats (&before);
+
+  /* The first pass only records hashes; the second merges. */
+  ksm_scan (2 * PAGE_CNT);
+  ksm_get_stats (&after);
+  if (after.merge_cnt - before.merge_cnt != 4)
+    fail ("merged %zu pages instead of 4",
+          after.merge_cnt - before.merge_cnt);
+  if (after.shared_cnt - before.shared_cnt != 2
+      || after.sharing_cnt - before.sharing_cnt != 6)
+    fail ("%zu frames shared by %zu mappings instead of 2 by 6",
+          after.shared_cnt - before.shared_cnt,
+          after.sharing_cnt - before.sharing_cnt);
+  for (i = 0; i < PAGE_CNT; i++) 
+    {
+      size_t twin = i < 4 ? 0 : i < 6 ? 4 : i;
+      if (frame (pml4, i) != frame (pml4, twin)
+          || writable (pml4, i) != (i >= 6))
+        fail ("page %zu is mapped wrong", i);
+    }
+  msg ("merged 6 pages into 2 shared frames.");
+
+  if (ksm_fault (pml4, UPAGE + 6 * PGSIZE))
+    fail ("ksm_fault() unmerged a private page");
+  if (!ksm_fault (pml4, UPAGE + 2 * PGSIZE + 123))
+    fail ("ksm_fault() failed");
+  if (frame (pml4, 2) == frame (pml4, 0) || !writable (pml4, 2))
+    fail ("page 2 is still shared");
+  memset (frame (pml4, 2), 'x', PGSIZE);
+  if (*(uint8_t *) frame (pml4, 0) != 0 || *(uint8_t *) frame (pml4, 3) != 0)
+    fail ("write to unmerged page 2 showed through");
+  ksm_get_stats (&after);
+  if (after.unmerge_cnt - before.unmerge_cnt != 1)
+    fail ("unmerged %zu pages instead of 1",
+          after.unmerge_cnt - before.unmerge_cnt);
+  msg ("write fault gave page 2 a private copy.");
+
+  ksm_unregister (pml4);
+  for (i = 0; i < PAGE_CNT; i++) 
+    {
+      void *kpage = frame (pml4, i);
+      pml4_clear_page (pml4, UPAGE + i * PGSIZE);
+      page_put (kva_to_page (kpage));
+    }
+  pml4_destroy (pml4);
+  ksm_scan (1);
+  ksm_get_stats (&after);
+  if (after.shared_cnt != before.shared_cnt)
+    fail ("%zu shared frames left over", after.shared_cnt - before.shared_cnt);
+  msg ("freed the shared frames once unmapped.");
+  pass ();
+}
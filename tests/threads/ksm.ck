@@ -0,0 +1,13 @@
+# -*- perl -*-
+use strict;
+use warnings;
+use tests::tests;
+check_expected ([<<'EOF']);
+(ksm) begin
+(ksm) merged 6 pages into 2 shared frames.
+(ksm) write fault gave page 2 a private copy.
+(ksm) freed the shared frames once unmapped.
+(ksm) PASS
+(ksm) end
+EOF
+pass;
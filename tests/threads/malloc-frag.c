@@ -0,0 +1,153 @@
+/* Measures how much memory malloc() uses to hold a synthetic
+   allocation trace, and checks that the blocks it returns do
+   not overlap.
+
+   The trace keeps LIVE_CNT blocks alive.  Sizes are drawn from a
+   mix of small (up to 256 bytes), medium (up to 4 kB) and large
+   (up to 16 kB) requests.  After the initial fill, each step
+   either frees a random block and allocates a new one in its
+   place, or grows a random block by an eighth with realloc().
+   At the end the test reports the bytes requested by live
+   blocks, the kernel pages consumed to hold them, the resulting
+   overhead, and how many realloc() calls kept their block in
+   place. */
+
+#include <random.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+#include "tests/threads/tests.h"
+#include "threads/malloc.h"
+#include "threads/palloc.h"
+#include "threads/vaddr.h"
+
+#define LIVE_CNT 1000           /* Blocks alive at once. */
+#define STEP_CNT 10000          /* Trace steps after the fill. */
+#define SEED 332                /* Random seed. */
+
+/* A live block. */
+struct live 
+  {
+    uint8_t *p;                 /* Block, filled with TAG. */
+    size_t size;                /* Requested size. */
+    uint8_t tag;                /* Fill byte. */
+  };
+
+static struct live live[LIVE_CNT];
+
+/* Returns the number of free pages in the kernel pool. */
+static size_t
+kernel_free_pages (void) 
+{
+  void *head = NULL;
+  void *page;
+  size_t cnt = 0;
+
+  while ((page = palloc_get_page (0)) != NULL) 
+    {
+      *(void **) page = head;
+      head = page;
+      cnt++;
+    }
+  while (head != NULL) 
+    {
+      page = head;
+      head = *(void **) page;
+      palloc_free_page (page);
+    }
+  return cnt;
+}
+
+/* Returns a random request size. */
+static size_t
+random_size (void) 
+{
+  unsigned long kind = random_ulong () % 10;
+
+  if (kind < 6)
+    return 8 + random_ulong () % 249;
+  else if (kind < 9)
+    return 257 + random_ulong () % 3840;
+  else
+    return 4097 + random_ulong () % 12288;
+}
+
+/* Checks that L still holds its fill byte. */
+static void
+check_block (const struct live *l) 
+{
+  size_t i;
+
+  for (i = 0; i < l->size; i++)
+    if (l->p[i] != l->tag)
+      fail ("block %p of %zu bytes overwritten at offset %zu",
+            l->p, l->size, i);
+}
+
+/* Allocates a new block for L. */
+static void
+alloc_block (struct live *l, uint8_t tag) 
+{
+  l->size = random_size ();
+  l->p = malloc (l->size);
+  if (l->p == NULL)
+    fail ("malloc() of %zu bytes failed", l->size);
+  l->tag = tag;
+  memset (l->p, tag, l->size);
+}
+
+void
+test_malloc_frag (void) 
+{
+  size_t free_before, pages, requested = 0;
+  int reallocs = 0, in_place = 0;
+  int i;
+
+  random_init (SEED);
+  free_before = kernel_free_pages ();
+
+  for (i = 0; i < LIVE_CNT; i++)
+    alloc_block (&live[i], i);
+
+  for (i = 0; i < STEP_CNT; i++) 
+    {
+      struct live *l = &live[random_ulong () % LIVE_CNT];
+
+      check_block (l);
+      if (random_ulong () % 4 == 0) 
+        {
+          size_t new_size = l->size + l->size / 8 + 1;
+          uint8_t *p = realloc (l->p, new_size);
+          if (p == NULL)
+            fail ("realloc() to %zu bytes failed", new_size);
+          reallocs++;
+          if (p == l->p)
+            in_place++;
+          memset (p + l->size, l->tag, new_size - l->size);
+          l->p = p;
+          l->size = new_size;
+        }
+      else 
+        {
+          free (l->p);
+          alloc_block (l, i);
+        }
+    }
+
+  for (i = 0; i < LIVE_CNT; i++) 
+    {
+      check_block (&live[i]);
+      requested += live[i].size;
+    }
+  pages = free_before - kernel_free_pages ();
+  msg ("%zu bytes requested in %d blocks, %zu pages used",
+       requested, LIVE_CNT, pages);
+  msg ("overhead: %zu%% of used memory",
+       (pages * PGSIZE - requested) * 100 / (pages * PGSIZE));
+  msg ("realloc(): %d of %d calls kept the block in place",
+       in_place, reallocs);
+
+  for (i = 0; i < LIVE_CNT; i++)
+    free (live[i].p);
+  pass ();
+}
@@ -0,0 +1,79 @@
+/* Tests pml4_map_range(), pml4_protect_range() and
+   pml4_unmap_range() on a range that spans several page tables,
+   and checks that unmapping everything frees all the page tables
+   that held the range. */
+
+#include <stdint.h>
+#include <stdio.h>
+#include "tests/threads/tests.h"
+#include "threads/mmu.h"
+#include "threads/palloc.h"
+#include "threads/vaddr.h"
+
+#define PAGE_CNT 1100           /* Pages in the range. */
+
+/* Starts 100 pages below a page table boundary, so that the
+   range touches three page tables. */
+#define UPAGE ((uint8_t *) 0x10000000 - 100 * PGSIZE)
+
+/* Checks that page IDX of the range maps to page IDX of KPAGES,
+   writable if WRITABLE, or is unmapped if MAPPED is false. */
+static void
+check_page (uint64_t *pml4, uint8_t *kpages, size_t idx, bool mapped,
+            bool writable) 
+{
+  void *upage = UPAGE + idx * PGSIZE;
+  void *kpage = pml4_get_page (pml4, upage);
+
+  if (!mapped) 
+    {
+      if (kpage != NULL)
+        fail ("page %zu still mapped", idx);
+      return;
+    }
+  if (kpage != kpages + idx * PGSIZE)
+    fail ("page %zu maps to %p instead of %p",
+          idx, kpage, kpages + idx * PGSIZE);
+  if (((*pml4e_walk (pml4, (uint64_t) upage, 0) & PTE_W) != 0) != writable)
+    fail ("page %zu has the wrong protection", idx);
+}
+
+void
+test_mmu_range (void) 
+{
+  uint64_t *pml4;
+  uint8_t *kpages;
+  size_t i;
+
+  pml4 = pml4_create ();
+  kpages = palloc_get_multiple (PAL_ZERO, PAGE_CNT);
+  if (pml4 == NULL || kpages == NULL)
+    fail ("out of memory");
+
+  if (!pml4_map_range (pml4, UPAGE, kpages, PAGE_CNT, true))
+    fail ("pml4_map_range() failed");
+  for (i = 0; i < PAGE_CNT; i++)
+    check_page (pml4, kpages, i, true, true);
+  msg ("mapped %d pages.", PAGE_CNT);
+
+  pml4_protect_range (pml4, UPAGE + 50 * PGSIZE, 200, false);
+  for (i = 0; i < PAGE_CNT; i++)
+    check_page (pml4, kpages, i, true, i < 50 || i >= 250);
+  msg ("write-protected 200 pages.");
+
+  pml4_unmap_range (pml4, UPAGE, PAGE_CNT / 2);
+  for (i = 0; i < PAGE_CNT; i++)
+    check_page (pml4, kpages, i, i >= PAGE_CNT / 2, i >= 250);
+  msg ("unmapped the first half.");
+
+  pml4_unmap_range (pml4, UPAGE + PAGE_CNT / 2 * PGSIZE, PAGE_CNT / 2);
+  for (i = 0; i < PAGE_CNT; i++)
+    check_page (pml4, kpages, i, false, false);
+  if (pml4[0] != 0)
+    fail ("page tables were not freed");
+  msg ("unmapped the second half and freed its page tables.");
+
+  pml4_destroy (pml4);
+  palloc_free_multiple (kpages, PAGE_CNT);
+  pass ();
+}
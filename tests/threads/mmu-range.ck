@@ -0,0 +1,14 @@
+# -*- perl -*-
+use strict;
+use warnings;
+use tests::tests;
+check_expected ([<<'EOF']);
+(mmu-range) begin
+(mmu-range) mapped 1100 pages.
+(mmu-range) write-protected 200 pages.
+(mmu-range) unmapped the first half.
+(mmu-range) unmapped the second half and freed its page tables.
+(mmu-range) PASS
+(mmu-range) end
+EOF
+pass;
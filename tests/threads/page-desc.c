@@ -0,0 +1,63 @@
+/* Tests the page descriptor array: kva_to_page() and
+   page_to_kva() are inverses, newly allocated pages have one
+   reference and the right flags, and page_put() frees a page
+   only when its last reference goes away. */
+
+#include <stdint.h>
+#include <stdio.h>
+#include "tests/threads/tests.h"
+#include "threads/palloc.h"
+#include "threads/vaddr.h"
+
+#define PAGE_CNT 5              /* Pages in the multi-page block. */
+
+void
+test_page_desc (void) 
+{
+  uint8_t *kpages, *upage;
+  struct page *page;
+  int i;
+
+  kpages = palloc_get_multiple (0, PAGE_CNT);
+  upage = palloc_get_page (PAL_USER);
+  if (kpages == NULL || upage == NULL)
+    fail ("out of memory");
+
+  for (i = 0; i < PAGE_CNT; i++) 
+    {
+      page = kva_to_page (kpages + i * PGSIZE + 123);
+      if (page_to_kva (page) != kpages + i * PGSIZE)
+        fail ("page %d does not map back to its address", i);
+      if (page->refcnt != 1 || page->flags != 0 || page->mapping != NULL)
+        fail ("kernel page %d not initialized", i);
+    }
+  if (kva_to_page (kpages + PGSIZE) != kva_to_page (kpages) + 1)
+    fail ("descriptors of adjacent pages not adjacent");
+  msg ("kernel pages described.");
+
+  page = kva_to_page (upage);
+  if (page_to_kva (page) != upage)
+    fail ("user page does not map back to its address");
+  if (page->refcnt != 1 || page->flags != PAGE_USER)
+    fail ("user page not initialized");
+  msg ("user page described.");
+
+  palloc_set_owner (kpages, PAGE_CNT, &kpages);
+  if (kva_to_page (kpages + (PAGE_CNT - 1) * PGSIZE)->mapping != &kpages)
+    fail ("owner not recorded in mapping");
+  palloc_free_multiple (kpages, PAGE_CNT);
+  if (kva_to_page (kpages)->refcnt != 0
+      || kva_to_page (kpages)->mapping != NULL)
+    fail ("freed page still referenced");
+  msg ("freed pages have no references.");
+
+  page_get (page);
+  page_put (page);
+  if (page->refcnt != 1)
+    fail ("page_put() dropped the wrong number of references");
+  page_put (page);
+  if (page->refcnt != 0)
+    fail ("last page_put() did not free the page");
+  msg ("shared page freed after its last reference.");
+  pass ();
+}
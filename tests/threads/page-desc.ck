@@ -0,0 +1,14 @@
+# -*- perl -*-
+use strict;
+use warnings;
+use tests::tests;
+check_expected ([<<'EOF']);
+(page-desc) begin
+(page-desc) kernel pages described.
+(page-desc) user page described.
+(page-desc) freed pages have no references.
+(page-desc) shared page freed after its last reference.
+(page-desc) PASS
+(page-desc) end
+EOF
+pass;
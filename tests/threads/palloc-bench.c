@@ -0,0 +1,193 @@
+/* Compares the buddy page allocator behind palloc_get_multiple()
+   against the linear bitmap scan it replaced, on the same
+   synthetic workload of multi-page allocations.
+
+   Both allocators manage as many pages as the user pool holds.
+   After filling three quarters of them, the workload repeatedly
+   frees a random live allocation and requests a new one of 1 to
+   MAX_RUN pages.  For each allocator it reports the average and
+   worst allocation latency in CPU cycles and how many requests
+   failed despite enough free pages in total, which is a measure
+   of external fragmentation.
+
+   The bitmap allocator here only does bookkeeping, exactly as the
+   old palloc did under its pool lock: bitmap_scan_and_flip()
+   from bit 0 on allocation and bitmap_set_multiple() on free. */
+
+#include <bitmap.h>
+#include <random.h>
+#include <stdio.h>
+#include "tests/threads/tests.h"
+#include "threads/malloc.h"
+#include "threads/palloc.h"
+#include "intrinsic.h"
+
+#define MAX_RUN 16              /* Largest request, in pages. */
+#define MAX_LIVE 4096           /* Most allocations live at once. */
+#define CHURN_OPS 20000         /* Free/allocate pairs to time. */
+#define SEED 330                /* Random seed shared by both runs. */
+
+/* One allocator under test. */
+struct allocator 
+  {
+    const char *name;
+    bool (*alloc) (size_t page_cnt, uintptr_t *handle);
+    void (*free) (uintptr_t handle, size_t page_cnt);
+  };
+
+/* A live allocation. */
+struct live 
+  {
+    uintptr_t handle;
+    size_t page_cnt;
+  };
+
+static struct bitmap *bitmap;
+
+static bool
+bitmap_alloc (size_t page_cnt, uintptr_t *handle) 
+{
+  size_t idx = bitmap_scan_and_flip (bitmap, 0, page_cnt, false);
+  *handle = idx;
+  return idx != BITMAP_ERROR;
+}
+
+static void
+bitmap_free (uintptr_t handle, size_t page_cnt) 
+{
+  bitmap_set_multiple (bitmap, handle, page_cnt, false);
+}
+
+static bool
+buddy_alloc (size_t page_cnt, uintptr_t *handle) 
+{
+  void *pages = palloc_get_multiple (PAL_USER, page_cnt);
+  *handle = (uintptr_t) pages;
+  return pages != NULL;
+}
+
+static void
+buddy_free (uintptr_t handle, size_t page_cnt) 
+{
+  palloc_free_multiple ((void *) handle, page_cnt);
+}
+
+/* Returns the number of pages in the user pool. */
+static size_t
+user_pool_pages (void) 
+{
+  void *head = NULL;
+  void *page;
+  size_t cnt = 0;
+
+  while ((page = palloc_get_page (PAL_USER)) != NULL) 
+    {
+      *(void **) page = head;
+      head = page;
+      cnt++;
+    }
+  while (head != NULL) 
+    {
+      page = head;
+      head = *(void **) page;
+      palloc_free_page (page);
+    }
+  return cnt;
+}
+
+/* Runs the workload against A with CAPACITY pages available,
+   using LIVE to track live allocations. */
+static void
+run (const struct allocator *a, size_t capacity, struct live *live) 
+{
+  size_t live_cnt = 0, live_pages = 0;
+  uint64_t total = 0, worst = 0;
+  size_t allocs = 0, failures = 0, failed_free_pages = 0;
+  int i;
+
+  random_init (SEED);
+
+  /* Fill three quarters of the pages. */
+  while (live_cnt < MAX_LIVE && live_pages < capacity / 4 * 3) 
+    {
+      size_t cnt = random_ulong () % MAX_RUN + 1;
+      if (!a->alloc (cnt, &live[live_cnt].handle))
+        break;
+      live[live_cnt++].page_cnt = cnt;
+      live_pages += cnt;
+    }
+
+  /* Churn. */
+  for (i = 0; i < CHURN_OPS; i++) 
+    {
+      size_t cnt = random_ulong () % MAX_RUN + 1;
+      uint64_t start, cycles;
+      bool ok;
+
+      if (live_cnt > 0) 
+        {
+          size_t victim = random_ulong () % live_cnt;
+          a->free (live[victim].handle, live[victim].page_cnt);
+          live_pages -= live[victim].page_cnt;
+          live[victim] = live[--live_cnt];
+        }
+
+      start = rdtsc ();
+      ok = a->alloc (cnt, &live[live_cnt].handle);
+      cycles = rdtsc () - start;
+
+      total += cycles;
+      if (cycles > worst)
+        worst = cycles;
+      allocs++;
+      if (ok) 
+        {
+          live[live_cnt++].page_cnt = cnt;
+          live_pages += cnt;
+        }
+      else if (capacity - live_pages >= cnt) 
+        {
+          failures++;
+          failed_free_pages += capacity - live_pages;
+        }
+    }
+
+  msg ("%s: %zu allocations, avg %llu cycles, max %llu cycles",
+       a->name, allocs, total / allocs, worst);
+  msg ("%s: %zu fragmentation failures, avg %zu pages free at failure",
+       a->name, failures, failures ? failed_free_pages / failures : 0);
+
+  while (live_cnt > 0) 
+    {
+      live_cnt--;
+      a->free (live[live_cnt].handle, live[live_cnt].page_cnt);
+    }
+}
+
+void
+test_palloc_bench (void) 
+{
+  static const struct allocator bitmap_allocator =
+    {"bitmap", bitmap_alloc, bitmap_free};
+  static const struct allocator buddy_allocator =
+    {"buddy", buddy_alloc, buddy_free};
+  size_t capacity = user_pool_pages ();
+  struct live *live = malloc (MAX_LIVE * sizeof *live);
+
+  if (live == NULL)
+    fail ("out of memory");
+  msg ("user pool: %zu pages", capacity);
+
+  bitmap = bitmap_create (capacity);
+  if (bitmap == NULL)
+    fail ("out of memory");
+  run (&bitmap_allocator, capacity, live);
+  bitmap_destroy (bitmap);
+
+  run (&buddy_allocator, capacity, live);
+  if (user_pool_pages () != capacity)
+    fail ("buddy allocator leaked pages");
+
+  free (live);
+  pass ();
+}
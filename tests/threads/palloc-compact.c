@@ -0,0 +1,103 @@
+/* Tests compaction: with every page allocated and then every
+   other one freed, no two free pages are adjacent, so a
+   multi-page allocation can succeed only by migrating movable
+   pages out of the way.  The movable pages form a doubly linked
+   list that must survive being moved. */
+
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+#include "tests/threads/tests.h"
+#include "threads/palloc.h"
+#include "threads/vaddr.h"
+
+/* A list node, one per page, at the start of the page. */
+struct node 
+  {
+    struct node *prev, *next;
+    size_t id;
+  };
+
+static struct node head = {&head, &head, 0};
+static size_t migrate_cnt;
+
+static bool
+node_migrate (struct page *page, void *new_kva) 
+{
+  struct node *old = page_to_kva (page);
+  struct node *new = new_kva;
+
+  memcpy (new, old, PGSIZE);
+  new->prev->next = new;
+  new->next->prev = new;
+  palloc_set_movable (new, kva_to_page (old)->mapping);
+  page_put (page);
+  migrate_cnt++;
+  return true;
+}
+
+static struct page_owner node_owner = {node_migrate};
+
+void
+test_palloc_compact (void) 
+{
+  struct node *n, *next;
+  size_t node_cnt = 0, id;
+  void *block;
+
+  /* Take every page there is. */
+  for (;;) 
+    {
+      n = palloc_get_page (0);
+      if (n == NULL)
+        break;
+      palloc_set_movable (n, &node_owner);
+      n->id = ++node_cnt;
+      n->prev = head.prev;
+      n->next = &head;
+      head.prev->next = n;
+      head.prev = n;
+    }
+  msg ("allocated all pages as movable list nodes.");
+
+  /* Free every other node. */
+  for (n = head.next; n != &head && n->next != &head; n = next) 
+    {
+      struct node *victim = n->next;
+      next = victim->next;
+      n->next = next;
+      next->prev = n;
+      page_put (kva_to_page (victim));
+      node_cnt--;
+    }
+  msg ("freed every other node.");
+
+  block = palloc_get_multiple (0, 4);
+  if (block == NULL)
+    fail ("4-page allocation failed");
+  if (migrate_cnt == 0)
+    fail ("4-page allocation succeeded without migrating a page");
+  msg ("4-page allocation succeeded after migrating pages.");
+  palloc_free_multiple (block, 4);
+
+  /* The list must still be whole, in order. */
+  id = 0;
+  for (n = head.next; n != &head; n = n->next) 
+    {
+      if (n->prev->next != n || n->id <= id)
+        fail ("list damaged at node %zu", n->id);
+      id = n->id;
+      node_cnt--;
+    }
+  if (node_cnt != 0)
+    fail ("%zu nodes lost", node_cnt);
+  msg ("list intact after migration.");
+
+  for (n = head.next; n != &head; n = next) 
+    {
+      next = n->next;
+      page_put (kva_to_page (n));
+    }
+  head.prev = head.next = &head;
+  pass ();
+}
@@ -0,0 +1,14 @@
+# -*- perl -*-
+use strict;
+use warnings;
+use tests::tests;
+check_expected ([<<'EOF']);
+(palloc-compact) begin
+(palloc-compact) allocated all pages as movable list nodes.
+(palloc-compact) freed every other node.
+(palloc-compact) 4-page allocation succeeded after migrating pages.
+(palloc-compact) list intact after migration.
+(palloc-compact) PASS
+(palloc-compact) end
+EOF
+pass;
@@ -0,0 +1,52 @@
+/* Tests borrowing between the page pools: once the kernel pool
+   is exhausted, kernel allocations are served from the user pool,
+   marked as loans, until only the user pool's reserve is left,
+   which user allocations can still use. */
+
+#include <stdint.h>
+#include <stdio.h>
+#include "tests/threads/tests.h"
+#include "threads/palloc.h"
+
+void
+test_palloc_lend (void) 
+{
+  void *pages = NULL;
+  void *upage;
+  size_t loan_cnt = 0;
+
+  /* Take every kernel page there is, chaining them together. */
+  for (;;) 
+    {
+      void **page = palloc_get_page (0);
+      if (page == NULL)
+        break;
+      *page = pages;
+      pages = page;
+
+      if (kva_to_page (page)->flags & PAGE_LOAN) 
+        {
+          if (!(kva_to_page (page)->flags & PAGE_USER))
+            fail ("loan did not come from the user pool");
+          loan_cnt++;
+        }
+    }
+  if (loan_cnt == 0)
+    fail ("kernel allocations did not borrow from the user pool");
+  msg ("kernel allocations borrowed from the user pool.");
+
+  upage = palloc_get_page (PAL_USER);
+  if (upage == NULL)
+    fail ("user pool reserve was lent out");
+  palloc_free_page (upage);
+  msg ("user pool kept its reserve.");
+
+  while (pages != NULL) 
+    {
+      void *next = *(void **) pages;
+      palloc_free_page (pages);
+      pages = next;
+    }
+  msg ("freed all pages.");
+  pass ();
+}
@@ -0,0 +1,13 @@
+# -*- perl -*-
+use strict;
+use warnings;
+use tests::tests;
+check_expected ([<<'EOF']);
+(palloc-lend) begin
+(palloc-lend) kernel allocations borrowed from the user pool.
+(palloc-lend) user pool kept its reserve.
+(palloc-lend) freed all pages.
+(palloc-lend) PASS
+(palloc-lend) end
+EOF
+pass;
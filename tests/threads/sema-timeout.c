@@ -0,0 +1,95 @@
+/* Tests that sema_down_timeout(), lock_acquire_timeout(), and
+   cond_timedwait() give up once their timeout expires, and that
+   they return early, without waiting out the timeout, when woken
+   the ordinary way. */
+
+#include <stdio.h>
+#include "tests/threads/tests.h"
+#include "threads/init.h"
+#include "threads/synch.h"
+#include "threads/thread.h"
+#include "devices/timer.h"
+
+static thread_func up_thread;
+static thread_func hold_thread;
+static thread_func signal_thread;
+
+static struct semaphore sema;
+static struct semaphore held;
+static struct lock lock;
+static struct condition condition;
+
+void
+test_sema_timeout (void) 
+{
+  int64_t start;
+
+  /* Semaphore that is never up'd. */
+  sema_init (&sema, 0);
+  start = timer_ticks ();
+  if (sema_down_timeout (&sema, 10))
+    fail ("sema_down_timeout() downed a zero semaphore");
+  if (timer_elapsed (start) < 10)
+    fail ("sema_down_timeout() returned early");
+  msg ("sema_down_timeout() timed out.");
+
+  /* Semaphore that is up'd before the timeout. */
+  start = timer_ticks ();
+  thread_create ("up", PRI_DEFAULT, up_thread, NULL);
+  if (!sema_down_timeout (&sema, 1000))
+    fail ("sema_down_timeout() missed sema_up()");
+  if (timer_elapsed (start) >= 1000)
+    fail ("sema_down_timeout() waited out its timeout");
+  msg ("sema_down_timeout() woken by sema_up().");
+
+  /* Lock held by another thread. */
+  lock_init (&lock);
+  sema_init (&held, 0);
+  thread_create ("holder", PRI_DEFAULT, hold_thread, NULL);
+  sema_down (&held);
+  if (lock_acquire_timeout (&lock, 5))
+    fail ("lock_acquire_timeout() acquired a held lock");
+  msg ("lock_acquire_timeout() timed out.");
+  if (!lock_acquire_timeout (&lock, 1000))
+    fail ("lock_acquire_timeout() missed lock_release()");
+  msg ("lock_acquire_timeout() acquired the lock.");
+
+  /* Condition variable. */
+  cond_init (&condition);
+  if (cond_timedwait (&condition, &lock, 10))
+    fail ("cond_timedwait() returned true without a signal");
+  if (!lock_held_by_current_thread (&lock))
+    fail ("cond_timedwait() did not reacquire the lock");
+  msg ("cond_timedwait() timed out.");
+  thread_create ("signal", PRI_DEFAULT, signal_thread, NULL);
+  if (!cond_timedwait (&condition, &lock, 1000))
+    fail ("cond_timedwait() missed cond_signal()");
+  msg ("cond_timedwait() woken by cond_signal().");
+  lock_release (&lock);
+
+  pass ();
+}
+
+static void
+up_thread (void *aux UNUSED) 
+{
+  timer_sleep (5);
+  sema_up (&sema);
+}
+
+static void
+hold_thread (void *aux UNUSED) 
+{
+  lock_acquire (&lock);
+  sema_up (&held);
+  timer_sleep (20);
+  lock_release (&lock);
+}
+
+static void
+signal_thread (void *aux UNUSED) 
+{
+  lock_acquire (&lock);
+  cond_signal (&condition, &lock);
+  lock_release (&lock);
+}
@@ -0,0 +1,16 @@
+# -*- perl -*-
+use strict;
+use warnings;
+use tests::tests;
+check_expected ([<<'EOF']);
+(sema-timeout) begin
+(sema-timeout) sema_down_timeout() timed out.
+(sema-timeout) sema_down_timeout() woken by sema_up().
+(sema-timeout) lock_acquire_timeout() timed out.
+(sema-timeout) lock_acquire_timeout() acquired the lock.
+(sema-timeout) cond_timedwait() timed out.
+(sema-timeout) cond_timedwait() woken by cond_signal().
+(sema-timeout) PASS
+(sema-timeout) end
+EOF
+pass;
@@ -0,0 +1,85 @@
+/* Tests the shrinker registry: when the page allocator runs out
+   of pages, it takes back the pages that a registered shrinker
+   is holding, and keeps allocating until they are gone too. */
+
+#include <stdint.h>
+#include <stdio.h>
+#include "tests/threads/tests.h"
+#include "threads/palloc.h"
+#include "threads/shrinker.h"
+
+#define STASH_CNT 64            /* Pages held by the shrinker. */
+
+/* Pages the test shrinker can give back, chained through their
+   first words. */
+static void *stash;
+static size_t stash_cnt;
+
+static size_t
+stash_count (struct shrinker *s UNUSED) 
+{
+  return stash_cnt;
+}
+
+static size_t
+stash_scan (struct shrinker *s UNUSED, size_t page_cnt) 
+{
+  size_t cnt = 0;
+
+  while (stash != NULL && cnt < page_cnt) 
+    {
+      void *next = *(void **) stash;
+      palloc_free_page (stash);
+      stash = next;
+      stash_cnt--;
+      cnt++;
+    }
+  return cnt;
+}
+
+static struct shrinker stash_shrinker = 
+  {
+    .count = stash_count,
+    .scan = stash_scan,
+    .name = "test",
+  };
+
+void
+test_shrinker (void) 
+{
+  void *pages = NULL;
+  size_t i;
+
+  for (i = 0; i < STASH_CNT; i++) 
+    {
+      void **page = palloc_get_page (PAL_ASSERT);
+      *page = stash;
+      stash = page;
+      stash_cnt++;
+    }
+  shrinker_register (&stash_shrinker);
+  msg ("registered shrinker holding %d pages.", STASH_CNT);
+
+  /* Take every page there is. */
+  for (;;) 
+    {
+      void **page = palloc_get_page (0);
+      if (page == NULL)
+        break;
+      *page = pages;
+      pages = page;
+    }
+  if (stash_cnt != 0 || stash_shrinker.freed_cnt != STASH_CNT)
+    fail ("shrinker gave back %zu pages, kept %zu",
+          stash_shrinker.freed_cnt, stash_cnt);
+  msg ("allocator took back all the shrinker's pages.");
+
+  while (pages != NULL) 
+    {
+      void *next = *(void **) pages;
+      palloc_free_page (pages);
+      pages = next;
+    }
+  shrinker_unregister (&stash_shrinker);
+  pass ();
+}
@@ -0,0 +1,12 @@
+# -*- perl -*-
+use strict;
+use warnings;
+use tests::tests;
+check_expected ([<<'EOF']);
+(shrinker) begin
+(shrinker) registered shrinker holding 64 pages.
+(shrinker) allocator took back all the shrinker's pages.
+(shrinker) PASS
+(shrinker) end
+EOF
+pass;
@@ -0,0 +1,106 @@
+/* Tests the slab allocator: objects of a non-power-of-two size
+   come back distinct, aligned and non-overlapping, each object is
+   constructed once, and freed objects keep their constructed
+   state when they are handed out again. */
+
+#include <stdint.h>
+#include <stdio.h>
+#include "tests/threads/tests.h"
+#include "threads/slab.h"
+
+#define OBJ_CNT 300             /* Objects allocated at once. */
+#define OBJ_MAGIC 0x0b1ec7      /* Set by the constructor. */
+
+/* A 72-byte object, which malloc() would round up to 128. */
+struct obj 
+  {
+    unsigned magic;             /* Set by ctor(), never cleared. */
+    int owner;                  /* Index while allocated. */
+    char payload[64];
+  };
+
+static struct obj *objs[OBJ_CNT];
+static int ctor_cnt;
+
+static void
+ctor (void *obj_) 
+{
+  struct obj *obj = obj_;
+
+  obj->magic = OBJ_MAGIC;
+  obj->owner = -1;
+  ctor_cnt++;
+}
+
+/* Allocates every STEP'th object of OBJS, starting from FIRST,
+   from C and checks them. */
+static void
+alloc_objs (struct kmem_cache *c, int first, int step) 
+{
+  int i, j;
+
+  for (i = first; i < OBJ_CNT; i += step) 
+    {
+      objs[i] = kmem_cache_alloc (c);
+      if (objs[i] == NULL)
+        fail ("kmem_cache_alloc() failed");
+      if ((uintptr_t) objs[i] % 8 != 0)
+        fail ("object %p is misaligned", objs[i]);
+      if (objs[i]->magic != OBJ_MAGIC || objs[i]->owner != -1)
+        fail ("object %p is not in its constructed state", objs[i]);
+      objs[i]->owner = i;
+    }
+
+  for (i = 0; i < OBJ_CNT; i++)
+    for (j = i + 1; j < OBJ_CNT; j++) 
+      {
+        uintptr_t a = (uintptr_t) objs[i], b = (uintptr_t) objs[j];
+        if (a < b + sizeof (struct obj) && b < a + sizeof (struct obj))
+          fail ("objects %p and %p overlap", objs[i], objs[j]);
+      }
+}
+
+/* Frees every STEP'th object of OBJS, starting from FIRST, back
+   to C in its constructed state. */
+static void
+free_objs (struct kmem_cache *c, int first, int step) 
+{
+  int i;
+
+  for (i = first; i < OBJ_CNT; i += step) 
+    {
+      if (objs[i]->owner != i)
+        fail ("object %p was overwritten", objs[i]);
+      objs[i]->owner = -1;
+      kmem_cache_free (c, objs[i]);
+    }
+}
+
+void
+test_slab_cache (void) 
+{
+  struct kmem_cache *c;
+  int old_ctor_cnt;
+
+  c = kmem_cache_create ("slab-cache", sizeof (struct obj), 0, ctor);
+  if (c == NULL)
+    fail ("kmem_cache_create() failed");
+
+  alloc_objs (c, 0, 1);
+  msg ("allocated %d objects.", OBJ_CNT);
+  if (ctor_cnt < OBJ_CNT)
+    fail ("only %d objects constructed", ctor_cnt);
+
+  /* Every slab keeps some objects in use, so the freed ones must
+     be handed out again without being reconstructed. */
+  free_objs (c, 1, 2);
+  old_ctor_cnt = ctor_cnt;
+  alloc_objs (c, 1, 2);
+  if (ctor_cnt != old_ctor_cnt)
+    fail ("%d objects constructed again", ctor_cnt - old_ctor_cnt);
+  msg ("reallocated %d objects in their constructed state.", OBJ_CNT / 2);
+
+  free_objs (c, 0, 1);
+  kmem_cache_destroy (c);
+  pass ();
+}
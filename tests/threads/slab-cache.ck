@@ -0,0 +1,12 @@
+# -*- perl -*-
+use strict;
+use warnings;
+use tests::tests;
+check_expected ([<<'EOF']);
+(slab-cache) begin
+(slab-cache) allocated 300 objects.
+(slab-cache) reallocated 150 objects in their constructed state.
+(slab-cache) PASS
+(slab-cache) end
+EOF
+pass;
@@ -29,6 +29,18 @@ static const struct test tests[] =
     {"priority-preempt", test_priority_preempt},
     {"priority-sema", test_priority_sema},
     {"priority-condvar", test_priority_condvar},
+    {"sema-timeout", test_sema_timeout},
+    {"palloc-bench", test_palloc_bench},
+    {"slab-cache", test_slab_cache},
+    {"malloc-frag", test_malloc_frag},
+    {"mmu-range", test_mmu_range},
+    {"vmalloc", test_vmalloc},
+    {"page-desc", test_page_desc},
+    {"palloc-lend", test_palloc_lend},
+    {"shrinker", test_shrinker},
+    {"palloc-compact", test_palloc_compact},
+    {"ksm", test_ksm},
+    {"heapprof", test_heapprof},
     {"mlfqs-load-1", test_mlfqs_load_1},
     {"mlfqs-load-60", test_mlfqs_load_60},
     {"mlfqs-load-avg", test_mlfqs_load_avg},
@@ -38,6 +50,13 @@ static const struct test tests[] =
     {"mlfqs-nice-2", test_mlfqs_nice_2},
     {"mlfqs-nice-10", test_mlfqs_nice_10},
     {"mlfqs-block", test_mlfqs_block},
+#ifdef VM
+    {"lazy-load", test_lazy_load},
+    {"swap-evict", test_swap_evict},
+    {"fork-cow", test_fork_cow},
+    {"fault-around", test_fault_around},
+    {"ksm-merge", test_ksm_merge},
+#endif
   };
 
 static const char *test_name;
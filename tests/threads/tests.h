@@ -23,6 +23,18 @@ extern test_func test_priority_fifo;
 extern test_func test_priority_preempt;
 extern test_func test_priority_sema;
 extern test_func test_priority_condvar;
+extern test_func test_sema_timeout;
+extern test_func test_palloc_bench;
+extern test_func test_slab_cache;
+extern test_func test_malloc_frag;
+extern test_func test_mmu_range;
+extern test_func test_vmalloc;
+extern test_func test_page_desc;
+extern test_func test_palloc_lend;
+extern test_func test_shrinker;
+extern test_func test_palloc_compact;
+extern test_func test_ksm;
+extern test_func test_heapprof;
 extern test_func test_mlfqs_load_1;
 extern test_func test_mlfqs_load_60;
 extern test_func test_mlfqs_load_avg;
@@ -32,6 +44,13 @@ extern test_func test_mlfqs_fair_20;
 extern test_func test_mlfqs_nice_2;
 extern test_func test_mlfqs_nice_10;
 extern test_func test_mlfqs_block;
+#ifdef VM
+extern test_func test_lazy_load;
+extern test_func test_swap_evict;
+extern test_func test_fork_cow;
+extern test_func test_fault_around;
+extern test_func test_ksm_merge;
+#endif
 
 void msg (const char *, ...);
 void fail (const char *, ...);
@@ -0,0 +1,75 @@
+/* Tests vmalloc(): a block spanning many pages is usable
+   throughout, blocks are separated by a guard page, freed
+   address space is reused, and impossible requests fail. */
+
+#include <stdint.h>
+#include <stdio.h>
+#include "tests/threads/tests.h"
+#include "threads/vaddr.h"
+#include "threads/vmalloc.h"
+
+#define BIG_PAGES 300           /* Pages in the big block. */
+
+/* Fills each of the PAGE_CNT pages at P with a pattern derived
+   from SEED and the page's index. */
+static void
+fill (uint8_t *p, size_t page_cnt, int seed) 
+{
+  size_t i, j;
+
+  for (i = 0; i < page_cnt; i++)
+    for (j = 0; j < PGSIZE; j += 512)
+      p[i * PGSIZE + j] = seed + i + j / 512;
+}
+
+/* Checks the pattern written by fill(). */
+static void
+check (const uint8_t *p, size_t page_cnt, int seed) 
+{
+  size_t i, j;
+
+  for (i = 0; i < page_cnt; i++)
+    for (j = 0; j < PGSIZE; j += 512)
+      if (p[i * PGSIZE + j] != (uint8_t) (seed + i + j / 512))
+        fail ("page %zu of block at %p corrupted", i, p);
+}
+
+void
+test_vmalloc (void) 
+{
+  uint8_t *big, *small, *reused;
+
+  big = vmalloc (BIG_PAGES * PGSIZE - 100);
+  if (big == NULL)
+    fail ("vmalloc of %d pages failed", BIG_PAGES);
+  if (!is_vmalloc_vaddr (big) || pg_ofs (big) != 0)
+    fail ("vmalloc returned bad address %p", big);
+  fill (big, BIG_PAGES, 1);
+  msg ("allocated and filled %d pages.", BIG_PAGES);
+
+  small = vmalloc (1);
+  if (small == NULL)
+    fail ("vmalloc of 1 byte failed");
+  if (small < big + (BIG_PAGES + 1) * PGSIZE)
+    fail ("no guard page between blocks");
+  fill (small, 1, 2);
+  check (big, BIG_PAGES, 1);
+  msg ("second block follows a guard page.");
+
+  vfree (big);
+  reused = vmalloc (BIG_PAGES / 2 * PGSIZE);
+  if (reused != big)
+    fail ("freed address space not reused");
+  fill (reused, BIG_PAGES / 2, 3);
+  check (reused, BIG_PAGES / 2, 3);
+  check (small, 1, 2);
+  msg ("freed address space reused.");
+
+  if (vmalloc (0) != NULL || vmalloc (VMALLOC_END - VMALLOC_START) != NULL)
+    fail ("impossible request succeeded");
+  msg ("impossible requests failed.");
+
+  vfree (reused);
+  vfree (small);
+  pass ();
+}
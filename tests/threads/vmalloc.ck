@@ -0,0 +1,14 @@
+# -*- perl -*-
+use strict;
+use warnings;
+use tests::tests;
+check_expected ([<<'EOF']);
+(vmalloc) begin
+(vmalloc) allocated and filled 300 pages.
+(vmalloc) second block follows a guard page.
+(vmalloc) freed address space reused.
+(vmalloc) impossible requests failed.
+(vmalloc) PASS
+(vmalloc) end
+EOF
+pass;
@@ -0,0 +1,76 @@
+/* Measures fault-around on a file mapping: scanning a mapping
+   whose pages are all in the page cache takes a fault per page
+   with a window of one page, but only one per window with a
+   window of 16 pages, the others being mapped ahead. */
+
+#include <stdint.h>
+#include <stdio.h>
+#include "tests/threads/tests.h"
+#include "filesys/file.h"
+#include "filesys/filesys.h"
+#include "threads/mmu.h"
+#include "threads/thread.h"
+#include "threads/vaddr.h"
+#include "vm/mmap.h"
+#include "vm/vm.h"
+
+#define PAGE_CNT 64             /* Pages in the file. */
+#define UPAGE ((uint8_t *) 0x10000000)
+
+/* Maps FILE at UPAGE, reads every page of it as a user scan
+   would, faulting in only the pages that are not yet mapped, and
+   unmaps it again.  Returns the number of faults taken. */
+static size_t
+scan (struct file *file) 
+{
+  struct thread *t = thread_current ();
+  struct vm_stats before, after;
+  size_t i;
+
+  if (do_mmap (UPAGE, PAGE_CNT * PGSIZE, 0, file, 0) != UPAGE)
+    fail ("do_mmap() failed");
+  vm_get_stats (&before);
+  for (i = 0; i < PAGE_CNT; i++) 
+    {
+      uint8_t *upage = UPAGE + i * PGSIZE;
+
+      if (pml4_get_page (t->pml4, upage) == NULL
+          && !vm_try_handle_fault (NULL, upage, true, false, true))
+        fail ("fault on page %zu failed", i);
+      if (*(uint8_t *) pml4_get_page (t->pml4, upage) != 0)
+        fail ("page %zu has wrong contents", i);
+    }
+  vm_get_stats (&after);
+  do_munmap (UPAGE);
+  return after.fault_cnt - before.fault_cnt;
+}
+
+void
+test_fault_around (void) 
+{
+  struct thread *t = thread_current ();
+  unsigned saved = vm_fault_around;
+  struct file *file;
+
+  if (!filesys_create ("data", PAGE_CNT * PGSIZE)
+      || (file = filesys_open ("data")) == NULL)
+    fail ("cannot create file");
+  t->pml4 = pml4_create ();
+  if (t->pml4 == NULL)
+    fail ("out of memory");
+  supplemental_page_table_init (&t->spt);
+
+  /* The first scan also brings the whole file into the cache. */
+  vm_fault_around = 1;
+  msg ("window of 1 page: %zu faults for %d pages.", scan (file), PAGE_CNT);
+  vm_fault_around = 16;
+  msg ("window of 16 pages: %zu faults for %d pages.", scan (file), PAGE_CNT);
+  vm_fault_around = saved;
+
+  supplemental_page_table_kill (&t->spt);
+  pml4_destroy (t->pml4);
+  t->pml4 = NULL;
+  file_close (file);
+  filesys_remove ("data");
+  pass ();
+}
@@ -0,0 +1,12 @@
+# -*- perl -*-
+use strict;
+use warnings;
+use tests::tests;
+check_expected ([<<'EOF']);
+(fault-around) begin
+(fault-around) window of 1 page: 64 faults for 64 pages.
+(fault-around) window of 16 pages: 4 faults for 64 pages.
+(fault-around) PASS
+(fault-around) end
+EOF
+pass;
@@ -0,0 +1,156 @@
+/* Tests copy-on-write sharing between two page tables, as fork
+   sets it up: the child's copy maps the parent's frames
+   read-only in both tables, a write gives the writer a copy of
+   its own and drops the shared frame's reference count back,
+   and the last sharer only has its page made writable again. */
+
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+#include "tests/threads/tests.h"
+#include "threads/mmu.h"
+#include "threads/palloc.h"
+#include "threads/pte.h"
+#include "threads/synch.h"
+#include "threads/thread.h"
+#include "threads/vaddr.h"
+#include "vm/vm.h"
+
+#define PAGE_CNT 4              /* Pages shared. */
+#define UPAGE ((uint8_t *) 0x10000000)
+
+static struct thread *parent;
+static struct semaphore done;
+
+/* Returns the frame of page IDX in PML4. */
+static uint8_t *
+frame_of (uint64_t *pml4, size_t idx) 
+{
+  uint8_t *kpage = pml4_get_page (pml4, UPAGE + idx * PGSIZE);
+
+  if (kpage == NULL)
+    fail ("page %zu not mapped", idx);
+  return kpage;
+}
+
+/* Returns true if page IDX is writable in PML4. */
+static bool
+is_writable (uint64_t *pml4, size_t idx) 
+{
+  uint64_t *pte = pml4e_walk (pml4, (uint64_t) (UPAGE + idx * PGSIZE), 0);
+
+  return pte != NULL && (*pte & PTE_W) != 0;
+}
+
+/* Handles a write fault on resident page IDX of the running
+   thread, as a write to a read-only PTE would raise. */
+static void
+write_fault (size_t idx) 
+{
+  if (!vm_try_handle_fault (NULL, UPAGE + idx * PGSIZE, true, true, false))
+    fail ("write fault on page %zu failed", idx);
+}
+
+/* Copies the parent's pages, as fork would, and writes to one. */
+static void
+child (void *aux UNUSED) 
+{
+  struct thread *t = thread_current ();
+  struct vm_stats before, after;
+  size_t i;
+
+  t->pml4 = pml4_create ();
+  if (t->pml4 == NULL)
+    fail ("out of memory");
+  supplemental_page_table_init (&t->spt);
+  if (!supplemental_page_table_copy (&t->spt, &parent->spt))
+    fail ("supplemental_page_table_copy() failed");
+
+  for (i = 0; i < PAGE_CNT; i++) 
+    {
+      uint8_t *kpage = frame_of (t->pml4, i);
+
+      if (kpage != frame_of (parent->pml4, i))
+        fail ("page %zu not shared", i);
+      if (kva_to_page (kpage)->refcnt != 2)
+        fail ("page %zu has %d references, expected 2", i,
+              kva_to_page (kpage)->refcnt);
+      if (is_writable (t->pml4, i) || is_writable (parent->pml4, i))
+        fail ("shared page %zu is writable", i);
+    }
+  msg ("child shares %d read-only frames.", PAGE_CNT);
+
+  vm_get_stats (&before);
+  write_fault (0);
+  vm_get_stats (&after);
+  if (frame_of (t->pml4, 0) == frame_of (parent->pml4, 0))
+    fail ("write fault did not copy the page");
+  if (!is_writable (t->pml4, 0))
+    fail ("copied page is not writable");
+  if (memcmp (frame_of (t->pml4, 0), frame_of (parent->pml4, 0), PGSIZE))
+    fail ("copy differs from the original");
+  if (kva_to_page (frame_of (parent->pml4, 0))->refcnt != 1)
+    fail ("parent's frame still has %d references",
+          kva_to_page (frame_of (parent->pml4, 0))->refcnt);
+  msg ("child write copied %zu page.", after.cow_cnt - before.cow_cnt);
+  memset (frame_of (t->pml4, 0), 'c', PGSIZE);
+
+  supplemental_page_table_kill (&t->spt);
+  pml4_destroy (t->pml4);
+  t->pml4 = NULL;
+  sema_up (&done);
+}
+
+void
+test_fork_cow (void) 
+{
+  struct vm_stats before, after;
+  size_t i;
+
+  parent = thread_current ();
+  parent->pml4 = pml4_create ();
+  if (parent->pml4 == NULL)
+    fail ("out of memory");
+  supplemental_page_table_init (&parent->spt);
+  for (i = 0; i < PAGE_CNT; i++) 
+    {
+      uint8_t *upage = UPAGE + i * PGSIZE;
+
+      if (!vm_alloc_zero (upage, true)
+          || !vm_try_handle_fault (NULL, upage, true, true, true))
+        fail ("cannot set up page %zu", i);
+      memset (frame_of (parent->pml4, i), 'a' + i, PGSIZE);
+      pml4_set_dirty (parent->pml4, upage, true);
+    }
+
+  sema_init (&done, 0);
+  thread_create ("child", PRI_DEFAULT, child, NULL);
+  sema_down (&done);
+
+  /* With the child gone, every frame is the parent's alone. */
+  for (i = 0; i < PAGE_CNT; i++) 
+    {
+      const uint8_t *kpage = frame_of (parent->pml4, i);
+      size_t j;
+
+      if (kva_to_page (kpage)->refcnt != 1)
+        fail ("page %zu has %d references after the child exited", i,
+              kva_to_page (kpage)->refcnt);
+      for (j = 0; j < PGSIZE; j++)
+        if (kpage[j] != 'a' + i)
+          fail ("parent's page %zu changed", i);
+    }
+  msg ("parent's frames are its own again, unchanged.");
+
+  vm_get_stats (&before);
+  write_fault (1);
+  vm_get_stats (&after);
+  if (!is_writable (parent->pml4, 1))
+    fail ("page is still read-only");
+  msg ("parent write copied %zu pages.", after.cow_cnt - before.cow_cnt);
+
+  supplemental_page_table_kill (&parent->spt);
+  pml4_destroy (parent->pml4);
+  parent->pml4 = NULL;
+  pass ();
+}
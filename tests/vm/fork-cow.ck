@@ -0,0 +1,14 @@
+# -*- perl -*-
+use strict;
+use warnings;
+use tests::tests;
+check_expected ([<<'EOF']);
+(fork-cow) begin
+(fork-cow) child shares 4 read-only frames.
+(fork-cow) child write copied 1 page.
+(fork-cow) parent's frames are its own again, unchanged.
+(fork-cow) parent write copied 0 pages.
+(fork-cow) PASS
+(fork-cow) end
+EOF
+pass;
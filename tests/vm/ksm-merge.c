@@ -0,0 +1,107 @@
+/* Tests same-page merging of pages in the frame table: identical
+   pages end up sharing one read-only frame copy-on-write, a write
+   fault gives the writer its own copy, and the shared frames are
+   freed once the pages are gone. */
+
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+#include "tests/threads/tests.h"
+#include "threads/ksm.h"
+#include "threads/mmu.h"
+#include "threads/palloc.h"
+#include "threads/pte.h"
+#include "threads/thread.h"
+#include "threads/vaddr.h"
+#include "vm/vm.h"
+
+#define PAGE_CNT 8              /* Pages in the range. */
+#define UPAGE ((uint8_t *) 0x10000000)
+
+/* Contents of each page: pages 0 to 3 are zeroed, pages 4 and 5
+   are filled with 'a', and pages 6 and 7 are unique. */
+static const char fill[PAGE_CNT] = {0, 0, 0, 0, 'a', 'a', 'b', 'c'};
+
+static uint8_t *
+frame (size_t idx) 
+{
+  return pml4_get_page (thread_current ()->pml4, UPAGE + idx * PGSIZE);
+}
+
+static bool
+writable (size_t idx) 
+{
+  return (*pml4e_walk (thread_current ()->pml4,
+                       (uint64_t) (UPAGE + idx * PGSIZE), 0) & PTE_W) != 0;
+}
+
+void
+test_ksm_merge (void) 
+{
+  struct thread *t = thread_current ();
+  struct ksm_stats before, after;
+  struct vm_stats vm_before, vm_after;
+  size_t i;
+
+  t->pml4 = pml4_create ();
+  if (t->pml4 == NULL)
+    fail ("out of memory");
+  supplemental_page_table_init (&t->spt);
+  for (i = 0; i < PAGE_CNT; i++) 
+    {
+      uint8_t *upage = UPAGE + i * PGSIZE;
+
+      if (!vm_alloc_zero (upage, true)
+          || !vm_try_handle_fault (NULL, upage, true, true, true))
+        fail ("cannot set up page %zu", i);
+      memset (frame (i), fill[i], PGSIZE);
+      pml4_set_dirty (t->pml4, upage, true);
+    }
+  if (!ksm_register (t->pml4, UPAGE, PAGE_CNT))
+    fail ("ksm_register() failed");
+  ksm_get_stats (&before);
+
+  /* The first pass only records hashes; the second merges. */
+  ksm_scan (2 * PAGE_CNT);
+  ksm_get_stats (&after);
+  if (after.merge_cnt - before.merge_cnt != 4)
+    fail ("merged %zu pages instead of 4",
+          after.merge_cnt - before.merge_cnt);
+  for (i = 0; i < PAGE_CNT; i++) 
+    {
+      size_t twin = i < 4 ? 0 : i < 6 ? 4 : i;
+      if (frame (i) != frame (twin) || writable (i) != (i >= 6))
+        fail ("page %zu is mapped wrong", i);
+    }
+  if (kva_to_page (frame (0))->refcnt != 5)
+    fail ("zeroed frame has %d references instead of 5",
+          kva_to_page (frame (0))->refcnt);
+  msg ("merged 6 pages into 2 shared frames.");
+
+  vm_get_stats (&vm_before);
+  if (!vm_try_handle_fault (NULL, UPAGE + 2 * PGSIZE + 123, true, true,
+                            false))
+    fail ("write fault on page 2 failed");
+  vm_get_stats (&vm_after);
+  if (frame (2) == frame (0) || !writable (2))
+    fail ("page 2 is still shared");
+  memset (frame (2), 'x', PGSIZE);
+  if (*frame (0) != 0 || *frame (3) != 0)
+    fail ("write to unmerged page 2 showed through");
+  if (kva_to_page (frame (0))->refcnt != 4)
+    fail ("zeroed frame has %d references instead of 4",
+          kva_to_page (frame (0))->refcnt);
+  msg ("write fault copied %zu page, giving page 2 a private frame.",
+       vm_after.cow_cnt - vm_before.cow_cnt);
+
+  ksm_unregister (t->pml4);
+  supplemental_page_table_kill (&t->spt);
+  pml4_destroy (t->pml4);
+  t->pml4 = NULL;
+  ksm_scan (1);
+  ksm_get_stats (&after);
+  if (after.shared_cnt != before.shared_cnt)
+    fail ("%zu shared frames left over", after.shared_cnt - before.shared_cnt);
+  msg ("freed the shared frames once unmapped.");
+  pass ();
+}
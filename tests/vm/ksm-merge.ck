@@ -0,0 +1,13 @@
+# -*- perl -*-
+use strict;
+use warnings;
+use tests::tests;
+check_expected ([<<'EOF']);
+(ksm-merge) begin
+(ksm-merge) merged 6 pages into 2 shared frames.
+(ksm-merge) write fault copied 1 page, giving page 2 a private frame.
+(ksm-merge) freed the shared frames once unmapped.
+(ksm-merge) PASS
+(ksm-merge) end
+EOF
+pass;
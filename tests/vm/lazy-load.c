@@ -0,0 +1,115 @@
+/* Tests demand paging: a lazily loaded segment reads nothing
+   until its pages are touched, a touched page is read once with
+   the rest of it zeroed, even after the file has been closed,
+   and the pages past the file data get zeroed frames. */
+
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+#include "tests/threads/tests.h"
+#include "filesys/file.h"
+#include "filesys/filesys.h"
+#include "threads/mmu.h"
+#include "threads/palloc.h"
+#include "threads/thread.h"
+#include "threads/vaddr.h"
+#include "vm/vm.h"
+
+#define PAGE_CNT 8              /* Pages in the segment. */
+#define READ_BYTES (5 * PGSIZE + 100)   /* Bytes of them in the file. */
+#define UPAGE ((uint8_t *) 0x10000000)
+
+/* Faults in page IDX of the segment, reading it, and returns
+   its frame. */
+static uint8_t *
+touch (size_t idx) 
+{
+  struct thread *t = thread_current ();
+  uint8_t *upage = UPAGE + idx * PGSIZE;
+
+  if (!vm_try_handle_fault (NULL, upage + 7, true, false, true))
+    fail ("fault on page %zu failed", idx);
+  if (pml4_get_page (t->pml4, upage) == NULL)
+    fail ("page %zu not mapped after its fault", idx);
+  return pml4_get_page (t->pml4, upage);
+}
+
+/* Checks that the first SIZE bytes of KPAGE are C and the rest
+   are zero. */
+static void
+check_page (const uint8_t *kpage, size_t size, int c) 
+{
+  size_t i;
+
+  for (i = 0; i < PGSIZE; i++)
+    if (kpage[i] != (i < size ? c : 0))
+      fail ("byte %zu is %d, expected %d", i, kpage[i], i < size ? c : 0);
+}
+
+void
+test_lazy_load (void) 
+{
+  struct thread *t = thread_current ();
+  struct vm_stats before, after;
+  struct file *file;
+  uint8_t *buf;
+  size_t i;
+
+  /* Write page I of the file full of 'a' + I. */
+  buf = palloc_get_page (0);
+  if (buf == NULL || !filesys_create ("segment", READ_BYTES)
+      || (file = filesys_open ("segment")) == NULL)
+    fail ("cannot create file");
+  for (i = 0; i * PGSIZE < READ_BYTES; i++) 
+    {
+      size_t size = READ_BYTES - i * PGSIZE < PGSIZE
+                    ? READ_BYTES - i * PGSIZE : PGSIZE;
+      memset (buf, 'a' + i, PGSIZE);
+      if (file_write (file, buf, size) != (off_t) size)
+        fail ("cannot write file");
+    }
+  palloc_free_page (buf);
+
+  t->pml4 = pml4_create ();
+  if (t->pml4 == NULL)
+    fail ("out of memory");
+  supplemental_page_table_init (&t->spt);
+
+  vm_get_stats (&before);
+  if (!vm_load_segment (file, 0, UPAGE, READ_BYTES,
+                        PAGE_CNT * PGSIZE - READ_BYTES, true))
+    fail ("vm_load_segment() failed");
+  vm_get_stats (&after);
+  for (i = 0; i < PAGE_CNT; i++)
+    if (pml4_get_page (t->pml4, UPAGE + i * PGSIZE) != NULL)
+      fail ("page %zu mapped before being touched", i);
+  if (after.file_cnt != before.file_cnt)
+    fail ("loading the segment read %zu pages",
+          after.file_cnt - before.file_cnt);
+  msg ("set up %d pages without reading any.", PAGE_CNT);
+
+  check_page (touch (2), PGSIZE, 'c');
+  msg ("page 2 read on first touch.");
+
+  file_close (file);
+  check_page (touch (5), READ_BYTES - 5 * PGSIZE, 'f');
+  msg ("page 5 read after the file was closed, tail zeroed.");
+
+  check_page (touch (7), 0, 0);
+  msg ("page 7 given a zeroed frame.");
+
+  if (vm_try_handle_fault (NULL, UPAGE + PAGE_CNT * PGSIZE, true, false,
+                           true))
+    fail ("fault past the segment succeeded");
+
+  vm_get_stats (&after);
+  msg ("%zu faults read %zu of %d pages and zeroed %zu.",
+       after.fault_cnt - before.fault_cnt, after.file_cnt - before.file_cnt,
+       PAGE_CNT, after.zero_cnt - before.zero_cnt);
+
+  supplemental_page_table_kill (&t->spt);
+  pml4_destroy (t->pml4);
+  t->pml4 = NULL;
+  filesys_remove ("segment");
+  pass ();
+}
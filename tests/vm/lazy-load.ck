@@ -0,0 +1,15 @@
+# -*- perl -*-
+use strict;
+use warnings;
+use tests::tests;
+check_expected ([<<'EOF']);
+(lazy-load) begin
+(lazy-load) set up 8 pages without reading any.
+(lazy-load) page 2 read on first touch.
+(lazy-load) page 5 read after the file was closed, tail zeroed.
+(lazy-load) page 7 given a zeroed frame.
+(lazy-load) 3 faults read 2 of 8 pages and zeroed 1.
+(lazy-load) PASS
+(lazy-load) end
+EOF
+pass;
@@ -0,0 +1,119 @@
+/* Tests eviction under memory overcommit, with the user pool
+   limited to 32 pages: many more pages than that can be touched,
+   every page reads back what was written to it, dirty file pages
+   go to swap, and clean file pages are dropped and read again. */
+
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+#include "tests/threads/tests.h"
+#include "filesys/file.h"
+#include "filesys/filesys.h"
+#include "threads/mmu.h"
+#include "threads/palloc.h"
+#include "threads/thread.h"
+#include "threads/vaddr.h"
+#include "vm/vm.h"
+
+#define FILE_PAGES 8            /* File-backed pages. */
+#define ZERO_PAGES 96           /* Zero pages after them. */
+#define UPAGE ((uint8_t *) 0x10000000)
+
+/* Returns the frame of page IDX, faulting it in if it is not
+   resident. */
+static uint8_t *
+touch (size_t idx) 
+{
+  struct thread *t = thread_current ();
+  uint8_t *upage = UPAGE + idx * PGSIZE;
+
+  if (pml4_get_page (t->pml4, upage) == NULL
+      && !vm_try_handle_fault (NULL, upage, true, true, true))
+    fail ("fault on page %zu failed", idx);
+  return pml4_get_page (t->pml4, upage);
+}
+
+/* Fills page IDX with C, as a user write would, setting its
+   dirty bit. */
+static void
+write_page (size_t idx, int c) 
+{
+  memset (touch (idx), c, PGSIZE);
+  pml4_set_dirty (thread_current ()->pml4, UPAGE + idx * PGSIZE, true);
+}
+
+/* Checks that page IDX is filled with C. */
+static void
+check_page (size_t idx, int c) 
+{
+  const uint8_t *kpage = touch (idx);
+  size_t i;
+
+  for (i = 0; i < PGSIZE; i++)
+    if (kpage[i] != (uint8_t) c)
+      fail ("page %zu byte %zu is %d, expected %d", idx, i, kpage[i],
+            (uint8_t) c);
+}
+
+void
+test_swap_evict (void) 
+{
+  struct thread *t = thread_current ();
+  struct vm_stats before, after;
+  struct file *file;
+  uint8_t *buf;
+  size_t i;
+
+  buf = palloc_get_page (0);
+  if (buf == NULL || !filesys_create ("data", FILE_PAGES * PGSIZE)
+      || (file = filesys_open ("data")) == NULL)
+    fail ("cannot create file");
+  for (i = 0; i < FILE_PAGES; i++) 
+    {
+      memset (buf, 'a' + i, PGSIZE);
+      file_write (file, buf, PGSIZE);
+    }
+  palloc_free_page (buf);
+
+  t->pml4 = pml4_create ();
+  if (t->pml4 == NULL)
+    fail ("out of memory");
+  supplemental_page_table_init (&t->spt);
+  if (!vm_load_segment (file, 0, UPAGE, FILE_PAGES * PGSIZE,
+                        ZERO_PAGES * PGSIZE, true))
+    fail ("vm_load_segment() failed");
+  file_close (file);
+
+  /* Dirty the even file pages, read the odd ones, and then fill
+     every zero page, which forces all of them out. */
+  vm_get_stats (&before);
+  for (i = 0; i < FILE_PAGES; i++)
+    if (i % 2 == 0)
+      write_page (i, 'A' + i);
+    else
+      check_page (i, 'a' + i);
+  for (i = FILE_PAGES; i < FILE_PAGES + ZERO_PAGES; i++)
+    write_page (i, i);
+  vm_get_stats (&after);
+  if (after.evict_cnt == before.evict_cnt)
+    fail ("nothing was evicted");
+  msg ("touched %d pages, evicting some.", FILE_PAGES + ZERO_PAGES);
+
+  before = after;
+  for (i = 0; i < FILE_PAGES; i++)
+    check_page (i, i % 2 == 0 ? 'A' + i : 'a' + i);
+  vm_get_stats (&after);
+  msg ("dirty file pages came back from swap.");
+  msg ("%zu clean file pages were read again.",
+       after.file_cnt - before.file_cnt);
+
+  for (i = FILE_PAGES; i < FILE_PAGES + ZERO_PAGES; i++)
+    check_page (i, i);
+  msg ("every zero page kept its contents.");
+
+  supplemental_page_table_kill (&t->spt);
+  pml4_destroy (t->pml4);
+  t->pml4 = NULL;
+  filesys_remove ("data");
+  pass ();
+}
@@ -0,0 +1,14 @@
+# -*- perl -*-
+use strict;
+use warnings;
+use tests::tests;
+check_expected ([<<'EOF']);
+(swap-evict) begin
+(swap-evict) touched 104 pages, evicting some.
+(swap-evict) dirty file pages came back from swap.
+(swap-evict) 4 clean file pages were read again.
+(swap-evict) every zero page kept its contents.
+(swap-evict) PASS
+(swap-evict) end
+EOF
+pass;
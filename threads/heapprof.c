@@ -0,0 +1,234 @@
+#include "threads/heapprof.h"
+#include <debug.h>
+#include <stdint.h>
+#include <stdio.h>
+#include "threads/interrupt.h"
+
+/* Allocation-site heap profiler.
+
+   Sampled blocks that have not yet been freed are kept in LIVE,
+   an open-addressed hash table keyed by block address, with the
+   allocator kind in the key's low bit so that a malloc() block
+   and a page never collide.  Each entry refers to its call site
+   in SITES, a second open-addressed table keyed by return
+   address, which aggregates the blocks and bytes allocated at
+   that site, both live and in total.  Both tables are static,
+   since the profiler cannot allocate memory, and are protected
+   by disabling interrupts.  A sample that finds its table full
+   is dropped and counted.
+
+   Counts are of sampled allocations only; the report scales
+   them by the sampling period to estimate the real totals. */
+
+/* Table sizes.  Powers of 2. */
+#define LIVE_MAX 2048
+#define SITE_MAX 256
+
+/* A sampled block that has not been freed. */
+struct live_block {
+	uintptr_t key;              /* Block address | kind, 0 if empty. */
+	uint32_t size;              /* Size in bytes. */
+	uint16_t site;              /* Index in SITES. */
+};
+
+/* A call site. */
+struct site {
+	const void *addr;           /* Return address, null if empty. */
+	enum heapprof_kind kind;    /* Allocator called. */
+	size_t live_cnt;            /* Sampled blocks not yet freed. */
+	size_t live_bytes;          /* Bytes in those blocks. */
+	size_t total_cnt;           /* Sampled blocks allocated. */
+	size_t total_bytes;         /* Bytes in those blocks. */
+};
+
+unsigned heapprof_period;
+static unsigned countdown;      /* Allocations until next sample. */
+static size_t dropped_cnt;      /* Samples dropped, tables full. */
+static size_t live_cnt;         /* Entries in use in LIVE. */
+
+static struct live_block live[LIVE_MAX];
+static struct site sites[SITE_MAX];
+
+/* Returns a hash of pointer-sized value X. */
+static inline size_t
+hash_ptr (uintptr_t x) {
+	x ^= x >> 29;
+	x *= 0xbf58476d1ce4e5b9ULL;
+	x ^= x >> 32;
+	return x;
+}
+
+/* Returns the key for BLOCK of the given KIND. */
+static inline uintptr_t
+make_key (enum heapprof_kind kind, const void *block) {
+	return (uintptr_t) block | (kind == HEAPPROF_PALLOC);
+}
+
+/* Starts sampling one of every PERIOD allocations, and arranges
+   for heapprof_print_stats() to report them at power off. */
+void
+heapprof_start (unsigned period) {
+	ASSERT (period > 0);
+	countdown = 1;
+	heapprof_period = period;
+}
+
+/* Counts an allocation of BLOCK, SIZE bytes of the given KIND,
+   by the caller at SITE, and records it if it is sampled. */
+void
+heapprof_record_alloc (enum heapprof_kind kind, const void *block,
+		size_t size, const void *site) {
+	enum intr_level old_level = intr_disable ();
+	uintptr_t key = make_key (kind, block);
+	size_t s, i, n;
+
+	if (heapprof_period == 0 || --countdown > 0)
+		goto done;
+	countdown = heapprof_period;
+
+	/* Find or add the site. */
+	s = hash_ptr ((uintptr_t) site) % SITE_MAX;
+	for (n = 0; n < SITE_MAX; n++, s = (s + 1) % SITE_MAX) {
+		if (sites[s].addr == site && sites[s].kind == kind)
+			break;
+		if (sites[s].addr == NULL) {
+			sites[s].addr = site;
+			sites[s].kind = kind;
+			break;
+		}
+	}
+	if (n == SITE_MAX) {
+		dropped_cnt++;
+		goto done;
+	}
+
+	/* Add the block, keeping LIVE at most 3/4 full. */
+	if (live_cnt >= LIVE_MAX / 4 * 3) {
+		dropped_cnt++;
+		goto done;
+	}
+	for (i = hash_ptr (key) % LIVE_MAX; live[i].key != 0;
+			i = (i + 1) % LIVE_MAX)
+		ASSERT (live[i].key != key);
+	live[i].key = key;
+	live[i].size = size < UINT32_MAX ? size : UINT32_MAX;
+	live[i].site = s;
+	live_cnt++;
+
+	sites[s].live_cnt++;
+	sites[s].live_bytes += live[i].size;
+	sites[s].total_cnt++;
+	sites[s].total_bytes += live[i].size;
+
+done:
+	intr_set_level (old_level);
+}
+
+/* Forgets BLOCK, of the given KIND, if it was sampled. */
+void
+heapprof_record_free (enum heapprof_kind kind, const void *block) {
+	enum intr_level old_level;
+	uintptr_t key = make_key (kind, block);
+	size_t i, j;
+
+	if (block == NULL || live_cnt == 0)
+		return;
+
+	old_level = intr_disable ();
+	for (i = hash_ptr (key) % LIVE_MAX; live[i].key != key;
+			i = (i + 1) % LIVE_MAX)
+		if (live[i].key == 0)
+			goto done;
+
+	sites[live[i].site].live_cnt--;
+	sites[live[i].site].live_bytes -= live[i].size;
+	live_cnt--;
+
+	/* Delete by shifting back later entries of the same probe
+	   sequence, so that lookups never need tombstones. */
+	for (j = (i + 1) % LIVE_MAX; live[j].key != 0; j = (j + 1) % LIVE_MAX) {
+		size_t home = hash_ptr (live[j].key) % LIVE_MAX;
+
+		/* Move entry J into hole I unless its home lies cyclically
+		   in (I, J]. */
+		if ((j > i && (home <= i || home > j))
+				|| (j < i && home <= i && home > j)) {
+			live[i] = live[j];
+			i = j;
+		}
+	}
+	live[i].key = 0;
+
+done:
+	intr_set_level (old_level);
+}
+
+/* Looks up BLOCK, of the given KIND.  If it was sampled and has
+   not been freed, stores the unscaled counts for the site that
+   allocated it in *SITE and returns true; otherwise returns
+   false. */
+bool
+heapprof_lookup (enum heapprof_kind kind, const void *block,
+		struct heapprof_site *site) {
+	enum intr_level old_level = intr_disable ();
+	uintptr_t key = make_key (kind, block);
+	bool found = false;
+	size_t i;
+
+	if (block != NULL)
+		for (i = hash_ptr (key) % LIVE_MAX; live[i].key != 0;
+				i = (i + 1) % LIVE_MAX)
+			if (live[i].key == key) {
+				struct site *s = &sites[live[i].site];
+
+				site->addr = s->addr;
+				site->live_cnt = s->live_cnt;
+				site->live_bytes = s->live_bytes;
+				site->total_cnt = s->total_cnt;
+				site->total_bytes = s->total_bytes;
+				found = true;
+				break;
+			}
+	intr_set_level (old_level);
+	return found;
+}
+
+/* Prints the sampled call sites, most live bytes first, if
+   profiling was started.  The site addresses can be given to
+   the `backtrace' utility to find the functions they are in. */
+void
+heapprof_print_stats (void) {
+	static uint16_t order[SITE_MAX];
+	unsigned period = heapprof_period;
+	size_t site_cnt = 0, i, j;
+
+	if (period == 0)
+		return;
+
+	for (i = 0; i < SITE_MAX; i++)
+		if (sites[i].addr != NULL) {
+			/* Insertion sort by decreasing live bytes. */
+			for (j = site_cnt++; j > 0
+					&& sites[order[j - 1]].live_bytes < sites[i].live_bytes; j--)
+				order[j] = order[j - 1];
+			order[j] = i;
+		}
+
+	printf ("Heap: sampled 1 in %u allocations, %zu samples dropped\n",
+			period, dropped_cnt);
+	printf ("Heap: %18s %6s %10s %12s %10s %12s\n", "site", "kind",
+			"live", "live bytes", "total", "total bytes");
+	for (i = 0; i < site_cnt; i++) {
+		struct site *s = &sites[order[i]];
+		printf ("Heap: %18p %6s %10zu %12zu %10zu %12zu\n", s->addr,
+				s->kind == HEAPPROF_MALLOC ? "malloc" : "palloc",
+				s->live_cnt * period, s->live_bytes * period,
+				s->total_cnt * period, s->total_bytes * period);
+	}
+
+	/* One line that can be pasted after `backtrace'. */
+	printf ("Heap sites:");
+	for (i = 0; i < site_cnt; i++)
+		printf (" %p", sites[order[i]].addr);
+	printf ("\n");
+}
@@ -13,14 +13,21 @@
 #include "devices/serial.h"
 #include "devices/timer.h"
 #include "devices/vga.h"
+#include "threads/heapprof.h"
 #include "threads/interrupt.h"
 #include "threads/io.h"
+#include "threads/ksm.h"
 #include "threads/loader.h"
 #include "threads/malloc.h"
 #include "threads/mmu.h"
 #include "threads/palloc.h"
 #include "threads/pte.h"
+#include "threads/rcu.h"
+#include "threads/shrinker.h"
+#include "threads/slab.h"
+#include "threads/synch.h"
 #include "threads/thread.h"
+#include "threads/vmalloc.h"
 #ifdef USERPROG
 #include "userprog/process.h"
 #include "userprog/exception.h"
@@ -35,6 +42,9 @@
 #include "filesys/filesys.h"
 #include "filesys/fsutil.h"
 #endif
+#ifdef VM
+#include "vm/vm.h"
+#endif
 
 /* Page-map-level-4 with kernel mappings only. */
 uint64_t *base_pml4;
@@ -55,7 +65,7 @@ static char **parse_options (char **argv);
 static void run_actions (char **argv);
 static void usage (void);
 
-static void print_stats (void);
+static void print_stats (bool panicking);
 
 
 int main (void) NO_RETURN;
@@ -82,6 +92,7 @@ main (void) {
 	mem_end = palloc_init ();
 	malloc_init ();
 	paging_init (mem_end);
+	vmalloc_init ();
 
 #ifdef USERPROG
 	tss_init ();
@@ -99,6 +110,7 @@ main (void) {
 #endif
 	/* Start thread scheduler and enable interrupts. */
 	thread_start ();
+	rcu_init ();
 	serial_init_queue ();
 	timer_calibrate ();
 
@@ -107,6 +119,9 @@ main (void) {
 	disk_init ();
 	filesys_init (format_filesys);
 #endif
+#ifdef VM
+	vm_init ();
+#endif
 
 	printf ("Boot complete.\n");
 
@@ -134,28 +149,50 @@ bss_init (void) {
 
 /* Populates the page table with the kernel virtual mapping,
  * and then sets up the CPU to use the new page directory.
- * Points base_pml4 to the pml4 it creates. */
+ * Points base_pml4 to the pml4 it creates.
+ *
+ * The mapping uses 2 MB pages wherever a whole aligned 2 MB
+ * region is below MEM_END and is either all kernel text, which
+ * is mapped read-only, or has no kernel text at all.  The rest,
+ * around the edges of the text and at the end of memory, is
+ * mapped with 4 kB pages. */
 static void
 paging_init (uint64_t mem_end) {
 	uint64_t *pml4, *pte;
+	uint64_t size;
 	int perm;
 	pml4 = base_pml4 = palloc_get_page (PAL_ASSERT | PAL_ZERO);
 
 	extern char start, _end_kernel_text;
+	uint64_t text_start = (uint64_t) &start;
+	uint64_t text_end = (uint64_t) &_end_kernel_text;
+
 	// Maps physical address [0 ~ mem_end] to
 	//   [LOADER_KERN_BASE ~ LOADER_KERN_BASE + mem_end].
-	for (uint64_t pa = 0; pa < mem_end; pa += PGSIZE) {
+	for (uint64_t pa = 0; pa < mem_end; pa += size) {
 		uint64_t va = (uint64_t) ptov(pa);
 
+		size = LARGE_PGSIZE;
+		if (va % size != 0 || mem_end - pa < size
+				|| (va < text_end && va + size > text_start
+					&& (va < text_start || va + size > text_end)))
+			size = PGSIZE;
+
 		perm = PTE_P | PTE_W;
-		if ((uint64_t) &start <= va && va < (uint64_t) &_end_kernel_text)
+		if (text_start <= va && va < text_end)
 			perm &= ~PTE_W;
 
-		if ((pte = pml4e_walk (pml4, va, 1)) != NULL)
-			*pte = pa | perm;
+		if (size == LARGE_PGSIZE)
+			pte = pml4e_walk_large (pml4, va);
+		else
+			pte = pml4e_walk (pml4, va, 1);
+		if (pte == NULL)
+			PANIC ("paging_init: out of memory for page tables");
+		*pte = pa | perm | (size == LARGE_PGSIZE ? PTE_PS : 0);
 	}
 
 	// reload cr3
+	pcid_init ();
 	pml4_activate(0);
 }
 
@@ -216,6 +253,14 @@ parse_options (char **argv) {
 #ifdef USERPROG
 		else if (!strcmp (name, "-ul"))
 			user_page_limit = atoi (value);
+#endif
+#ifdef VM
+		else if (!strcmp (name, "-fa")) {
+			int pages = atoi (value);
+			if (pages <= 0 || (pages & (pages - 1)) != 0)
+				PANIC ("-fa: PAGES must be a power of two");
+			vm_fault_around = pages;
+		}
 #endif
 		else
 			PANIC ("unknown option `%s' (use -h for help)", name);
@@ -224,6 +269,40 @@ parse_options (char **argv) {
 	return argv;
 }
 
+/* Starts lock profiling; the ARGV[1] most contended locks are
+   reported at power off. */
+static void
+run_lockstat (char **argv) {
+	lock_profile_start (atoi (argv[1]));
+}
+
+/* Starts heap profiling, sampling one in ARGV[1] allocations;
+   the call sites are reported at power off. */
+static void
+run_heapprof (char **argv) {
+	int period = atoi (argv[1]);
+
+	if (period <= 0)
+		PANIC ("heapprof: sampling period must be positive");
+	heapprof_start (period);
+}
+
+/* Prints the heap profile collected so far. */
+static void
+run_heapdump (char **argv UNUSED) {
+	heapprof_print_stats ();
+}
+
+/* Prints memory usage and fragmentation statistics. */
+static void
+run_memstat (char **argv UNUSED) {
+	palloc_print_stats ();
+	malloc_print_stats ();
+	kmem_cache_print_stats ();
+	shrinker_print_stats ();
+	ksm_print_stats ();
+}
+
 /* Runs the task specified in ARGV[1]. */
 static void
 run_task (char **argv) {
@@ -252,6 +331,10 @@ run_actions (char **argv) {
 	/* Table of supported actions. */
 	static const struct action actions[] = {
 		{"run", 2, run_task},
+		{"lockstat", 2, run_lockstat},
+		{"memstat", 1, run_memstat},
+		{"heapprof", 2, run_heapprof},
+		{"heapdump", 1, run_heapdump},
 #ifdef FILESYS
 		{"ls", 1, fsutil_ls},
 		{"cat", 2, fsutil_cat},
@@ -298,6 +381,10 @@ usage (void) {
 #else
 			"  run TEST           Run TEST.\n"
 #endif
+			"  lockstat N         Profile locks, report top N at power off.\n"
+			"  memstat            Print memory usage and fragmentation.\n"
+			"  heapprof N         Sample 1 in N allocations, report at power off.\n"
+			"  heapdump           Print the heap profile so far.\n"
 #ifdef FILESYS
 			"  ls                 List files in the root directory.\n"
 			"  cat FILE           Print FILE to the console.\n"
@@ -314,6 +401,9 @@ usage (void) {
 			"  -mlfqs             Use multi-level feedback queue scheduler.\n"
 #ifdef USERPROG
 			"  -ul=COUNT          Limit user memory to COUNT pages.\n"
+#endif
+#ifdef VM
+			"  -fa=PAGES          Map up to PAGES cached pages per fault.\n"
 #endif
 			);
 	power_off ();
@@ -324,11 +414,15 @@ usage (void) {
    as long as we're running on Bochs or QEMU. */
 void
 power_off (void) {
+	/* debug_panic() powers off with interrupts disabled, possibly
+	   from an interrupt handler or while holding any lock. */
+	bool panicking = intr_get_level () == INTR_OFF;
+
 #ifdef FILESYS
 	filesys_done ();
 #endif
 
-	print_stats ();
+	print_stats (panicking);
 
 	printf ("Powering off...\n");
 	outw (0x604, 0x2000);               /* Poweroff command for qemu */
@@ -337,9 +431,21 @@ power_off (void) {
 
 /* Print statistics about Pintos execution. */
 static void
-print_stats (void) {
+print_stats (bool panicking) {
 	timer_print_stats ();
 	thread_print_stats ();
+	lock_print_stats ();
+
+	/* These take locks, which a panicking thread may already hold
+	   or be unable to wait for. */
+	if (!panicking) {
+		palloc_print_stats ();
+		malloc_print_stats ();
+		kmem_cache_print_stats ();
+		shrinker_print_stats ();
+		ksm_print_stats ();
+	}
+	heapprof_print_stats ();
 #ifdef FILESYS
 	disk_print_stats ();
 #endif
@@ -348,4 +454,7 @@ print_stats (void) {
 #ifdef USERPROG
 	exception_print_stats ();
 #endif
+#ifdef VM
+	vm_print_stats ();
+#endif
 }
@@ -0,0 +1,495 @@
+#include "threads/ksm.h"
+#include <debug.h>
+#include <hash.h>
+#include <list.h>
+#include <stdio.h>
+#include <string.h>
+#include "devices/timer.h"
+#include "threads/interrupt.h"
+#include "threads/malloc.h"
+#include "threads/mmu.h"
+#include "threads/palloc.h"
+#include "threads/synch.h"
+#include "threads/thread.h"
+#include "threads/vaddr.h"
+#ifdef VM
+#include "vm/frame.h"
+#include "vm/vm.h"
+#endif
+
+/* The scanner visits the pages of the registered ranges in turn
+   and hashes each one.  A page whose hash changed since its last
+   visit is being written to, so it is left alone until it
+   settles.  Otherwise the scanner looks for an identical page,
+   first among the shared frames in the "stable" table and then
+   among the pages visited earlier in the same pass in the
+   "unstable" table.  A match in the stable table just points
+   the page at the shared frame.  A match in the unstable table
+   first turns the matching page's frame into a new shared frame.
+
+   The unstable table holds pages that may change at any time,
+   so it is emptied after each pass.  The stable table holds a
+   reference to each shared frame, which it drops at the end of
+   a pass once no mapping uses the frame any more.
+
+   Only frames that belong to nothing but their one mapping are
+   merged.  Page-cache frames and frames that are already shared
+   are left alone.  A frame in the VM frame table is merged only
+   with another one, through vm_merge_frame(), which makes the
+   two entries share it copy-on-write as fork would, and a write
+   fault on it is handled by vm_try_handle_fault() rather than by
+   ksm_fault().  The scanner holds frame_lock while it looks at a
+   page, so that the frame table does not evict or copy the page
+   underneath it. */
+
+#define BUCKET_CNT 64           /* Buckets in each table. */
+#define SCAN_BATCH 100          /* Pages scanned per wakeup. */
+#define SCAN_SLEEP 20           /* Timer ticks between wakeups. */
+
+/* A range registered with ksm_register(). */
+struct ksm_area {
+	struct list_elem elem;      /* Element in AREAS. */
+	uint64_t *pml4;             /* Page map that holds the range. */
+	uint8_t *upage;             /* First user virtual page. */
+	size_t page_cnt;            /* Number of pages. */
+	unsigned *hashes;           /* Hash of each page at last visit. */
+};
+
+/* A shared frame in the stable table, or a candidate page in the
+   unstable table. */
+struct ksm_node {
+	struct list_elem elem;      /* Element in a bucket. */
+	unsigned hash;              /* Hash of the contents. */
+	void *kpage;                /* The frame. */
+	struct ksm_area *area;      /* Unstable only: where KPAGE was */
+	uint8_t *upage;             /* mapped when it was visited. */
+};
+
+/* Protects everything below. */
+static struct lock ksm_lock;
+static bool ksm_initialized;
+
+static struct list areas;                   /* Registered ranges. */
+static struct list stable[BUCKET_CNT];      /* Shared frames. */
+static struct list unstable[BUCKET_CNT];    /* Candidates this pass. */
+
+/* Next page to scan: page CURSOR_IDX of CURSOR_AREA, or the
+   start of a new pass if CURSOR_AREA is null. */
+static struct ksm_area *cursor_area;
+static size_t cursor_idx;
+
+static size_t merge_cnt, unmerge_cnt, scan_cnt;
+
+static thread_func ksm_thread;
+static void scan_page (struct ksm_area *, size_t idx);
+static void end_pass (void);
+
+/* Initializes the tables and starts the scanner the first time
+   a range is registered. */
+static void
+init_ksm (void) {
+	enum intr_level old_level = intr_disable ();
+	bool first = !ksm_initialized;
+	size_t i;
+
+	if (first) {
+		lock_init_named (&ksm_lock, "ksm");
+		list_init (&areas);
+		for (i = 0; i < BUCKET_CNT; i++) {
+			list_init (&stable[i]);
+			list_init (&unstable[i]);
+		}
+		ksm_initialized = true;
+	}
+	intr_set_level (old_level);
+
+	if (first && thread_create ("ksm", PRI_MIN, ksm_thread, NULL) == TID_ERROR)
+		PANIC ("ksm: cannot create scanner thread");
+}
+
+/* Makes the PAGE_CNT user virtual pages starting at UPAGE in
+   PML4 mergeable.  The pages need not be mapped yet.  The range
+   must be unregistered with ksm_unregister() before PML4 is
+   destroyed.  Returns true if successful, false if memory
+   allocation failed. */
+bool
+ksm_register (uint64_t *pml4, void *upage, size_t page_cnt) {
+	struct ksm_area *a;
+
+	ASSERT (pg_ofs (upage) == 0);
+	ASSERT (page_cnt > 0 && is_user_vaddr ((uint8_t *) upage
+				+ page_cnt * PGSIZE - 1));
+
+	init_ksm ();
+	a = malloc (sizeof *a);
+	if (a == NULL)
+		return false;
+	a->hashes = calloc (page_cnt, sizeof *a->hashes);
+	if (a->hashes == NULL) {
+		free (a);
+		return false;
+	}
+	a->pml4 = pml4;
+	a->upage = upage;
+	a->page_cnt = page_cnt;
+
+	lock_acquire (&ksm_lock);
+	list_push_back (&areas, &a->elem);
+	lock_release (&ksm_lock);
+	return true;
+}
+
+/* Unregisters every range in PML4.  Pages already merged stay
+   shared until they are written or unmapped. */
+void
+ksm_unregister (uint64_t *pml4) {
+	struct list_elem *e, *next;
+	size_t i;
+
+	if (!ksm_initialized)
+		return;
+
+	lock_acquire (&ksm_lock);
+	for (i = 0; i < BUCKET_CNT; i++)
+		for (e = list_begin (&unstable[i]); e != list_end (&unstable[i]);
+				e = next) {
+			struct ksm_node *n = list_entry (e, struct ksm_node, elem);
+			next = list_next (e);
+			if (n->area->pml4 == pml4) {
+				list_remove (e);
+				free (n);
+			}
+		}
+	for (e = list_begin (&areas); e != list_end (&areas); e = next) {
+		struct ksm_area *a = list_entry (e, struct ksm_area, elem);
+		next = list_next (e);
+		if (a->pml4 != pml4)
+			continue;
+		if (a == cursor_area) {
+			cursor_area = next != list_end (&areas)
+				? list_entry (next, struct ksm_area, elem) : NULL;
+			cursor_idx = 0;
+		}
+		list_remove (e);
+		free (a->hashes);
+		free (a);
+	}
+	lock_release (&ksm_lock);
+}
+
+/* Scans the next PAGE_CNT pages of the registered ranges,
+   wrapping around to start a new pass as needed.  With no ranges
+   registered, just frees shared frames no longer in use. */
+void
+ksm_scan (size_t page_cnt) {
+	if (!ksm_initialized)
+		return;
+
+	lock_acquire (&ksm_lock);
+	if (list_empty (&areas))
+		end_pass ();
+	while (page_cnt-- > 0 && !list_empty (&areas)) {
+		struct list_elem *next;
+
+		if (cursor_area == NULL) {
+			cursor_area = list_entry (list_begin (&areas), struct ksm_area, elem);
+			cursor_idx = 0;
+		}
+#ifdef VM
+		lock_acquire (&frame_lock);
+#endif
+		scan_page (cursor_area, cursor_idx);
+#ifdef VM
+		lock_release (&frame_lock);
+#endif
+		if (++cursor_idx < cursor_area->page_cnt)
+			continue;
+
+		next = list_next (&cursor_area->elem);
+		cursor_idx = 0;
+		if (next != list_end (&areas))
+			cursor_area = list_entry (next, struct ksm_area, elem);
+		else {
+			cursor_area = NULL;
+			end_pass ();
+		}
+	}
+	lock_release (&ksm_lock);
+}
+
+/* Scanner thread. */
+static void
+ksm_thread (void *aux UNUSED) {
+	for (;;) {
+		timer_sleep (SCAN_SLEEP);
+		ksm_scan (SCAN_BATCH);
+	}
+}
+
+/* Returns the page table entry that maps UPAGE in PML4 if it is
+   present, otherwise a null pointer. */
+static uint64_t *
+present_pte (uint64_t *pml4, void *upage) {
+	uint64_t *pte = pml4e_walk (pml4, (uint64_t) upage, 0);
+
+	return pte != NULL && (*pte & PTE_P) ? pte : NULL;
+}
+
+/* Returns true if KPAGE may be merged with OTHER: either both
+   are in the VM frame table or neither is.  A shared frame that
+   has left the frame table because nothing maps it any more
+   counts as outside it. */
+static bool
+same_owner (void *kpage, void *other) {
+	return ((kva_to_page (kpage)->flags ^ kva_to_page (other)->flags)
+			& PAGE_LRU) == 0;
+}
+
+/* Returns the shared frame whose contents match KPAGE, which
+   hashes to HASH, or a null pointer if there is none. */
+static struct ksm_node *
+find_stable (void *kpage, unsigned hash) {
+	struct list *bucket = &stable[hash % BUCKET_CNT];
+	struct list_elem *e;
+
+	for (e = list_begin (bucket); e != list_end (bucket); e = list_next (e)) {
+		struct ksm_node *n = list_entry (e, struct ksm_node, elem);
+		if (n->hash == hash && same_owner (kpage, n->kpage)
+				&& !memcmp (n->kpage, kpage, PGSIZE))
+			return n;
+	}
+	return NULL;
+}
+
+/* Returns and removes the candidate page whose contents match
+   KPAGE, which hashes to HASH, or returns a null pointer if there
+   is none.  Drops candidates that have been unmapped or
+   write-protected since they were visited. */
+static struct ksm_node *
+take_unstable (void *kpage, unsigned hash) {
+	struct list *bucket = &unstable[hash % BUCKET_CNT];
+	struct list_elem *e, *next;
+
+	for (e = list_begin (bucket); e != list_end (bucket); e = next) {
+		struct ksm_node *n = list_entry (e, struct ksm_node, elem);
+		uint64_t *pte;
+
+		next = list_next (e);
+		if (n->hash != hash)
+			continue;
+		pte = present_pte (n->area->pml4, n->upage);
+		if (pte == NULL || ptov (PTE_ADDR (*pte)) != n->kpage
+				|| !(*pte & PTE_W)) {
+			list_remove (e);
+			free (n);
+		} else if (n->kpage != kpage && same_owner (kpage, n->kpage)
+				&& !memcmp (n->kpage, kpage, PGSIZE)) {
+			list_remove (e);
+			return n;
+		}
+	}
+	return NULL;
+}
+
+/* Points UPAGE in PML4, which maps KPAGE, at shared frame SHARED
+   instead, read-only, and drops KPAGE. */
+static void
+merge_page (uint64_t *pml4, void *upage, void *kpage, void *shared) {
+	bool success;
+
+#ifdef VM
+	if (kva_to_page (kpage)->flags & PAGE_LRU) {
+		vm_merge_frame (kpage, shared);
+		merge_cnt++;
+		return;
+	}
+#endif
+	pml4_clear_page (pml4, upage);
+	success = pml4_set_page (pml4, upage, shared, false);
+	ASSERT (success);
+	page_get (kva_to_page (shared));
+	page_put (kva_to_page (kpage));
+	merge_cnt++;
+}
+
+/* Returns true if KPAGE is mapped only once and belongs to no
+   other subsystem but, under VM, the frame table, so that
+   merging may replace it. */
+static bool
+is_private (void *kpage) {
+	struct page *page = kva_to_page (kpage);
+
+	if (page->refcnt != 1)
+		return false;
+#ifdef VM
+	if (page->flags & PAGE_LRU) {
+		struct vm_entry *e = page->mapping;
+		return e->kpage == kpage && e->sharer == e;
+	}
+#endif
+	return page->mapping == NULL && !(page->flags & PAGE_LRU);
+}
+
+/* Scans page IDX of area A. */
+static void
+scan_page (struct ksm_area *a, size_t idx) {
+	uint8_t *upage = a->upage + idx * PGSIZE;
+	uint64_t *pte = present_pte (a->pml4, upage);
+	struct ksm_node *n;
+	void *kpage;
+	unsigned hash;
+
+	/* Merged pages are read-only, and so is anything else we
+	   should not touch. */
+	if (pte == NULL || !(*pte & PTE_W))
+		return;
+	kpage = ptov (PTE_ADDR (*pte));
+	if (!is_private (kpage))
+		return;
+	hash = hash_bytes (kpage, PGSIZE);
+	if (hash != a->hashes[idx]) {
+		a->hashes[idx] = hash;
+		return;
+	}
+
+	/* Keep the page from changing while we compare it. */
+	pml4_protect_range (a->pml4, upage, 1, false);
+
+	n = find_stable (kpage, hash);
+	if (n != NULL) {
+		merge_page (a->pml4, upage, kpage, n->kpage);
+		return;
+	}
+
+	n = take_unstable (kpage, hash);
+	if (n != NULL) {
+		/* Compare again now that the candidate cannot change. */
+		pml4_protect_range (n->area->pml4, n->upage, 1, false);
+		if (!memcmp (n->kpage, kpage, PGSIZE)) {
+			struct page *shared = kva_to_page (n->kpage);
+
+			shared->flags |= PAGE_KSM;
+			page_get (shared);
+			n->area = NULL;
+			n->upage = NULL;
+			list_push_back (&stable[hash % BUCKET_CNT], &n->elem);
+			merge_page (a->pml4, upage, kpage, n->kpage);
+			return;
+		}
+		pml4_protect_range (n->area->pml4, n->upage, 1, true);
+		free (n);
+	}
+
+	/* No match.  Remember the page for the rest of the pass. */
+	pml4_protect_range (a->pml4, upage, 1, true);
+	n = malloc (sizeof *n);
+	if (n != NULL) {
+		n->hash = hash;
+		n->kpage = kpage;
+		n->area = a;
+		n->upage = upage;
+		list_push_back (&unstable[hash % BUCKET_CNT], &n->elem);
+	}
+}
+
+/* Empties the unstable table and frees shared frames that only
+   the stable table still refers to. */
+static void
+end_pass (void) {
+	struct list_elem *e, *next;
+	size_t i;
+
+	ASSERT (lock_held_by_current_thread (&ksm_lock));
+
+	for (i = 0; i < BUCKET_CNT; i++) {
+		while (!list_empty (&unstable[i]))
+			free (list_entry (list_pop_front (&unstable[i]), struct ksm_node,
+						elem));
+		for (e = list_begin (&stable[i]); e != list_end (&stable[i]); e = next) {
+			struct ksm_node *n = list_entry (e, struct ksm_node, elem);
+			struct page *page = kva_to_page (n->kpage);
+
+			next = list_next (e);
+			if (page->refcnt == 1) {
+				list_remove (e);
+				page->flags &= ~PAGE_KSM;
+				page_put (page);
+				free (n);
+			}
+		}
+	}
+	if (!list_empty (&areas))
+		scan_cnt++;
+}
+
+/* Handles a write fault on UPAGE in PML4.  If UPAGE maps a
+   shared frame, gives it a private, writable copy and returns
+   true.  Returns false if UPAGE does not map a shared frame,
+   maps one in the VM frame table, which vm_try_handle_fault()
+   unshares itself, or memory allocation failed. */
+bool
+ksm_fault (uint64_t *pml4, void *upage) {
+	uint64_t *pte;
+	void *kpage, *copy;
+	bool success = false;
+
+	if (!ksm_initialized)
+		return false;
+
+	upage = pg_round_down (upage);
+	lock_acquire (&ksm_lock);
+	pte = present_pte (pml4, upage);
+	if (pte != NULL && !(*pte & PTE_W)) {
+		kpage = ptov (PTE_ADDR (*pte));
+		if ((kva_to_page (kpage)->flags & (PAGE_KSM | PAGE_LRU)) == PAGE_KSM
+				&& (copy = palloc_get_page (PAL_USER)) != NULL) {
+			memcpy (copy, kpage, PGSIZE);
+			pml4_clear_page (pml4, upage);
+			success = pml4_set_page (pml4, upage, copy, true);
+			ASSERT (success);
+			page_put (kva_to_page (kpage));
+			unmerge_cnt++;
+		}
+	}
+	lock_release (&ksm_lock);
+	return success;
+}
+
+/* Stores merging statistics in STATS. */
+void
+ksm_get_stats (struct ksm_stats *stats) {
+	size_t i;
+
+	memset (stats, 0, sizeof *stats);
+	if (!ksm_initialized)
+		return;
+
+	lock_acquire (&ksm_lock);
+	for (i = 0; i < BUCKET_CNT; i++) {
+		struct list_elem *e;
+
+		for (e = list_begin (&stable[i]); e != list_end (&stable[i]);
+				e = list_next (e)) {
+			struct ksm_node *n = list_entry (e, struct ksm_node, elem);
+			stats->shared_cnt++;
+			stats->sharing_cnt += kva_to_page (n->kpage)->refcnt - 1;
+		}
+	}
+	stats->merge_cnt = merge_cnt;
+	stats->unmerge_cnt = unmerge_cnt;
+	stats->scan_cnt = scan_cnt;
+	lock_release (&ksm_lock);
+}
+
+/* Prints merging statistics. */
+void
+ksm_print_stats (void) {
+	struct ksm_stats s;
+
+	if (!ksm_initialized)
+		return;
+	ksm_get_stats (&s);
+	printf ("KSM: %zu frames shared by %zu mappings, %zu merged, "
+			"%zu unmerged, %zu passes\n", s.shared_cnt, s.sharing_cnt,
+			s.merge_cnt, s.unmerge_cnt, s.scan_cnt);
+}
@@ -5,41 +5,90 @@
 #include <stdint.h>
 #include <stdio.h>
 #include <string.h>
+#include "threads/heapprof.h"
+#include "threads/interrupt.h"
 #include "threads/palloc.h"
+#include "threads/shrinker.h"
 #include "threads/synch.h"
+#include "threads/thread.h"
 #include "threads/vaddr.h"
+#include "threads/vmalloc.h"
 
 /* A simple implementation of malloc().
 
-   The size of each request, in bytes, is rounded up to a power
-   of 2 and assigned to the "descriptor" that manages blocks of
-   that size.  The descriptor keeps a list of free blocks.  If
-   the free list is nonempty, one of its blocks is used to
-   satisfy the request.
-
-   Otherwise, a new page of memory, called an "arena", is
+   The size of each request, in bytes, is rounded up to a "size
+   class" and assigned to the "descriptor" that manages blocks of
+   that size.  Classes are spaced 16 bytes apart up to 128 bytes
+   and then four to each doubling (160, 192, 224, 256, 320, ...),
+   so that above 128 bytes rounding wastes less than a fifth of a
+   block, and they continue past the page size up to MID_MAX
+   bytes.  The class for a size is found with a single table
+   lookup.  The descriptor keeps a list of free blocks.  If the
+   free list is nonempty, one of its blocks is used to satisfy
+   the request.
+
+   Otherwise, a new "arena" of one or more contiguous pages is
    obtained from the page allocator (if none is available,
-   malloc() returns a null pointer).  The new arena is divided
-   into blocks, all of which are added to the descriptor's free
-   list.  Then we return one of the new blocks.
+   malloc() returns a null pointer).  Each descriptor's arena
+   size is chosen so that little of it is left over after
+   dividing it into blocks.  The new arena is divided into
+   blocks, all of which are added to the descriptor's free list.
+   Then we return one of the new blocks.
 
    When we free a block, we add it to its descriptor's free list.
    But if the arena that the block was in now has no in-use
-   blocks, we remove all of the arena's blocks from the free list
-   and give the arena back to the page allocator.
-
-   We can't handle blocks bigger than 2 kB using this scheme,
-   because they're too big to fit in a single page with a
-   descriptor.  We handle those by allocating contiguous pages
-   with the page allocator and sticking the allocation size at
-   the beginning of the allocated block's arena header. */
+   blocks, and the descriptor already has another such arena, we
+   remove all of the arena's blocks from the free list and give
+   the arena back to the page allocator.  Keeping one empty arena
+   stops a workload that allocates and frees across an arena
+   boundary from going to the page allocator every time.  Under
+   memory pressure, a shrinker frees those arenas too.
+
+   Each thread also keeps a small cache of free blocks for each
+   class of up to 1 kB, which only the thread itself touches.
+   malloc() and free() use the cache without taking the
+   descriptor's lock, and move blocks between the cache and the
+   descriptor in batches when the cache runs empty or full.
+   Blocks in a cache count as in use in their arenas.  A thread's
+   cache is created on its first malloc() and flushed by
+   malloc_thread_exit().
+
+   A block in an arena that spans several pages may start in any
+   of its pages, so a block's arena header is found through the
+   owner that palloc_set_owner() records for each page.
+
+   Requests bigger than MID_MAX bytes are handled by allocating
+   contiguous pages with the page allocator and sticking the
+   allocation size at the beginning of the allocated block's
+   arena header.  If physical memory is too fragmented for that,
+   the pages come from vmalloc() instead, which only needs them
+   to be virtually contiguous.
+
+   malloc_print_stats() reports, for each size class, the blocks
+   and arenas in use and their peaks. */
+
+/* Largest request served from a size class. */
+#define MID_MAX 8192
+
+/* Largest arena, in pages. */
+#define MAX_ARENA_PAGES 8
 
 /* Descriptor. */
 struct desc {
 	size_t block_size;          /* Size of each element in bytes. */
 	size_t blocks_per_arena;    /* Number of blocks in an arena. */
+	size_t arena_pages;         /* Number of pages in an arena. */
 	struct list free_list;      /* List of free blocks. */
+	size_t empty_cnt;           /* Arenas with no blocks in use. */
+	size_t cache_max;           /* Most blocks in a thread's cache. */
 	struct lock lock;           /* Lock. */
+	char name[16];              /* Lock name, e.g. "malloc 64". */
+
+	/* Statistics, protected by LOCK. */
+	size_t used_cnt;            /* Blocks in use or in thread caches. */
+	size_t peak_used_cnt;       /* Maximum of USED_CNT. */
+	size_t arena_cnt;           /* Arenas allocated. */
+	size_t peak_arena_cnt;      /* Maximum of ARENA_CNT. */
 };
 
 /* Magic number for detecting arena corruption. */
@@ -57,25 +106,88 @@ struct block {
 	struct list_elem free_elem; /* Free list element. */
 };
 
+/* Number of size classes with per-thread caches: 16 bytes
+   through 1 kB. */
+#define CACHE_CLASSES 20
+
+/* Bytes of blocks a thread's cache holds per class, roughly. */
+#define CACHE_BYTES 2048
+
+/* Free block in a thread's cache. */
+struct cached_block {
+	struct cached_block *next;  /* Next block in the cache. */
+};
+
+/* A thread's cache of free blocks. */
+struct malloc_cache {
+	struct cached_block *head[CACHE_CLASSES];   /* Free blocks. */
+	uint8_t cnt[CACHE_CLASSES];                 /* Blocks in HEAD[]. */
+};
+
 /* Our set of descriptors. */
-static struct desc descs[10];   /* Descriptors. */
+static struct desc descs[32];   /* Descriptors. */
 static size_t desc_cnt;         /* Number of descriptors. */
 
+/* Maps DIV_ROUND_UP (SIZE, 16) to the index in DESCS of the
+   smallest descriptor that satisfies a SIZE-byte request. */
+static uint8_t size_class[MID_MAX / 16 + 1];
+
+/* Statistics for big blocks, protected by disabling
+   interrupts. */
+static size_t big_cnt;          /* Big blocks in use. */
+static size_t big_pages;        /* Pages in big blocks in use. */
+static size_t peak_big_pages;   /* Maximum of BIG_PAGES. */
+
+static void *malloc_block (size_t size);
 static struct arena *block_to_arena (struct block *);
 static struct block *arena_to_block (struct arena *, size_t idx);
+static size_t arena_pages_for (size_t block_size);
+static struct block *desc_get (struct desc *);
+static void desc_put (struct desc *, struct block *);
+static struct malloc_cache *get_cache (void);
+static void cache_refill (struct malloc_cache *, size_t class);
+static void cache_flush (struct malloc_cache *, size_t class, size_t cnt);
+static void big_count (size_t page_cnt, bool alloc);
+static void free_arena (struct desc *, struct arena *);
+static struct shrinker malloc_shrinker;
 
 /* Initializes the malloc() descriptors. */
 void
 malloc_init (void) {
-	size_t block_size;
+	size_t block_size, step, i;
 
-	for (block_size = 16; block_size < PGSIZE / 2; block_size *= 2) {
+	for (block_size = 16; block_size <= MID_MAX; block_size += step) {
 		struct desc *d = &descs[desc_cnt++];
 		ASSERT (desc_cnt <= sizeof descs / sizeof *descs);
 		d->block_size = block_size;
-		d->blocks_per_arena = (PGSIZE - sizeof (struct arena)) / block_size;
+		d->arena_pages = arena_pages_for (block_size);
+		d->blocks_per_arena = (d->arena_pages * PGSIZE - sizeof (struct arena))
+			/ block_size;
 		list_init (&d->free_list);
-		lock_init (&d->lock);
+		d->empty_cnt = 0;
+		d->used_cnt = d->peak_used_cnt = 0;
+		d->arena_cnt = d->peak_arena_cnt = 0;
+		d->cache_max = CACHE_BYTES / block_size;
+		if (d->cache_max < 2)
+			d->cache_max = 2;
+		else if (d->cache_max > 16)
+			d->cache_max = 16;
+		snprintf (d->name, sizeof d->name, "malloc %zu", block_size);
+		lock_init_named (&d->lock, d->name);
+
+		/* The next class is 16 bytes up to 128, then a quarter of the
+		   largest power of 2 not above BLOCK_SIZE further. */
+		for (step = 16; block_size >= 128 && step * 8 <= block_size; step *= 2)
+			continue;
+	}
+	ASSERT (descs[CACHE_CLASSES - 1].block_size == 1024);
+	shrinker_register (&malloc_shrinker);
+
+	for (i = 0; i <= MID_MAX / 16; i++) {
+		size_t c = i > 0 ? size_class[i - 1] : 0;
+		while (descs[c].block_size < i * 16)
+			c++;
+		size_class[i] = c;
 	}
 }
 
@@ -83,62 +195,71 @@ malloc_init (void) {
    Returns a null pointer if memory is not available. */
 void *
 malloc (size_t size) {
+	void *p = malloc_block (size);
+
+	heapprof_alloc (HEAPPROF_MALLOC, p, size, __builtin_return_address (0));
+	return p;
+}
+
+/* Does the work of malloc(), without telling the heap profiler,
+   so that each public entry point can report its own caller. */
+static void *
+malloc_block (size_t size) {
+	struct malloc_cache *c;
 	struct desc *d;
 	struct block *b;
 	struct arena *a;
+	size_t class;
 
 	/* A null pointer satisfies a request for 0 bytes. */
 	if (size == 0)
 		return NULL;
 
-	/* Find the smallest descriptor that satisfies a SIZE-byte
-	   request. */
-	for (d = descs; d < descs + desc_cnt; d++)
-		if (d->block_size >= size)
-			break;
-	if (d == descs + desc_cnt) {
+	if (size > MID_MAX) {
 		/* SIZE is too big for any descriptor.
 		   Allocate enough pages to hold SIZE plus an arena. */
 		size_t page_cnt = DIV_ROUND_UP (size + sizeof *a, PGSIZE);
 		a = palloc_get_multiple (0, page_cnt);
-		if (a == NULL)
-			return NULL;
+		if (a != NULL)
+			palloc_set_owner (a, page_cnt, a);
+		else {
+			a = vmalloc (page_cnt * PGSIZE);
+			if (a == NULL)
+				return NULL;
+		}
 
 		/* Initialize the arena to indicate a big block of PAGE_CNT
 		   pages, and return it. */
 		a->magic = ARENA_MAGIC;
 		a->desc = NULL;
 		a->free_cnt = page_cnt;
+		big_count (page_cnt, true);
 		return a + 1;
 	}
 
-	lock_acquire (&d->lock);
-
-	/* If the free list is empty, create a new arena. */
-	if (list_empty (&d->free_list)) {
-		size_t i;
-
-		/* Allocate a page. */
-		a = palloc_get_page (0);
-		if (a == NULL) {
-			lock_release (&d->lock);
-			return NULL;
-		}
-
-		/* Initialize arena and add its blocks to the free list. */
-		a->magic = ARENA_MAGIC;
-		a->desc = d;
-		a->free_cnt = d->blocks_per_arena;
-		for (i = 0; i < d->blocks_per_arena; i++) {
-			struct block *b = arena_to_block (a, i);
-			list_push_back (&d->free_list, &b->free_elem);
+	/* Find the smallest descriptor that satisfies a SIZE-byte
+	   request. */
+	class = size_class[DIV_ROUND_UP (size, 16)];
+	d = &descs[class];
+	ASSERT (d->block_size >= size);
+
+	/* Take a block from this thread's cache, if it has one. */
+	if (class < CACHE_CLASSES && (c = get_cache ()) != NULL) {
+		struct cached_block *cb;
+
+		if (c->cnt[class] == 0) {
+			cache_refill (c, class);
+			if (c->cnt[class] == 0)
+				return NULL;
 		}
+		cb = c->head[class];
+		c->head[class] = cb->next;
+		c->cnt[class]--;
+		return cb;
 	}
 
-	/* Get a block from free list and return it. */
-	b = list_entry (list_pop_front (&d->free_list), struct block, free_elem);
-	a = block_to_arena (b);
-	a->free_cnt--;
+	lock_acquire (&d->lock);
+	b = desc_get (d);
 	lock_release (&d->lock);
 	return b;
 }
@@ -156,9 +277,10 @@ calloc (size_t a, size_t b) {
 		return NULL;
 
 	/* Allocate and zero memory. */
-	p = malloc (size);
+	p = malloc_block (size);
 	if (p != NULL)
 		memset (p, 0, size);
+	heapprof_alloc (HEAPPROF_MALLOC, p, size, __builtin_return_address (0));
 
 	return p;
 }
@@ -174,7 +296,8 @@ block_size (void *block) {
 }
 
 /* Attempts to resize OLD_BLOCK to NEW_SIZE bytes, possibly
-   moving it in the process.
+   moving it in the process.  OLD_BLOCK is kept in place if it
+   is already big enough.
    If successful, returns the new block; on failure, returns a
    null pointer.
    A call with null OLD_BLOCK is equivalent to malloc(NEW_SIZE).
@@ -184,8 +307,16 @@ realloc (void *old_block, size_t new_size) {
 	if (new_size == 0) {
 		free (old_block);
 		return NULL;
+	} else if (old_block != NULL && new_size <= block_size (old_block)) {
+		/* Profile the resize as a new allocation in place. */
+		heapprof_free (HEAPPROF_MALLOC, old_block);
+		heapprof_alloc (HEAPPROF_MALLOC, old_block, new_size,
+				__builtin_return_address (0));
+		return old_block;
 	} else {
-		void *new_block = malloc (new_size);
+		void *new_block = malloc_block (new_size);
+		heapprof_alloc (HEAPPROF_MALLOC, new_block, new_size,
+				__builtin_return_address (0));
 		if (old_block != NULL && new_block != NULL) {
 			size_t old_size = block_size (old_block);
 			size_t min_size = new_size < old_size ? new_size : old_size;
@@ -205,44 +336,322 @@ free (void *p) {
 		struct arena *a = block_to_arena (b);
 		struct desc *d = a->desc;
 
+		heapprof_free (HEAPPROF_MALLOC, p);
 		if (d != NULL) {
 			/* It's a normal block.  We handle it here. */
+			size_t class = d - descs;
+			struct malloc_cache *c = thread_current ()->malloc_cache;
 
 #ifndef NDEBUG
 			/* Clear the block to help detect use-after-free bugs. */
 			memset (b, 0xcc, d->block_size);
 #endif
 
-			lock_acquire (&d->lock);
-
-			/* Add block to free list. */
-			list_push_front (&d->free_list, &b->free_elem);
-
-			/* If the arena is now entirely unused, free it. */
-			if (++a->free_cnt >= d->blocks_per_arena) {
-				size_t i;
-
-				ASSERT (a->free_cnt == d->blocks_per_arena);
-				for (i = 0; i < d->blocks_per_arena; i++) {
-					struct block *b = arena_to_block (a, i);
-					list_remove (&b->free_elem);
-				}
-				palloc_free_page (a);
+			/* Put it in this thread's cache, if there is room after
+			   making some. */
+			if (class < CACHE_CLASSES && c != NULL) {
+				struct cached_block *cb = p;
+
+				if (c->cnt[class] >= d->cache_max)
+					cache_flush (c, class, d->cache_max / 2);
+				cb->next = c->head[class];
+				c->head[class] = cb;
+				c->cnt[class]++;
+				return;
 			}
 
+			lock_acquire (&d->lock);
+			desc_put (d, b);
 			lock_release (&d->lock);
 		} else {
 			/* It's a big block.  Free its pages. */
-			palloc_free_multiple (a, a->free_cnt);
+			big_count (a->free_cnt, false);
+			if (is_vmalloc_vaddr (a))
+				vfree (a);
+			else
+				palloc_free_multiple (a, a->free_cnt);
 			return;
 		}
 	}
 }
-
+
+/* Returns all the blocks in the running thread's cache to their
+   descriptors and frees the cache.  Called by thread_exit(). */
+void
+malloc_thread_exit (void) {
+	struct thread *t = thread_current ();
+	struct malloc_cache *c = t->malloc_cache;
+	size_t class;
+
+	if (c == NULL)
+		return;
+
+	for (class = 0; class < CACHE_CLASSES; class++)
+		cache_flush (c, class, c->cnt[class]);
+	t->malloc_cache = NULL;
+	free (c);
+}
+
+/* Prints, for each size class that has been used, the blocks
+   in use (counting those in threads' caches) and the arenas
+   allocated, now and at their peaks, then the same for big
+   blocks. */
+void
+malloc_print_stats (void) {
+	size_t i;
+	bool header = false;
+
+	for (i = 0; i < desc_cnt; i++) {
+		struct desc *d = &descs[i];
+		size_t used_cnt, peak_used_cnt, arena_cnt, peak_arena_cnt;
+		enum intr_level old_level;
+
+		/* Snapshot without D's lock, which the caller may hold. */
+		old_level = intr_disable ();
+		used_cnt = d->used_cnt;
+		peak_used_cnt = d->peak_used_cnt;
+		arena_cnt = d->arena_cnt;
+		peak_arena_cnt = d->peak_arena_cnt;
+		intr_set_level (old_level);
+
+		if (peak_arena_cnt == 0)
+			continue;
+		if (!header) {
+			printf ("Malloc: %6s %8s %8s %7s %7s %6s\n", "class", "used",
+					"peak", "arenas", "peak", "pages");
+			header = true;
+		}
+		printf ("Malloc: %6zu %8zu %8zu %7zu %7zu %6zu\n", d->block_size,
+				used_cnt, peak_used_cnt, arena_cnt, peak_arena_cnt,
+				arena_cnt * d->arena_pages);
+	}
+
+	if (header || peak_big_pages != 0)
+		printf ("Malloc: %zu big blocks in %zu pages, peak %zu pages\n",
+				big_cnt, big_pages, peak_big_pages);
+}
+
+/* Takes a block from D's free list, creating a new arena if the
+   list is empty.  D must be locked.  Returns a null pointer if
+   memory is not available. */
+static struct block *
+desc_get (struct desc *d) {
+	struct block *b;
+	struct arena *a;
+
+	ASSERT (lock_held_by_current_thread (&d->lock));
+
+	/* If the free list is empty, create a new arena. */
+	if (list_empty (&d->free_list)) {
+		size_t i;
+
+		/* Allocate an arena. */
+		a = palloc_get_multiple (0, d->arena_pages);
+		if (a == NULL)
+			return NULL;
+		palloc_set_owner (a, d->arena_pages, a);
+
+		/* Initialize arena and add its blocks to the free list. */
+		a->magic = ARENA_MAGIC;
+		a->desc = d;
+		a->free_cnt = d->blocks_per_arena;
+		for (i = 0; i < d->blocks_per_arena; i++) {
+			struct block *b = arena_to_block (a, i);
+			list_push_back (&d->free_list, &b->free_elem);
+		}
+		d->empty_cnt++;
+		if (++d->arena_cnt > d->peak_arena_cnt)
+			d->peak_arena_cnt = d->arena_cnt;
+	}
+
+	/* Get a block from free list and return it. */
+	b = list_entry (list_pop_front (&d->free_list), struct block, free_elem);
+	a = block_to_arena (b);
+	if (a->free_cnt-- == d->blocks_per_arena)
+		d->empty_cnt--;
+	if (++d->used_cnt > d->peak_used_cnt)
+		d->peak_used_cnt = d->used_cnt;
+	return b;
+}
+
+/* Adds block B to D's free list, and frees its arena if that
+   leaves the arena unused and D has another unused arena.  D must
+   be locked. */
+static void
+desc_put (struct desc *d, struct block *b) {
+	struct arena *a = block_to_arena (b);
+
+	ASSERT (lock_held_by_current_thread (&d->lock));
+
+	/* Add block to free list. */
+	list_push_front (&d->free_list, &b->free_elem);
+	d->used_cnt--;
+
+	/* If the arena is now entirely unused, free it, unless it is
+	   the only such arena. */
+	if (++a->free_cnt >= d->blocks_per_arena) {
+		ASSERT (a->free_cnt == d->blocks_per_arena);
+		if (d->empty_cnt == 0)
+			d->empty_cnt++;
+		else
+			free_arena (d, a);
+	}
+}
+
+/* Removes the blocks of A, an arena of D with no blocks in use,
+   from D's free list and frees A.  D must be locked. */
+static void
+free_arena (struct desc *d, struct arena *a) {
+	size_t i;
+
+	ASSERT (lock_held_by_current_thread (&d->lock));
+	ASSERT (a->free_cnt == d->blocks_per_arena);
+
+	for (i = 0; i < d->blocks_per_arena; i++) {
+		struct block *b = arena_to_block (a, i);
+		list_remove (&b->free_elem);
+	}
+	palloc_free_multiple (a, d->arena_pages);
+	d->arena_cnt--;
+}
+
+/* Returns the number of pages in the empty arenas that the
+   descriptors keep. */
+static size_t
+malloc_shrink_count (struct shrinker *s UNUSED) {
+	size_t cnt = 0, i;
+
+	for (i = 0; i < desc_cnt; i++)
+		cnt += descs[i].empty_cnt * descs[i].arena_pages;
+	return cnt;
+}
+
+/* Frees the empty arenas that the descriptors keep, until at
+   least PAGE_CNT pages are freed, skipping descriptors whose
+   locks are taken.  Blocks in threads' caches count as in use,
+   so arenas that only they keep busy are not freed. */
+static size_t
+malloc_shrink_scan (struct shrinker *s UNUSED, size_t page_cnt) {
+	size_t cnt = 0, i;
+
+	for (i = 0; i < desc_cnt && cnt < page_cnt; i++) {
+		struct desc *d = &descs[i];
+		struct list_elem *e;
+
+		if (d->empty_cnt == 0 || lock_held_by_current_thread (&d->lock)
+				|| !lock_try_acquire (&d->lock))
+			continue;
+
+		/* Find the empty arena through its free blocks. */
+		for (e = list_begin (&d->free_list); d->empty_cnt > 0
+				&& e != list_end (&d->free_list); e = list_next (e)) {
+			struct arena *a = block_to_arena (list_entry (e, struct block,
+						free_elem));
+			if (a->free_cnt == d->blocks_per_arena) {
+				free_arena (d, a);
+				d->empty_cnt--;
+				cnt += d->arena_pages;
+				break;
+			}
+		}
+		lock_release (&d->lock);
+	}
+	return cnt;
+}
+
+static struct shrinker malloc_shrinker = {
+	.count = malloc_shrink_count,
+	.scan = malloc_shrink_scan,
+	.name = "malloc",
+};
+
+/* Returns the running thread's block cache, creating it if
+   necessary.  Returns a null pointer if memory is not
+   available. */
+static struct malloc_cache *
+get_cache (void) {
+	struct thread *t = thread_current ();
+
+	if (t->malloc_cache == NULL) {
+		/* Allocate the cache from its descriptor directly, since
+		   malloc() would come back here. */
+		struct desc *d = &descs[size_class[DIV_ROUND_UP (
+				sizeof (struct malloc_cache), 16)]];
+		struct malloc_cache *c;
+
+		lock_acquire (&d->lock);
+		c = (struct malloc_cache *) desc_get (d);
+		lock_release (&d->lock);
+		if (c != NULL)
+			memset (c, 0, sizeof *c);
+		t->malloc_cache = c;
+	}
+	return t->malloc_cache;
+}
+
+/* Moves half of CLASS's cache capacity worth of blocks from its
+   descriptor into cache C, taking the descriptor's lock once.
+   Moves fewer if memory runs out. */
+static void
+cache_refill (struct malloc_cache *c, size_t class) {
+	struct desc *d = &descs[class];
+	size_t i;
+
+	lock_acquire (&d->lock);
+	for (i = 0; i < d->cache_max / 2; i++) {
+		struct cached_block *cb = (struct cached_block *) desc_get (d);
+		if (cb == NULL)
+			break;
+		cb->next = c->head[class];
+		c->head[class] = cb;
+		c->cnt[class]++;
+	}
+	lock_release (&d->lock);
+}
+
+/* Moves CNT blocks of CLASS from cache C back to their
+   descriptor, taking the descriptor's lock once. */
+static void
+cache_flush (struct malloc_cache *c, size_t class, size_t cnt) {
+	struct desc *d = &descs[class];
+
+	ASSERT (cnt <= c->cnt[class]);
+	if (cnt == 0)
+		return;
+
+	lock_acquire (&d->lock);
+	while (cnt-- > 0) {
+		struct cached_block *cb = c->head[class];
+		c->head[class] = cb->next;
+		c->cnt[class]--;
+		desc_put (d, (struct block *) cb);
+	}
+	lock_release (&d->lock);
+}
+
+/* Accounts for a big block of PAGE_CNT pages being allocated,
+   if ALLOC is true, or freed. */
+static void
+big_count (size_t page_cnt, bool alloc) {
+	enum intr_level old_level = intr_disable ();
+
+	if (alloc) {
+		big_cnt++;
+		big_pages += page_cnt;
+		if (big_pages > peak_big_pages)
+			peak_big_pages = big_pages;
+	} else {
+		big_cnt--;
+		big_pages -= page_cnt;
+	}
+	intr_set_level (old_level);
+}
+
 /* Returns the arena that block B is inside. */
 static struct arena *
 block_to_arena (struct block *b) {
-	struct arena *a = pg_round_down (b);
+	struct arena *a = (is_vmalloc_vaddr (b) ? pg_round_down (b)
+			: palloc_get_owner (b));
 
 	/* Check that the arena is valid. */
 	ASSERT (a != NULL);
@@ -250,8 +659,8 @@ block_to_arena (struct block *b) {
 
 	/* Check that the block is properly aligned for the arena. */
 	ASSERT (a->desc == NULL
-			|| (pg_ofs (b) - sizeof *a) % a->desc->block_size == 0);
-	ASSERT (a->desc != NULL || pg_ofs (b) == sizeof *a);
+			|| ((uint8_t *) b - (uint8_t *) (a + 1)) % a->desc->block_size == 0);
+	ASSERT (a->desc != NULL || (struct arena *) b == a + 1);
 
 	return a;
 }
@@ -266,3 +675,31 @@ arena_to_block (struct arena *a, size_t idx) {
 			+ sizeof *a
 			+ idx * a->desc->block_size);
 }
+
+/* Returns the number of pages in an arena for blocks of
+   BLOCK_SIZE bytes: the fewest pages that leave at most a
+   quarter of the arena unused, or failing that, the number that
+   leaves the smallest fraction unused.  Bigger arenas would
+   waste less space at the end but more in partially used
+   arenas. */
+static size_t
+arena_pages_for (size_t block_size) {
+	size_t pages, best = 0, best_waste = 0;
+
+	for (pages = 1; pages <= MAX_ARENA_PAGES; pages++) {
+		size_t space = pages * PGSIZE - sizeof (struct arena);
+		size_t waste;
+
+		if (space < block_size)
+			continue;
+		waste = space % block_size + sizeof (struct arena);
+		if (waste * 4 <= pages * PGSIZE)
+			return pages;
+		if (best == 0 || waste * best < best_waste * pages) {
+			best = pages;
+			best_waste = waste;
+		}
+	}
+	ASSERT (best != 0);
+	return best;
+}
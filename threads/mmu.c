@@ -5,19 +5,80 @@
 #include "threads/pte.h"
 #include "threads/palloc.h"
 #include "threads/mmu.h"
+#include "threads/interrupt.h"
 #include "intrinsic.h"
 
+/* Process-context identifiers (PCIDs).
+
+   With CR4.PCIDE set, the CPU tags each TLB entry with the PCID
+   that was in the low 12 bits of CR3 when the entry was created,
+   and a CR3 load with bit 63 set keeps the entries of all PCIDs.
+   Switching between address spaces then no longer flushes the
+   TLB.
+
+   base_pml4 always uses PCID 0.  Other pml4s get a PCID the
+   first time they are activated, from a counter that runs from 1
+   to PCID_MAX.  When the counter runs out, the generation number
+   is bumped, the whole TLB is flushed, and numbering starts over;
+   a pml4 whose recorded generation is old then gets a new PCID
+   on its next activation.  Dropping a pml4's PCID the same way is
+   also how changes to a pml4 that is not active are made
+   visible, since invlpg only affects the current PCID.
+
+   Each pml4 records its PCID and generation in entry PML4_META,
+   which is never used to map memory.  The entry's present bit is
+   always clear, so the CPU ignores the rest of it. */
+
+#define CR4_PGE (1 << 7)            /* Global pages enabled. */
+#define CR4_PCIDE (1 << 17)         /* PCIDs enabled. */
+#define CPUID_1_ECX_PCID (1 << 17)  /* CPU supports PCIDs. */
+#define CR3_NOFLUSH (1ULL << 63)    /* Keep TLB entries on CR3 load. */
+
+#define PCID_MAX 4095               /* Largest PCID. */
+#define PML4_META 511               /* PML4 entry with PCID info. */
+
+/* Encoding of the PML4_META entry.  Bit 0, PTE_P, stays clear. */
+#define META_PCID(META) (((META) >> 1) & PCID_MAX)
+#define META_GEN(META) ((META) >> 13)
+#define MAKE_META(PCID, GEN) (((uint64_t) (GEN) << 13) | ((PCID) << 1))
+
+static bool pcid_enabled;           /* Is CR4.PCIDE set? */
+static uint64_t pcid_gen = 1;       /* Current generation. */
+static uint64_t next_pcid = 1;      /* Next PCID to hand out. */
+
+static void tlb_invalidate (uint64_t *pml4, const void *va);
+
+/* Pending TLB invalidations and page-table pages to free, for
+   operations on a range of pages.  Invalidating more than
+   BATCH_VA_MAX pages one by one would cost more than flushing the
+   whole TLB. */
+#define BATCH_VA_MAX 32
+#define BATCH_TABLE_MAX 16
+
+struct tlb_batch {
+	uint64_t *pml4;                     /* Page map being changed. */
+	size_t va_cnt;                      /* Pages to invalidate. */
+	uint64_t va[BATCH_VA_MAX];          /* First BATCH_VA_MAX of them. */
+	size_t table_cnt;                   /* Page-table pages to free. */
+	void *tables[BATCH_TABLE_MAX];      /* The pages. */
+};
+
+static void batch_flush (struct tlb_batch *);
+
 static uint64_t *
 pgdir_walk (uint64_t *pdp, const uint64_t va, int create) {
 	int idx = PDX (va);
 	if (pdp) {
 		uint64_t *pte = (uint64_t *) pdp[idx];
+		/* A large page has no page table. */
+		if ((uint64_t) pte & PTE_PS)
+			return NULL;
 		if (!((uint64_t) pte & PTE_P)) {
 			if (create) {
-				uint64_t *new_page = palloc_get_page (PAL_ASSERT | PAL_ZERO);
-				if (new_page) {
-					pdp[idx] = vtop (new_page) | PTE_U | PTE_W | PTE_P;
-				}
+				uint64_t *new_page = palloc_get_page (PAL_ZERO);
+				if (new_page == NULL)
+					return NULL;
+				pdp[idx] = vtop (new_page) | PTE_U | PTE_W | PTE_P;
 			} else
 				return NULL;
 		}
@@ -35,18 +96,18 @@ pdpe_walk (uint64_t *pdpe, const uint64_t va, int create) {
 		uint64_t *pde = (uint64_t *) pdpe[idx];
 		if (!((uint64_t) pde & PTE_P)) {
 			if (create) {
-				uint64_t *new_page = palloc_get_page (PAL_ASSERT | PAL_ZERO);
-				if (new_page) {
-					pdpe[idx] = vtop (new_page) | PTE_U | PTE_W | PTE_P;
-					allocated = 1;
-				}
+				uint64_t *new_page = palloc_get_page (PAL_ZERO);
+				if (new_page == NULL)
+					return NULL;
+				pdpe[idx] = vtop (new_page) | PTE_U | PTE_W | PTE_P;
+				allocated = 1;
 			} else
 				return NULL;
 		}
 		pte = pgdir_walk (ptov (PTE_ADDR (pdpe[idx])), va, create);
 	}
 	if (pte == NULL && allocated) {
-		palloc_free_page ((void *) PTE_ADDR (pdpe[idx]));
+		palloc_free_page (ptov (PTE_ADDR (pdpe[idx])));
 		pdpe[idx] = 0;
 	}
 	return pte;
@@ -56,8 +117,10 @@ pdpe_walk (uint64_t *pdpe, const uint64_t va, int create) {
  * address VADDR in page map level 4, pml4.
  * If PML4E does not have a page table for VADDR, behavior depends
  * on CREATE.  If CREATE is true, then a new page table is
- * created and a pointer into it is returned.  Otherwise, a null
- * pointer is returned. */
+ * created and a pointer into it is returned, or a null pointer
+ * if memory allocation fails, in which case no table is left
+ * half built.  Otherwise, a null pointer is returned.  VADDR
+ * must not lie in a large page. */
 uint64_t *
 pml4e_walk (uint64_t *pml4e, const uint64_t va, int create) {
 	uint64_t *pte = NULL;
@@ -67,23 +130,53 @@ pml4e_walk (uint64_t *pml4e, const uint64_t va, int create) {
 		uint64_t *pdpe = (uint64_t *) pml4e[idx];
 		if (!((uint64_t) pdpe & PTE_P)) {
 			if (create) {
-				uint64_t *new_page = palloc_get_page (PAL_ASSERT | PAL_ZERO);
-				if (new_page) {
-					pml4e[idx] = vtop (new_page) | PTE_U | PTE_W | PTE_P;
-					allocated = 1;
-				}
+				uint64_t *new_page = palloc_get_page (PAL_ZERO);
+				if (new_page == NULL)
+					return NULL;
+				pml4e[idx] = vtop (new_page) | PTE_U | PTE_W | PTE_P;
+				allocated = 1;
 			} else
 				return NULL;
 		}
 		pte = pdpe_walk (ptov (PTE_ADDR (pml4e[idx])), va, create);
 	}
 	if (pte == NULL && allocated) {
-		palloc_free_page ((void *) PTE_ADDR (pml4e[idx]));
+		palloc_free_page (ptov (PTE_ADDR (pml4e[idx])));
 		pml4e[idx] = 0;
 	}
 	return pte;
 }
 
+/* Returns the address of the page directory entry for the
+ * LARGE_PGSIZE-aligned virtual address VA in PML4, creating the
+ * page directory and the table above it if needed.  Storing
+ * PTE_PS along with a physical address in the entry maps a large
+ * page.  Returns a null pointer if memory allocation fails. */
+uint64_t *
+pml4e_walk_large (uint64_t *pml4, const uint64_t va) {
+	uint64_t *pdpe, *pde;
+
+	ASSERT (va % LARGE_PGSIZE == 0);
+
+	if (!(pml4[PML4 (va)] & PTE_P)) {
+		uint64_t *new_page = palloc_get_page (PAL_ZERO);
+		if (new_page == NULL)
+			return NULL;
+		pml4[PML4 (va)] = vtop (new_page) | PTE_U | PTE_W | PTE_P;
+	}
+	pdpe = ptov (PTE_ADDR (pml4[PML4 (va)]));
+
+	if (!(pdpe[PDPE (va)] & PTE_P)) {
+		uint64_t *new_page = palloc_get_page (PAL_ZERO);
+		if (new_page == NULL)
+			return NULL;
+		pdpe[PDPE (va)] = vtop (new_page) | PTE_U | PTE_W | PTE_P;
+	}
+	pde = ptov (PTE_ADDR (pdpe[PDPE (va)]));
+
+	return &pde[PDX (va)];
+}
+
 /* Creates a new page map level 4 (pml4) has mappings for kernel
  * virtual addresses, but none for user virtual addresses.
  * Returns the new page directory, or a null pointer if memory
@@ -91,8 +184,10 @@ pml4e_walk (uint64_t *pml4e, const uint64_t va, int create) {
 uint64_t *
 pml4_create (void) {
 	uint64_t *pml4 = palloc_get_page (0);
-	if (pml4)
+	if (pml4) {
 		memcpy (pml4, base_pml4, PGSIZE);
+		pml4[PML4_META] = 0;
+	}
 	return pml4;
 }
 
@@ -100,7 +195,8 @@ static void
 pgdir_for_each (uint64_t *pdp, pte_for_each_func *func, void *aux) {
 	for (unsigned i = 0; i < PGSIZE / sizeof(uint64_t *); i++) {
 		uint64_t *pte = ptov((uint64_t *) pdp[i]);
-		if (((uint64_t) pte) & PTE_P)
+		/* Large pages of the kernel's direct map have no PTEs. */
+		if ((((uint64_t) pte) & PTE_P) && !(((uint64_t) pte) & PTE_PS))
 			func (pte, aux);
 	}
 }
@@ -157,11 +253,81 @@ pml4_destroy (uint64_t *pml4) {
 	palloc_free_page ((void *) pml4);
 }
 
+/* Turns on PCIDs if the CPU supports them.  Must be called while
+ * the current PCID is 0, before the first pml4_activate(). */
+void
+pcid_init (void) {
+	uint32_t a, b, c, d;
+
+	cpuid (1, &a, &b, &c, &d);
+	if (c & CPUID_1_ECX_PCID) {
+		ASSERT ((rcr3 () & PCID_MAX) == 0);
+		lcr4 (rcr4 () | CR4_PCIDE);
+		pcid_enabled = true;
+	}
+}
+
+/* Flushes the TLB entries of every PCID.  Toggling CR4.PGE does
+ * that, global pages included. */
+static void
+flush_all_pcids (void) {
+	uint64_t cr4 = rcr4 ();
+
+	lcr4 (cr4 ^ CR4_PGE);
+	lcr4 (cr4);
+}
+
 /* Loads page directory PD into the CPU's page directory base
- * register. */
+ * register.  With PCIDs, TLB entries of PD from its previous
+ * activation survive, as do those of other address spaces. */
 void
 pml4_activate (uint64_t *pml4) {
-	lcr3 (vtop (pml4 ? pml4 : base_pml4));
+	enum intr_level old_level;
+	uint64_t meta, pcid;
+
+	if (pml4 == NULL)
+		pml4 = base_pml4;
+	if (!pcid_enabled) {
+		lcr3 (vtop (pml4));
+		return;
+	}
+	if (pml4 == base_pml4) {
+		lcr3 (vtop (pml4) | CR3_NOFLUSH);
+		return;
+	}
+
+	old_level = intr_disable ();
+	meta = pml4[PML4_META];
+	if (META_GEN (meta) == pcid_gen) {
+		/* Still owns its PCID: keep the TLB. */
+		lcr3 (vtop (pml4) | META_PCID (meta) | CR3_NOFLUSH);
+	} else {
+		/* Needs a new PCID.  Start a new generation if they have all
+		 * been handed out. */
+		if (next_pcid > PCID_MAX) {
+			pcid_gen++;
+			next_pcid = 1;
+			flush_all_pcids ();
+		}
+		pcid = next_pcid++;
+		pml4[PML4_META] = MAKE_META (pcid, pcid_gen);
+
+		/* Flush whatever a previous owner of PCID left behind. */
+		lcr3 (vtop (pml4) | pcid);
+	}
+	intr_set_level (old_level);
+}
+
+/* Makes a change to the mapping of VA in PML4 visible to the
+ * TLB.  If PML4 is not active and has a PCID, its cached
+ * translations may be stale, so it gives up its PCID, and its
+ * next activation flushes them. */
+static void
+tlb_invalidate (uint64_t *pml4, const void *va) {
+	if (PTE_ADDR (rcr3 ()) == vtop (pml4))
+		invlpg ((uint64_t) va);
+	else if (pcid_enabled)
+		pml4[PML4_META] = 0;
 }
 
 /* Looks up the physical address that corresponds to user virtual
@@ -179,6 +345,201 @@ pml4_get_page (uint64_t *pml4, const void *uaddr) {
 	return NULL;
 }
 
+/* Adds VA to the pages B must invalidate. */
+static void
+batch_add (struct tlb_batch *b, uint64_t va) {
+	if (b->va_cnt < BATCH_VA_MAX)
+		b->va[b->va_cnt] = va;
+	b->va_cnt++;
+}
+
+/* Adds page-table page TABLE, which mapped VA and has just been
+ * unlinked, to the pages B frees once the TLB no longer caches
+ * it. */
+static void
+batch_free_table (struct tlb_batch *b, void *table, uint64_t va) {
+	if (b->table_cnt == BATCH_TABLE_MAX)
+		batch_flush (b);
+	b->tables[b->table_cnt++] = table;
+	batch_add (b, va);
+}
+
+/* Carries out B's invalidations, by invlpg if there are few of
+ * them and by flushing the TLB otherwise, then frees its
+ * page-table pages.  invlpg also drops the CPU's cached
+ * page-table entries, so a freed table cannot be used after. */
+static void
+batch_flush (struct tlb_batch *b) {
+	size_t i;
+
+	if (b->va_cnt > 0) {
+		if (PTE_ADDR (rcr3 ()) != vtop (b->pml4)) {
+			/* Not active: the next activation flushes instead. */
+			if (pcid_enabled)
+				b->pml4[PML4_META] = 0;
+		} else if (b->va_cnt > BATCH_VA_MAX)
+			lcr3 (rcr3 ());
+		else
+			for (i = 0; i < b->va_cnt; i++)
+				invlpg (b->va[i]);
+		b->va_cnt = 0;
+	}
+
+	for (i = 0; i < b->table_cnt; i++)
+		palloc_free_page (b->tables[i]);
+	b->table_cnt = 0;
+}
+
+/* Returns true if page-table page TABLE has no entries. */
+static bool
+table_empty (const uint64_t *table) {
+	size_t i;
+
+	for (i = 0; i < PGSIZE / sizeof *table; i++)
+		if (table[i] != 0)
+			return false;
+	return true;
+}
+
+/* Frees the page table that maps user address VA in PML4 if it
+ * has no entries left, then the page directory above it if that
+ * is now empty, and so on up to, but not including, PML4. */
+static void
+reclaim_tables (uint64_t *pml4, uint64_t va, struct tlb_batch *b) {
+	uint64_t *pml4e = &pml4[PML4 (va)];
+	uint64_t *pdpt = ptov (PTE_ADDR (*pml4e));
+	uint64_t *pdpe = &pdpt[PDPE (va)];
+	uint64_t *pd = ptov (PTE_ADDR (*pdpe));
+	uint64_t *pde = &pd[PDX (va)];
+	uint64_t *pt = ptov (PTE_ADDR (*pde));
+
+	if (!table_empty (pt))
+		return;
+	*pde = 0;
+	batch_free_table (b, pt, va);
+	if (!table_empty (pd))
+		return;
+	*pdpe = 0;
+	batch_free_table (b, pd, va);
+	if (!table_empty (pdpt))
+		return;
+	*pml4e = 0;
+	batch_free_table (b, pdpt, va);
+}
+
+/* Returns the end of the page table that maps VA, or END if that
+ * comes first. */
+static uint64_t
+table_end (uint64_t va, uint64_t end) {
+	uint64_t next = (va & ~(LARGE_PGSIZE - 1)) + LARGE_PGSIZE;
+	return next < end ? next : end;
+}
+
+/* Maps the PAGE_CNT user virtual pages starting at UPAGE in PML4
+ * to the contiguous kernel pages starting at KPAGE, read/write if
+ * WRITABLE is true and read-only otherwise, replacing any
+ * existing mappings.  Walks down to each page table only once and
+ * invalidates replaced mappings together at the end.
+ * Returns true if successful.  If memory allocation fails,
+ * returns false with none of the range mapped. */
+bool
+pml4_map_range (uint64_t *pml4, void *upage, void *kpage, size_t page_cnt,
+		bool writable) {
+	struct tlb_batch b = { .pml4 = pml4 };
+	uint64_t va = (uint64_t) upage;
+	uint64_t end = va + page_cnt * PGSIZE;
+	uint64_t pa = vtop (kpage);
+
+	ASSERT (pg_ofs (upage) == 0);
+	ASSERT (pg_ofs (kpage) == 0);
+	ASSERT (page_cnt == 0 || is_user_vaddr (end - 1));
+	ASSERT (pml4 != base_pml4);
+
+	while (va < end) {
+		uint64_t *pte = pml4e_walk (pml4, va, 1);
+		uint64_t next = table_end (va, end);
+
+		if (pte == NULL) {
+			batch_flush (&b);
+			pml4_unmap_range (pml4, upage, (va - (uint64_t) upage) / PGSIZE);
+			return false;
+		}
+		for (; va < next; va += PGSIZE, pa += PGSIZE, pte++) {
+			if (*pte & PTE_P)
+				batch_add (&b, va);
+			*pte = pa | PTE_P | PTE_U | (writable ? PTE_W : 0);
+		}
+	}
+	batch_flush (&b);
+	return true;
+}
+
+/* Removes the mappings of the PAGE_CNT user virtual pages
+ * starting at UPAGE from PML4, and frees the page tables that
+ * this leaves empty.  The pages that were mapped are not freed.
+ * Pages in the range need not be mapped. */
+void
+pml4_unmap_range (uint64_t *pml4, void *upage, size_t page_cnt) {
+	struct tlb_batch b = { .pml4 = pml4 };
+	uint64_t va = (uint64_t) upage;
+	uint64_t end = va + page_cnt * PGSIZE;
+
+	ASSERT (pg_ofs (upage) == 0);
+	ASSERT (page_cnt == 0 || is_user_vaddr (end - 1));
+	ASSERT (pml4 != base_pml4);
+
+	while (va < end) {
+		uint64_t *pte = pml4e_walk (pml4, va, 0);
+		uint64_t next = table_end (va, end);
+
+		if (pte != NULL) {
+			uint64_t first = va;
+
+			for (; va < next; va += PGSIZE, pte++) {
+				if (*pte & PTE_P)
+					batch_add (&b, va);
+				*pte = 0;
+			}
+			reclaim_tables (pml4, first, &b);
+		}
+		va = next;
+	}
+	batch_flush (&b);
+}
+
+/* Makes the mapped pages among the PAGE_CNT user virtual pages
+ * starting at UPAGE in PML4 read/write if WRITABLE is true, and
+ * read-only otherwise. */
+void
+pml4_protect_range (uint64_t *pml4, void *upage, size_t page_cnt,
+		bool writable) {
+	struct tlb_batch b = { .pml4 = pml4 };
+	uint64_t va = (uint64_t) upage;
+	uint64_t end = va + page_cnt * PGSIZE;
+
+	ASSERT (pg_ofs (upage) == 0);
+	ASSERT (page_cnt == 0 || is_user_vaddr (end - 1));
+	ASSERT (pml4 != base_pml4);
+
+	while (va < end) {
+		uint64_t *pte = pml4e_walk (pml4, va, 0);
+		uint64_t next = table_end (va, end);
+
+		if (pte != NULL)
+			for (; va < next; va += PGSIZE, pte++) {
+				uint64_t old = *pte;
+
+				if (!(old & PTE_P))
+					continue;
+				*pte = writable ? old | PTE_W : old & ~(uint64_t) PTE_W;
+				if (*pte != old)
+					batch_add (&b, va);
+			}
+		va = next;
+	}
+	batch_flush (&b);
+}
+
 /* Adds a mapping in page map level 4 PML4 from user virtual page
  * UPAGE to the physical frame identified by kernel virtual address KPAGE.
  * UPAGE must not already be mapped. KPAGE should probably be a page obtained
@@ -215,9 +576,92 @@ pml4_clear_page (uint64_t *pml4, void *upage) {
 
 	if (pte != NULL && (*pte & PTE_P) != 0) {
 		*pte &= ~PTE_P;
-		if (rcr3 () == vtop (pml4))
-			invlpg ((uint64_t) upage);
+		tlb_invalidate (pml4, upage);
+	}
+}
+
+/* Maps kernel virtual page KVA, read/write, to the frame at
+ * kernel virtual address KPAGE.  KVA's page directory must
+ * already exist in base_pml4, and so be shared by every pml4;
+ * this allocates the page table below it if needed.  Returns
+ * true if successful, false if memory allocation failed.  KVA
+ * must not be mapped, and must have been flushed from the TLB
+ * since it was last unmapped.  May be called concurrently for
+ * pages that share a page table. */
+bool
+kernel_map_page (void *kva, void *kpage) {
+	uint64_t va = (uint64_t) kva;
+	uint64_t *pdpt, *pd, *pte, *pt = NULL;
+	enum intr_level old_level;
+
+	ASSERT (pg_ofs (kva) == 0);
+	ASSERT (pg_ofs (kpage) == 0);
+	ASSERT (is_kernel_vaddr (kva));
+
+	old_level = intr_disable ();
+	pte = pml4e_walk (base_pml4, va, 0);
+	if (pte == NULL) {
+		/* Allocating may sleep, so another thread may install the
+		 * page table first; then ours is freed unused. */
+		intr_set_level (old_level);
+		pt = palloc_get_page (PAL_ZERO);
+		if (pt == NULL)
+			return false;
+		old_level = intr_disable ();
+
+		ASSERT (base_pml4[PML4 (va)] & PTE_P);
+		pdpt = ptov (PTE_ADDR (base_pml4[PML4 (va)]));
+		ASSERT (pdpt[PDPE (va)] & PTE_P);
+		pd = ptov (PTE_ADDR (pdpt[PDPE (va)]));
+		if (pd[PDX (va)] == 0) {
+			pd[PDX (va)] = vtop (pt) | PTE_W | PTE_P;
+			pt = NULL;
+		}
+		pte = pml4e_walk (base_pml4, va, 0);
 	}
+	ASSERT (!(*pte & PTE_P));
+	*pte = vtop (kpage) | PTE_P | PTE_W;
+	intr_set_level (old_level);
+
+	palloc_free_page (pt);
+	return true;
+}
+
+/* Removes the mapping of kernel virtual page KVA, added by
+ * kernel_map_page(), and returns the kernel virtual address of
+ * the frame it mapped, or a null pointer if it was not mapped.
+ * The TLB may still cache the mapping until kernel_tlb_flush()
+ * is called. */
+void *
+kernel_clear_page (void *kva) {
+	uint64_t *pte = pml4e_walk (base_pml4, (uint64_t) kva, 0);
+	void *kpage;
+
+	ASSERT (is_kernel_vaddr (kva));
+	if (pte == NULL || !(*pte & PTE_P))
+		return NULL;
+	kpage = ptov (PTE_ADDR (*pte));
+	*pte = 0;
+	return kpage;
+}
+
+/* Flushes the TLB entries for the PAGE_CNT kernel virtual pages
+ * starting at KVA, after kernel_clear_page().  Kernel mappings
+ * are shared by every pml4 but are not global, so with PCIDs
+ * every address space may have cached them, and all PCIDs are
+ * flushed.  Without PCIDs, only the current CR3's entries can be
+ * stale. */
+void
+kernel_tlb_flush (void *kva, size_t page_cnt) {
+	size_t i;
+
+	if (pcid_enabled)
+		flush_all_pcids ();
+	else if (page_cnt > BATCH_VA_MAX)
+		lcr3 (rcr3 ());
+	else
+		for (i = 0; i < page_cnt; i++)
+			invlpg ((uint64_t) kva + i * PGSIZE);
 }
 
 /* Returns true if the PTE for virtual page VPAGE in PML4 is dirty,
@@ -241,8 +685,7 @@ pml4_set_dirty (uint64_t *pml4, const void *vpage, bool dirty) {
 		else
 			*pte &= ~(uint32_t) PTE_D;
 
-		if (rcr3 () == vtop (pml4))
-			invlpg ((uint64_t) vpage);
+		tlb_invalidate (pml4, vpage);
 	}
 }
 
@@ -267,7 +710,6 @@ pml4_set_accessed (uint64_t *pml4, const void *vpage, bool accessed) {
 		else
 			*pte &= ~(uint32_t) PTE_A;
 
-		if (rcr3 () == vtop (pml4))
-			invlpg ((uint64_t) vpage);
+		tlb_invalidate (pml4, vpage);
 	}
 }
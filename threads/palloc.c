@@ -2,12 +2,16 @@
 #include <bitmap.h>
 #include <debug.h>
 #include <inttypes.h>
+#include <list.h>
 #include <round.h>
 #include <stddef.h>
 #include <stdint.h>
 #include <stdio.h>
 #include <string.h>
+#include "threads/heapprof.h"
 #include "threads/init.h"
+#include "threads/interrupt.h"
+#include "threads/shrinker.h"
 #include "threads/loader.h"
 #include "threads/synch.h"
 #include "threads/vaddr.h"
@@ -23,25 +27,148 @@
    even if user processes are swapping like mad.
 
    By default, half of system RAM is given to the kernel pool and
-   half to the user pool.  That should be huge overkill for the
-   kernel pool, but that's just fine for demonstration purposes. */
+   half to the user pool.  The split is not fixed, though: when
+   one pool runs out, a request may borrow pages from the other,
+   as long as that leaves the lender more than its reserve of
+   RESERVE_DIV'th of its pages free.  So kernel caches can grow
+   into memory that user processes leave idle, and vice versa,
+   while each side keeps a floor that the other cannot take.
+   Borrowed pages are marked PAGE_LOAN and return to their own
+   pool when freed.  User requests do not borrow when
+   user_page_limit has been set, since then the user pool's size
+   is meant to be a hard limit.
+
+   A multi-page request that finds no free run long enough
+   compacts its pool: it picks the window of pages that holds
+   only free and movable pages, and the fewest movable ones,
+   moves those elsewhere through their owners' migrate callbacks,
+   and hands out the window.
+
+   If neither pool can satisfy a request, the registered
+   shrinkers (see shrinker.h) are asked to give back memory, and
+   the request is retried while they make progress.
+
+   Within a pool, free pages are managed by a binary buddy
+   allocator.  Free memory is kept as blocks of 2**ORDER pages,
+   aligned (relative to the pool base) to their own size, on one
+   free list per order.  A request for N pages takes a block of
+   the smallest sufficient order, splitting larger blocks as
+   needed, and immediately gives back the pages beyond N.
+   Freeing a range splits it into aligned blocks and merges each
+   with its buddy for as long as the buddy is free, so both
+   operations take O(log n) time.  The bookkeeping lives in the
+   `struct page' of each page, outside the pages themselves, so
+   free pages are never written.  USED_MAP still records which
+   pages are in use, for sanity checks.
+
+   There is one `struct page' for every frame from the start of
+   the kernel pool to the end of the user pool, in a single array
+   indexed by frame number, so that kva_to_page() and
+   page_to_kva() are simple arithmetic.  A free page's LRU element
+   links it into a buddy free list, if it heads a free block; an
+   allocated page's belongs to whoever allocated it.
+
+   Most requests are for a single page, so each pool also keeps
+   a small "magazine" of free pages in front of the buddy
+   allocator.  palloc_get_page() and palloc_free_page() pop and
+   push magazine entries with interrupts briefly disabled, which
+   is enough on a uniprocessor and never sleeps.  Only when the
+   magazine runs empty or full is the pool lock taken, to move
+   MAG_BATCH pages at once between the magazine and the buddy
+   free lists.  Pages in a magazine stay marked in USED_MAP.  If
+   a multi-page request fails, the magazine is drained back into
+   the buddy allocator, so that its pages can coalesce, and the
+   request is retried.
+
+   Finally, each pool keeps a stack of up to ZERO_MAX free pages
+   that are already filled with zeros.  The idle thread fills it
+   by taking free pages and clearing them, through
+   palloc_zero_idle(), so a single-page PAL_ZERO request usually
+   skips the memset().  Like the magazine, the stack is protected
+   by disabling interrupts, and its pages are handed out for
+   ordinary requests and drained for multi-page ones when the
+   pool would otherwise run out. */
+
+/* Largest block handed out or merged: 2**MAX_ORDER pages. */
+#define MAX_ORDER 20
+
+/* Single-page magazine: capacity, and pages moved per refill
+   or drain. */
+#define MAG_SIZE 64
+#define MAG_BATCH 16
+
+/* A pool lends pages to the other pool only while it has more
+   than 1/RESERVE_DIV of its pages free. */
+#define RESERVE_DIV 16
+
+/* Pages to ask the shrinkers for at a time, at least. */
+#define SHRINK_BATCH 32
+
+/* Most pre-zeroed pages kept per pool, and most cleared per pool
+   each time the idle thread runs. */
+#define ZERO_MAX 64
+#define ZERO_BATCH 8
 
 /* A memory pool. */
 struct pool {
+	const char *name;               /* Pool name, for statistics. */
 	struct lock lock;               /* Mutual exclusion. */
 	struct bitmap *used_map;        /* Bitmap of free pages. */
 	uint8_t *base;                  /* Base of pool. */
+	struct page *pages;             /* One per page, in PAGE_ARRAY. */
+	size_t free_cnt;                /* Pages on FREE_LISTS. */
+	struct list free_lists[MAX_ORDER + 1];  /* Free blocks by order. */
+
+	/* Protected by disabling interrupts, not by LOCK. */
+	void *mag[MAG_SIZE];            /* Free single pages. */
+	size_t mag_cnt;                 /* Number of pages in MAG. */
+	void *zeroed[ZERO_MAX];         /* Free pages filled with zeros. */
+	size_t zeroed_cnt;              /* Number of pages in ZEROED. */
+	size_t lent_cnt;                /* Pages lent to the other pool. */
+
+	/* Compaction statistics, protected by LOCK. */
+	size_t compact_cnt;             /* Compactions attempted. */
+	size_t compact_ok_cnt;          /* Compactions that succeeded. */
+	size_t migrate_cnt;             /* Pages migrated. */
+	size_t run_before;              /* Largest free run before and */
+	size_t run_after;               /* after the last compaction. */
 };
 
 /* Two pools: one for kernel data, one for user pages. */
 static struct pool kernel_pool, user_pool;
 
+/* Page descriptors, for frames PAGE_BASE_NO through
+   PAGE_BASE_NO + PAGE_ARRAY_CNT - 1. */
+static struct page *page_array;
+static size_t page_base_no;
+static size_t page_array_cnt;
+
 /* Maximum number of pages to put in user pool. */
 size_t user_page_limit = SIZE_MAX;
-static void
-init_pool (struct pool *p, void **bm_base, uint64_t start, uint64_t end);
+static void init_pool (struct pool *p, void **bm_base, uint64_t start,
+		uint64_t end, const char *name);
+static void init_page_array (void **base);
 
-static bool page_from_pool (const struct pool *, void *page);
+static bool page_from_pool (const struct pool *, const void *page);
+static struct pool *pool_of (const void *page);
+static size_t buddy_alloc (struct pool *, size_t page_cnt);
+static void buddy_free (struct pool *, size_t page_idx, size_t page_cnt);
+static void *mag_get (struct pool *);
+static void mag_put (struct pool *, void *page);
+static void mag_drain (struct pool *, size_t page_cnt);
+static void *zeroed_get (struct pool *);
+static void zeroed_drain (struct pool *);
+static void zero_pages (struct pool *);
+static void print_pool_stats (struct pool *);
+static void *get_pages (enum palloc_flags, size_t page_cnt);
+static void *try_get_pages (enum palloc_flags, size_t page_cnt,
+		bool *zeroed);
+static void *pool_get (struct pool *, enum palloc_flags, size_t page_cnt,
+		bool *zeroed);
+static bool may_lend (struct pool *, size_t page_cnt);
+static void *compact (struct pool *, size_t page_cnt);
+static size_t free_runs (struct pool *, size_t hist[], size_t *free_cnt,
+		size_t *run_cnt);
 
 /* multiboot info */
 struct multiboot_info {
@@ -157,8 +284,8 @@ populate_pools (struct area *base_mem, struct area *ext_mem) {
 						break;
 					}
 					// generate kernel pool
-					init_pool (&kernel_pool,
-							&free_start, region_start, start + rem * PGSIZE);
+					init_pool (&kernel_pool, &free_start, region_start,
+							start + rem * PGSIZE, "kernel_pool");
 					// Transition to the next state
 					if (rem == size_in_pg) {
 						rem = user_pages;
@@ -187,7 +314,8 @@ populate_pools (struct area *base_mem, struct area *ext_mem) {
 	}
 
 	// generate the user pool
-	init_pool(&user_pool, &free_start, region_start, end);
+	init_pool (&user_pool, &free_start, region_start, end, "user_pool");
+	init_page_array (&free_start);
 
 	// Iterate over the e820_entry. Setup the usable.
 	uint64_t usable_bound = (uint64_t) free_start;
@@ -223,11 +351,13 @@ split:
 			if ((uint64_t) pool_end < end) {
 				page_cnt = ((uint64_t) pool_end - start) / PGSIZE;
 				bitmap_set_multiple (pool->used_map, page_idx, page_cnt, false);
+				buddy_free (pool, page_idx, page_cnt);
 				start = (uint64_t) pool_end;
 				goto split;
 			} else {
 				page_cnt = ((uint64_t) end - start) / PGSIZE;
 				bitmap_set_multiple (pool->used_map, page_idx, page_cnt, false);
+				buddy_free (pool, page_idx, page_cnt);
 			}
 		}
 	}
@@ -249,6 +379,11 @@ palloc_init (void) {
 	printf ("\text_mem: 0x%llx ~ 0x%llx (Usable: %'llu kB)\n",
 		  ext_mem.start, ext_mem.end, ext_mem.size / 1024);
 	populate_pools (&base_mem, &ext_mem);
+	printf ("\tpage descriptors: %zu x %zu bytes = %zu kB "
+			"(%zu.%02zu%% of memory)\n", page_array_cnt, sizeof *page_array,
+			page_array_cnt * sizeof *page_array / 1024,
+			sizeof *page_array * 100 / PGSIZE,
+			sizeof *page_array * 10000 / PGSIZE % 100);
 	return ext_mem.end;
 }
 
@@ -260,20 +395,42 @@ palloc_init (void) {
    FLAGS, in which case the kernel panics. */
 void *
 palloc_get_multiple (enum palloc_flags flags, size_t page_cnt) {
-	struct pool *pool = flags & PAL_USER ? &user_pool : &kernel_pool;
+	void *pages = get_pages (flags, page_cnt);
 
-	lock_acquire (&pool->lock);
-	size_t page_idx = bitmap_scan_and_flip (pool->used_map, 0, page_cnt, false);
-	lock_release (&pool->lock);
+	heapprof_alloc (HEAPPROF_PALLOC, pages, page_cnt * PGSIZE,
+			__builtin_return_address (0));
+	return pages;
+}
+
+/* Does the work of palloc_get_multiple(), without telling the
+   heap profiler, so that each public entry point can report its
+   own caller. */
+static void *
+get_pages (enum palloc_flags flags, size_t page_cnt) {
+	bool zeroed = false;
 	void *pages;
 
-	if (page_idx != BITMAP_ERROR)
-		pages = pool->base + PGSIZE * page_idx;
-	else
-		pages = NULL;
+	if (page_cnt == 0)
+		return NULL;
+
+	pages = try_get_pages (flags, page_cnt, &zeroed);
+
+	/* A multi-page request needs contiguous pages, which a few
+	   scattered frees are unlikely to yield, so ask for as much as
+	   the shrinkers can give. */
+	while (pages == NULL
+			&& shrink_memory (page_cnt == 1 ? SHRINK_BATCH : SIZE_MAX) > 0)
+		pages = try_get_pages (flags, page_cnt, &zeroed);
 
 	if (pages) {
-		if (flags & PAL_ZERO)
+		size_t i;
+
+		for (i = 0; i < page_cnt; i++) {
+			struct page *page = kva_to_page ((uint8_t *) pages + i * PGSIZE);
+			page->refcnt = 1;
+			page->mapping = NULL;
+		}
+		if ((flags & PAL_ZERO) && !zeroed)
 			memset (pages, 0, PGSIZE * page_cnt);
 	} else {
 		if (flags & PAL_ASSERT)
@@ -283,6 +440,91 @@ palloc_get_multiple (enum palloc_flags flags, size_t page_cnt) {
 	return pages;
 }
 
+/* Takes PAGE_CNT contiguous pages from the pool that FLAGS
+   selects, or failing that borrows them from the other pool, and
+   sets their flags.  Returns the first page, or a null pointer
+   if neither pool can provide them.  Sets *ZEROED as
+   pool_get(). */
+static void *
+try_get_pages (enum palloc_flags flags, size_t page_cnt, bool *zeroed) {
+	struct pool *pool = flags & PAL_USER ? &user_pool : &kernel_pool;
+	struct pool *lender = flags & PAL_USER ? &kernel_pool : &user_pool;
+	uint16_t loan = 0;
+	void *pages;
+	size_t i;
+
+	pages = pool_get (pool, flags, page_cnt, zeroed);
+	if (pages == NULL
+			&& (!(flags & PAL_USER) || user_page_limit == SIZE_MAX)
+			&& may_lend (lender, page_cnt)) {
+		pages = pool_get (lender, flags, page_cnt, zeroed);
+		if (pages != NULL) {
+			enum intr_level old_level = intr_disable ();
+			lender->lent_cnt += page_cnt;
+			intr_set_level (old_level);
+			loan = PAGE_LOAN;
+		}
+	}
+
+	if (pages == NULL && page_cnt > 1)
+		pages = compact (pool, page_cnt);
+
+	if (pages != NULL)
+		for (i = 0; i < page_cnt; i++)
+			kva_to_page ((uint8_t *) pages + i * PGSIZE)->flags =
+				(pool_of (pages) == &user_pool ? PAGE_USER : 0) | loan;
+	return pages;
+}
+
+/* Takes PAGE_CNT contiguous free pages from POOL and returns
+   the first, or a null pointer if POOL has no such run.  Sets
+   *ZEROED to true if FLAGS has PAL_ZERO and the pages are
+   already filled with zeros. */
+static void *
+pool_get (struct pool *pool, enum palloc_flags flags, size_t page_cnt,
+		bool *zeroed) {
+	void *pages;
+
+	if (page_cnt == 1) {
+		if (flags & PAL_ZERO) {
+			pages = zeroed_get (pool);
+			if (pages != NULL) {
+				*zeroed = true;
+				return pages;
+			}
+		}
+		pages = mag_get (pool);
+	} else {
+		lock_acquire (&pool->lock);
+		size_t page_idx = buddy_alloc (pool, page_cnt);
+		lock_release (&pool->lock);
+		if (page_idx == BITMAP_ERROR) {
+			/* Pages parked in the magazine or the zeroed stack may
+			   be what keeps a large enough block from forming. */
+			mag_drain (pool, MAG_SIZE);
+			zeroed_drain (pool);
+			lock_acquire (&pool->lock);
+			page_idx = buddy_alloc (pool, page_cnt);
+			lock_release (&pool->lock);
+		}
+
+		if (page_idx != BITMAP_ERROR)
+			pages = pool->base + PGSIZE * page_idx;
+		else
+			pages = NULL;
+	}
+	return pages;
+}
+
+/* Returns true if pool P may lend PAGE_CNT pages to the other
+   pool without dipping into its reserve.  The count is read
+   without locking, which is good enough for a watermark. */
+static bool
+may_lend (struct pool *p, size_t page_cnt) {
+	size_t free_cnt = p->free_cnt + p->mag_cnt + p->zeroed_cnt;
+	return free_cnt > page_cnt + bitmap_size (p->used_map) / RESERVE_DIV;
+}
+
 /* Obtains a single free page and returns its kernel virtual
    address.
    If PAL_USER is set, the page is obtained from the user pool,
@@ -292,34 +534,52 @@ palloc_get_multiple (enum palloc_flags flags, size_t page_cnt) {
    FLAGS, in which case the kernel panics. */
 void *
 palloc_get_page (enum palloc_flags flags) {
-	return palloc_get_multiple (flags, 1);
+	void *page = get_pages (flags, 1);
+
+	heapprof_alloc (HEAPPROF_PALLOC, page, PGSIZE,
+			__builtin_return_address (0));
+	return page;
 }
 
 /* Frees the PAGE_CNT pages starting at PAGES. */
 void
 palloc_free_multiple (void *pages, size_t page_cnt) {
 	struct pool *pool;
-	size_t page_idx;
+	size_t page_idx, i;
 
 	ASSERT (pg_ofs (pages) == 0);
 	if (pages == NULL || page_cnt == 0)
 		return;
 
-	if (page_from_pool (&kernel_pool, pages))
-		pool = &kernel_pool;
-	else if (page_from_pool (&user_pool, pages))
-		pool = &user_pool;
-	else
-		NOT_REACHED ();
-
+	heapprof_free (HEAPPROF_PALLOC, pages);
+	pool = pool_of (pages);
 	page_idx = pg_no (pages) - pg_no (pool->base);
+	if (pool->pages[page_idx].flags & PAGE_LOAN) {
+		enum intr_level old_level = intr_disable ();
+		pool->lent_cnt -= page_cnt;
+		intr_set_level (old_level);
+	}
+	for (i = 0; i < page_cnt; i++) {
+		struct page *page = &pool->pages[page_idx + i];
+		ASSERT (page->refcnt <= 1);
+		ASSERT (!(page->flags & PAGE_LRU));
+		page->refcnt = 0;
+		page->flags = 0;
+		page->mapping = NULL;
+	}
 
 #ifndef NDEBUG
 	memset (pages, 0xcc, PGSIZE * page_cnt);
 #endif
-	lock_acquire (&pool->lock);
 	ASSERT (bitmap_all (pool->used_map, page_idx, page_cnt));
+	if (page_cnt == 1) {
+		mag_put (pool, pages);
+		return;
+	}
+
+	lock_acquire (&pool->lock);
 	bitmap_set_multiple (pool->used_map, page_idx, page_cnt, false);
+	buddy_free (pool, page_idx, page_cnt);
 	lock_release (&pool->lock);
 }
 
@@ -329,31 +589,716 @@ palloc_free_page (void *page) {
 	palloc_free_multiple (page, 1);
 }
 
-/* Initializes pool P as starting at START and ending at END */
+/* Adds to the pools' stacks of zeroed pages.  Called by the idle
+   thread each time it runs, so it does a bounded amount of work
+   and never sleeps: it only takes pages from the magazines, or
+   from the buddy allocator when the pool lock is free. */
+void
+palloc_zero_idle (void) {
+	zero_pages (&kernel_pool);
+	zero_pages (&user_pool);
+}
+
+/* Prints page usage and free-memory fragmentation for each
+   pool. */
+void
+palloc_print_stats (void) {
+	printf ("Memory: %zu page descriptors, %zu kB\n", page_array_cnt,
+			page_array_cnt * sizeof *page_array / 1024);
+	print_pool_stats (&kernel_pool);
+	print_pool_stats (&user_pool);
+}
+
+/* Records OWNER as the owner of the PAGE_CNT allocated pages
+   starting at PAGES, so that palloc_get_owner() can find it from
+   any address within them.  Freeing a page clears its owner. */
+void
+palloc_set_owner (void *pages, size_t page_cnt, void *owner) {
+	struct pool *pool = pool_of (pages);
+	size_t page_idx = pg_no (pages) - pg_no (pool->base);
+	size_t i;
+
+	ASSERT (pg_ofs (pages) == 0);
+	ASSERT (bitmap_all (pool->used_map, page_idx, page_cnt));
+	for (i = 0; i < page_cnt; i++)
+		pool->pages[page_idx + i].mapping = owner;
+}
+
+/* Returns the owner recorded by palloc_set_owner() for the page
+   that contains ADDR, or a null pointer if none was recorded. */
+void *
+palloc_get_owner (const void *addr) {
+	return kva_to_page (addr)->mapping;
+}
+
+/* Returns the descriptor of the frame that contains kernel
+   virtual address KVA, which must lie in one of the pools. */
+struct page *
+kva_to_page (const void *kva) {
+	size_t no = pg_no (kva) - page_base_no;
+
+	ASSERT (no < page_array_cnt);
+	return &page_array[no];
+}
+
+/* Returns the kernel virtual address of the frame that PAGE
+   describes. */
+void *
+page_to_kva (const struct page *page) {
+	ASSERT (page >= page_array && page < page_array + page_array_cnt);
+	return (void *) ((page_base_no + (page - page_array)) << PGBITS);
+}
+
+/* Marks allocated page KPAGE as movable, with OWNER as its
+   owner.  Compaction may then call OWNER->migrate() to move the
+   page elsewhere.  A movable page must be freed with page_put(),
+   not palloc_free_page(), since compaction may be holding a
+   reference to it. */
+void
+palloc_set_movable (void *kpage, struct page_owner *owner) {
+	struct page *page = kva_to_page (kpage);
+
+	ASSERT (pg_ofs (kpage) == 0);
+	ASSERT (page->refcnt > 0);
+	ASSERT (owner != NULL && owner->migrate != NULL);
+	page->mapping = owner;
+	page->flags |= PAGE_MOVABLE;
+}
+
+/* Adds a reference to allocated page PAGE, for sharing it. */
+void
+page_get (struct page *page) {
+	enum intr_level old_level = intr_disable ();
+
+	ASSERT (page->refcnt > 0);
+	page->refcnt++;
+	intr_set_level (old_level);
+}
+
+/* Drops a reference to PAGE, which must have been allocated as a
+   single page, and frees the page if that was the last one. */
+void
+page_put (struct page *page) {
+	enum intr_level old_level = intr_disable ();
+	int refcnt;
+
+	ASSERT (page->refcnt > 0);
+	refcnt = --page->refcnt;
+	intr_set_level (old_level);
+
+	if (refcnt == 0)
+		palloc_free_page (page_to_kva (page));
+}
+
+/* Initializes pool P, named NAME, as starting at START and
+   ending at END */
 static void
-init_pool (struct pool *p, void **bm_base, uint64_t start, uint64_t end) {
-  /* We'll put the pool's used_map at its base.
-     Calculate the space needed for the bitmap
-     and subtract it from the pool's size. */
+init_pool (struct pool *p, void **bm_base, uint64_t start, uint64_t end,
+		const char *name) {
+  /* We'll put the pool's used_map at BM_BASE.
+     Calculate the space needed for it and advance BM_BASE
+     past it.  Its page descriptors come later, from
+     init_page_array(). */
 	uint64_t pgcnt = (end - start) / PGSIZE;
 	size_t bm_pages = DIV_ROUND_UP (bitmap_buf_size (pgcnt), PGSIZE) * PGSIZE;
+	size_t i;
 
-	lock_init(&p->lock);
+	p->name = name;
+	lock_init_named (&p->lock, name);
 	p->used_map = bitmap_create_in_buf (pgcnt, *bm_base, bm_pages);
 	p->base = (void *) start;
+	p->pages = NULL;
 
 	// Mark all to unusable.
 	bitmap_set_all(p->used_map, true);
+	for (i = 0; i <= MAX_ORDER; i++)
+		list_init (&p->free_lists[i]);
+	p->free_cnt = 0;
+	p->mag_cnt = 0;
+	p->zeroed_cnt = 0;
+	p->lent_cnt = 0;
 
 	*bm_base += bm_pages;
 }
 
+/* Puts the page descriptor array, covering both pools, at BASE,
+   and advances BASE past it.  Must be called after both pools
+   are initialized and before any of their pages are freed. */
+static void
+init_page_array (void **base) {
+	size_t first = pg_no (kernel_pool.base);
+	size_t last = pg_no (user_pool.base) + bitmap_size (user_pool.used_map);
+	size_t i;
+
+	ASSERT (kernel_pool.base < user_pool.base);
+
+	page_array = *base;
+	page_base_no = first;
+	page_array_cnt = last - first;
+	for (i = 0; i < page_array_cnt; i++) {
+		struct page *page = &page_array[i];
+		page->order = -1;
+		page->flags = 0;
+		page->refcnt = 0;
+		page->mapping = NULL;
+	}
+	kernel_pool.pages = page_array;
+	user_pool.pages = page_array + (pg_no (user_pool.base) - first);
+
+	*base += DIV_ROUND_UP (page_array_cnt * sizeof *page_array, PGSIZE) * PGSIZE;
+}
+
 /* Returns true if PAGE was allocated from POOL,
    false otherwise. */
 static bool
-page_from_pool (const struct pool *pool, void *page) {
+page_from_pool (const struct pool *pool, const void *page) {
 	size_t page_no = pg_no (page);
 	size_t start_page = pg_no (pool->base);
 	size_t end_page = start_page + bitmap_size (pool->used_map);
 	return page_no >= start_page && page_no < end_page;
 }
+
+/* Returns the pool that PAGE belongs to. */
+static struct pool *
+pool_of (const void *page) {
+	if (page_from_pool (&kernel_pool, page))
+		return &kernel_pool;
+	else if (page_from_pool (&user_pool, page))
+		return &user_pool;
+	else
+		NOT_REACHED ();
+}
+
+/* Returns the smallest order whose blocks hold PAGE_CNT pages,
+   or MAX_ORDER + 1 if there is none. */
+static int
+order_for (size_t page_cnt) {
+	int order = 0;
+
+	while (order <= MAX_ORDER && ((size_t) 1 << order) < page_cnt)
+		order++;
+	return order;
+}
+
+/* Puts the free block of 2**ORDER pages at PAGE_IDX on its free
+   list. */
+static void
+buddy_insert (struct pool *p, size_t page_idx, int order) {
+	p->pages[page_idx].order = order;
+	list_push_front (&p->free_lists[order], &p->pages[page_idx].lru);
+}
+
+/* Takes the free block at PAGE_IDX off its free list. */
+static void
+buddy_remove (struct pool *p, size_t page_idx) {
+	list_remove (&p->pages[page_idx].lru);
+	p->pages[page_idx].order = -1;
+}
+
+/* Frees the block of 2**ORDER pages at PAGE_IDX, merging it with
+   its buddy as long as the buddy is free too. */
+static void
+buddy_free_block (struct pool *p, size_t page_idx, int order) {
+	size_t page_cnt = bitmap_size (p->used_map);
+
+	while (order < MAX_ORDER) {
+		size_t buddy = page_idx ^ ((size_t) 1 << order);
+		if (buddy >= page_cnt || p->pages[buddy].order != order)
+			break;
+		buddy_remove (p, buddy);
+		page_idx &= ~((size_t) 1 << order);
+		order++;
+	}
+	buddy_insert (p, page_idx, order);
+}
+
+/* Frees the PAGE_CNT pages starting at PAGE_IDX, which need not
+   form a single block, by freeing the largest aligned blocks
+   that make up the range. */
+static void
+buddy_free (struct pool *p, size_t page_idx, size_t page_cnt) {
+	size_t end = page_idx + page_cnt;
+
+	p->free_cnt += page_cnt;
+	while (page_idx < end) {
+		int order = 0;
+
+		while (order < MAX_ORDER
+				&& page_idx % ((size_t) 2 << order) == 0
+				&& page_idx + ((size_t) 2 << order) <= end)
+			order++;
+		buddy_free_block (p, page_idx, order);
+		page_idx += (size_t) 1 << order;
+	}
+}
+
+/* Takes PAGE_CNT contiguous pages from P's free lists and returns
+   the index of the first, or BITMAP_ERROR if no free block is
+   large enough. */
+static size_t
+buddy_alloc (struct pool *p, size_t page_cnt) {
+	int order = order_for (page_cnt);
+	int o;
+	size_t page_idx;
+
+	/* Find the smallest free block that is large enough. */
+	for (o = order; o <= MAX_ORDER; o++)
+		if (!list_empty (&p->free_lists[o]))
+			break;
+	if (o > MAX_ORDER)
+		return BITMAP_ERROR;
+
+	page_idx = list_entry (list_front (&p->free_lists[o]),
+			struct page, lru) - p->pages;
+	buddy_remove (p, page_idx);
+	p->free_cnt -= (size_t) 1 << o;
+
+	/* Split it down to ORDER, freeing the upper halves. */
+	while (o > order) {
+		o--;
+		buddy_insert (p, page_idx + ((size_t) 1 << o), o);
+	}
+
+	/* Give back the pages beyond PAGE_CNT. */
+	if (page_cnt < (size_t) 1 << order)
+		buddy_free (p, page_idx + page_cnt, ((size_t) 1 << order) - page_cnt);
+
+	ASSERT (bitmap_none (p->used_map, page_idx, page_cnt));
+	bitmap_set_multiple (p->used_map, page_idx, page_cnt, true);
+	return page_idx;
+}
+
+/* Returns a free page from P's magazine, refilling the magazine
+   from the buddy allocator first if it is empty.  Returns a null
+   pointer if P has no free pages at all. */
+static void *
+mag_get (struct pool *p) {
+	void *batch[MAG_BATCH];
+	size_t batch_cnt, i;
+	enum intr_level old_level;
+	void *page = NULL;
+
+	old_level = intr_disable ();
+	if (p->mag_cnt > 0)
+		page = p->mag[--p->mag_cnt];
+	intr_set_level (old_level);
+	if (page != NULL)
+		return page;
+
+	/* Refill: the first page goes to the caller, the rest into the
+	   magazine. */
+	lock_acquire (&p->lock);
+	for (batch_cnt = 0; batch_cnt < MAG_BATCH; batch_cnt++) {
+		size_t page_idx = buddy_alloc (p, 1);
+		if (page_idx == BITMAP_ERROR)
+			break;
+		batch[batch_cnt] = p->base + PGSIZE * page_idx;
+	}
+	lock_release (&p->lock);
+	if (batch_cnt == 0)
+		return zeroed_get (p);
+
+	old_level = intr_disable ();
+	for (i = 1; i < batch_cnt && p->mag_cnt < MAG_SIZE; i++)
+		p->mag[p->mag_cnt++] = batch[i];
+	intr_set_level (old_level);
+
+	/* Other threads may have filled the magazine meanwhile. */
+	if (i < batch_cnt) {
+		lock_acquire (&p->lock);
+		for (; i < batch_cnt; i++) {
+			size_t page_idx = pg_no (batch[i]) - pg_no (p->base);
+			bitmap_reset (p->used_map, page_idx);
+			buddy_free (p, page_idx, 1);
+		}
+		lock_release (&p->lock);
+	}
+	return batch[0];
+}
+
+/* Puts free PAGE into P's magazine, first draining part of the
+   magazine back to the buddy allocator if it is full. */
+static void
+mag_put (struct pool *p, void *page) {
+	enum intr_level old_level;
+
+	for (;;) {
+		old_level = intr_disable ();
+		if (p->mag_cnt < MAG_SIZE) {
+			p->mag[p->mag_cnt++] = page;
+			intr_set_level (old_level);
+			return;
+		}
+		intr_set_level (old_level);
+		mag_drain (p, MAG_BATCH);
+	}
+}
+
+/* Returns up to PAGE_CNT pages from P's magazine to the buddy
+   allocator. */
+static void
+mag_drain (struct pool *p, size_t page_cnt) {
+	void *batch[MAG_SIZE];
+	size_t batch_cnt = 0, i;
+	enum intr_level old_level;
+
+	ASSERT (page_cnt <= MAG_SIZE);
+
+	old_level = intr_disable ();
+	while (batch_cnt < page_cnt && p->mag_cnt > 0)
+		batch[batch_cnt++] = p->mag[--p->mag_cnt];
+	intr_set_level (old_level);
+	if (batch_cnt == 0)
+		return;
+
+	lock_acquire (&p->lock);
+	for (i = 0; i < batch_cnt; i++) {
+		size_t page_idx = pg_no (batch[i]) - pg_no (p->base);
+		ASSERT (bitmap_test (p->used_map, page_idx));
+		bitmap_reset (p->used_map, page_idx);
+		buddy_free (p, page_idx, 1);
+	}
+	lock_release (&p->lock);
+}
+
+/* Returns a zeroed page from P's stack of them, or a null pointer
+   if the stack is empty. */
+static void *
+zeroed_get (struct pool *p) {
+	enum intr_level old_level;
+	void *page = NULL;
+
+	old_level = intr_disable ();
+	if (p->zeroed_cnt > 0)
+		page = p->zeroed[--p->zeroed_cnt];
+	intr_set_level (old_level);
+	return page;
+}
+
+/* Returns all of P's zeroed pages to the buddy allocator. */
+static void
+zeroed_drain (struct pool *p) {
+	void *page;
+
+	while ((page = zeroed_get (p)) != NULL) {
+		size_t page_idx = pg_no (page) - pg_no (p->base);
+
+		lock_acquire (&p->lock);
+		ASSERT (bitmap_test (p->used_map, page_idx));
+		bitmap_reset (p->used_map, page_idx);
+		buddy_free (p, page_idx, 1);
+		lock_release (&p->lock);
+	}
+}
+
+/* Zeroes up to ZERO_BATCH free pages of P onto its zeroed stack,
+   stopping early if the stack is full or no free page can be had
+   without sleeping.  Only the idle thread adds to the stack, so
+   once there is room for a page there still is after clearing
+   it. */
+static void
+zero_pages (struct pool *p) {
+	size_t i;
+
+	for (i = 0; i < ZERO_BATCH && p->zeroed_cnt < ZERO_MAX; i++) {
+		enum intr_level old_level;
+		void *page = NULL;
+
+		/* Take a page from the magazine, or failing that from the
+		   buddy allocator.  Keep interrupts off while holding the
+		   lock, so that the idle thread is never preempted with it
+		   held. */
+		old_level = intr_disable ();
+		if (p->mag_cnt > 0)
+			page = p->mag[--p->mag_cnt];
+		else if (lock_try_acquire (&p->lock)) {
+			size_t page_idx = buddy_alloc (p, 1);
+			lock_release (&p->lock);
+			if (page_idx != BITMAP_ERROR)
+				page = p->base + PGSIZE * page_idx;
+		}
+		intr_set_level (old_level);
+		if (page == NULL)
+			return;
+
+		memset (page, 0, PGSIZE);
+
+		old_level = intr_disable ();
+		ASSERT (p->zeroed_cnt < ZERO_MAX);
+		p->zeroed[p->zeroed_cnt++] = page;
+		intr_set_level (old_level);
+	}
+}
+
+/* Prints statistics for pool P: its size, how many of its pages
+   are in use, how many free pages sit in the magazine and the
+   zeroed stack, and a histogram of the lengths of the runs of
+   contiguous free pages in the buddy allocator. */
+static void
+print_pool_stats (struct pool *p) {
+	size_t hist[MAX_ORDER + 2];
+	size_t page_cnt = bitmap_size (p->used_map);
+	size_t free_cnt, max_run, run_cnt;
+	size_t cached_cnt, i;
+	enum intr_level old_level;
+
+	if (p->name == NULL)
+		return;
+
+	lock_acquire (&p->lock);
+	old_level = intr_disable ();
+	cached_cnt = p->mag_cnt + p->zeroed_cnt;
+	intr_set_level (old_level);
+	max_run = free_runs (p, hist, &free_cnt, &run_cnt);
+	lock_release (&p->lock);
+
+	printf ("Memory: %s: %zu pages, %zu used (%zu lent), %zu free "
+			"(%zu cached), largest free run %zu pages\n", p->name, page_cnt,
+			page_cnt - free_cnt - cached_cnt, p->lent_cnt,
+			free_cnt + cached_cnt, cached_cnt, max_run);
+	if (run_cnt == 0)
+		return;
+	printf ("Memory: %s: free runs:", p->name);
+	for (i = 0; i <= MAX_ORDER + 1; i++)
+		if (hist[i] != 0) {
+			if (i == 0)
+				printf (" 1:%zu", hist[i]);
+			else
+				printf (" %zu-%zu:%zu", (size_t) 1 << i, ((size_t) 2 << i) - 1,
+						hist[i]);
+		}
+	printf ("\n");
+	if (p->compact_cnt > 0)
+		printf ("Memory: %s: %zu compactions, %zu succeeded, %zu pages "
+				"migrated; last: largest free run %zu -> %zu pages\n", p->name,
+				p->compact_cnt, p->compact_ok_cnt, p->migrate_cnt,
+				p->run_before, p->run_after);
+}
+
+/* Scans pool P, which must be locked, for runs of contiguous
+   free pages.  Free blocks that happen to be adjacent form one
+   run, even when they are not buddies.  If HIST is nonnull, sets
+   HIST[I], for I <= MAX_ORDER + 1, to the number of runs of
+   2**I to 2**(I+1) - 1 pages.  If FREE_CNT and RUN_CNT are
+   nonnull, stores the number of free pages and of runs there.
+   Returns the length of the longest run. */
+static size_t
+free_runs (struct pool *p, size_t hist[], size_t *free_cnt,
+		size_t *run_cnt) {
+	size_t page_cnt = bitmap_size (p->used_map);
+	size_t run = 0, max_run = 0, page_idx;
+
+	ASSERT (lock_held_by_current_thread (&p->lock));
+
+	if (hist != NULL)
+		memset (hist, 0, sizeof *hist * (MAX_ORDER + 2));
+	if (free_cnt != NULL)
+		*free_cnt = *run_cnt = 0;
+	for (page_idx = 0; page_idx <= page_cnt; ) {
+		int order = page_idx < page_cnt ? p->pages[page_idx].order : -1;
+
+		if (order >= 0) {
+			run += (size_t) 1 << order;
+			page_idx += (size_t) 1 << order;
+			continue;
+		}
+		if (run > 0) {
+			int b = 0;
+
+			while (b <= MAX_ORDER && ((size_t) 2 << b) <= run)
+				b++;
+			if (hist != NULL)
+				hist[b]++;
+			if (free_cnt != NULL) {
+				*free_cnt += run;
+				(*run_cnt)++;
+			}
+			if (run > max_run)
+				max_run = run;
+			run = 0;
+		}
+		page_idx++;
+	}
+	return max_run;
+}
+
+/* Takes free page PAGE_IDX of pool P, which must be locked, out
+   of the free block that contains it, and puts the rest of the
+   block back on the free lists. */
+static void
+buddy_take (struct pool *p, size_t page_idx) {
+	size_t head = page_idx;
+	int o;
+
+	for (o = 0; o <= MAX_ORDER; o++) {
+		head = page_idx & ~(((size_t) 1 << o) - 1);
+		if (p->pages[head].order == o)
+			break;
+	}
+	ASSERT (o <= MAX_ORDER);
+
+	buddy_remove (p, head);
+	p->free_cnt--;
+	while (o-- > 0) {
+		size_t half = (size_t) 1 << o;
+
+		if (page_idx >= head + half) {
+			buddy_insert (p, head, o);
+			head += half;
+		} else
+			buddy_insert (p, head + half, o);
+	}
+}
+
+/* Returns true if allocated page PAGE can be migrated. */
+static bool
+is_movable (const struct page *page) {
+	return (page->flags & PAGE_MOVABLE) && page->refcnt > 0;
+}
+
+/* Adds a reference to PAGE if it has one already, with interrupts
+   off so as not to race with page_put().  Returns true if
+   successful. */
+static bool
+page_try_get (struct page *page) {
+	enum intr_level old_level = intr_disable ();
+	bool success = page->refcnt > 0;
+
+	if (success)
+		page->refcnt++;
+	intr_set_level (old_level);
+	return success;
+}
+
+/* Returns the start of the window of PAGE_CNT pages in pool P,
+   which must be locked, that has only free and movable pages and
+   the fewest movable ones, or BITMAP_ERROR if there is none.
+   Pages parked in the magazine or the zeroed stack count as
+   neither. */
+static size_t
+find_window (struct pool *p, size_t page_cnt) {
+	size_t pool_cnt = bitmap_size (p->used_map);
+	size_t fixed = 0, movable = 0;
+	size_t best = BITMAP_ERROR, best_movable = SIZE_MAX;
+	size_t i;
+
+	for (i = 0; i < pool_cnt; i++) {
+		/* Add page I to the window, and drop page I - PAGE_CNT. */
+		if (!bitmap_test (p->used_map, i))
+			;
+		else if (is_movable (&p->pages[i]))
+			movable++;
+		else
+			fixed++;
+		if (i >= page_cnt) {
+			size_t j = i - page_cnt;
+			if (!bitmap_test (p->used_map, j))
+				;
+			else if (is_movable (&p->pages[j]))
+				movable--;
+			else
+				fixed--;
+		}
+
+		if (i + 1 >= page_cnt && fixed == 0 && movable < best_movable) {
+			best = i + 1 - page_cnt;
+			best_movable = movable;
+		}
+	}
+	return best;
+}
+
+/* Gives back the pages of the window of PAGE_CNT pages at
+   START in pool P that compact() had claimed: drops its
+   references to pages that still have owners, and frees the
+   rest. */
+static void
+release_window (struct pool *p, size_t start, size_t page_cnt) {
+	size_t i;
+
+	for (i = start; i < start + page_cnt; i++) {
+		struct page *page = &p->pages[i];
+
+		if (page->refcnt > 1)
+			page_put (page);
+		else {
+			page->flags = 0;
+			page->mapping = NULL;
+			palloc_free_page (p->base + i * PGSIZE);
+		}
+	}
+}
+
+/* Assembles PAGE_CNT contiguous pages in pool P by migrating
+   movable pages out of the way, and returns them allocated, or
+   a null pointer if that is not possible. */
+static void *
+compact (struct pool *p, size_t page_cnt) {
+	enum palloc_flags flags = p == &user_pool ? PAL_USER : 0;
+	size_t start, i, migrated = 0;
+
+	/* Parked pages would keep their windows from being used. */
+	mag_drain (p, MAG_SIZE);
+	zeroed_drain (p);
+
+	lock_acquire (&p->lock);
+	p->compact_cnt++;
+	p->run_before = free_runs (p, NULL, NULL, NULL);
+	start = find_window (p, page_cnt);
+	if (start == BITMAP_ERROR) {
+		lock_release (&p->lock);
+		return NULL;
+	}
+
+	/* Claim the window: take its free pages off the free lists,
+	   and pin its movable pages, so that they are not freed under
+	   us. */
+	for (i = start; i < start + page_cnt; i++) {
+		struct page *page = &p->pages[i];
+
+		if (!bitmap_test (p->used_map, i)) {
+			buddy_take (p, i);
+			bitmap_mark (p->used_map, i);
+			page->refcnt = 1;
+			page->flags = 0;
+			page->mapping = NULL;
+		} else if (!page_try_get (page)) {
+			/* Freed into the magazine since find_window(). */
+			lock_release (&p->lock);
+			release_window (p, start, i - start);
+			return NULL;
+		}
+	}
+	lock_release (&p->lock);
+
+	/* Move the pages that still have owners.  Each successful
+	   migrate() drops the owner's reference, leaving ours. */
+	for (i = start; i < start + page_cnt; i++) {
+		struct page *page = &p->pages[i];
+		struct page_owner *owner = page->mapping;
+		void *dst;
+
+		if (page->refcnt > 1) {
+			ASSERT (page->flags & PAGE_MOVABLE);
+			dst = palloc_get_page (flags);
+			if (dst == NULL || !owner->migrate (page, dst)) {
+				palloc_free_page (dst);
+				release_window (p, start, page_cnt);
+				return NULL;
+			}
+			ASSERT (page->refcnt == 1);
+			migrated++;
+		}
+		page->flags = 0;
+		page->mapping = NULL;
+	}
+
+	lock_acquire (&p->lock);
+	p->compact_ok_cnt++;
+	p->migrate_cnt += migrated;
+	p->run_after = free_runs (p, NULL, NULL, NULL);
+	if (p->run_after < page_cnt)
+		p->run_after = page_cnt;
+	lock_release (&p->lock);
+	return p->base + start * PGSIZE;
+}
@@ -0,0 +1,195 @@
+#include "threads/rcu.h"
+#include <debug.h>
+#include <list.h>
+#include <stdint.h>
+#include "threads/interrupt.h"
+#include "threads/thread.h"
+
+/* Read-copy-update for a uniprocessor kernel.
+
+   A thread inside a read-side critical section can neither sleep
+   (asserted in rcu_note_context_switch()) nor be preempted
+   (thread_tick() defers the time-slice yield until the outermost
+   rcu_read_unlock()).  Therefore, whenever schedule() switches
+   away from a thread, that thread is outside any read-side
+   critical section, and so is every other thread.  Each call to
+   schedule() is thus a quiescent state, and it advances GP_SEQ.
+   A grace period that begins at sequence number N is over once
+   GP_SEQ exceeds N.
+
+   Callbacks queued by call_rcu() are run in batches by the "rcu"
+   kernel thread, after it has waited out a grace period with
+   synchronize_rcu().  Running them from thread context lets them
+   free memory with free() or palloc_free_page(), which may
+   sleep. */
+
+/* Number of quiescent states observed.  Only written by
+   schedule(), with interrupts off. */
+static int64_t gp_seq;
+
+/* Callbacks waiting for a grace period. */
+static struct list cb_list;
+
+/* Up'd when CB_LIST becomes nonempty. */
+static struct semaphore cb_ready;
+
+static thread_func rcu_thread;
+
+/* Initializes RCU and starts the thread that runs call_rcu()
+   callbacks.  Must be called after thread_start(). */
+void
+rcu_init (void) {
+	list_init (&cb_list);
+	sema_init (&cb_ready, 0);
+	if (thread_create ("rcu", PRI_DEFAULT, rcu_thread, NULL) == TID_ERROR)
+		PANIC ("rcu: cannot create callback thread");
+}
+
+/* Enters a read-side critical section.  May nest. */
+void
+rcu_read_lock (void) {
+	thread_current ()->rcu_nesting++;
+	barrier ();
+}
+
+/* Leaves a read-side critical section.  If this ends the
+   outermost one and the thread's time slice ran out meanwhile,
+   yields now. */
+void
+rcu_read_unlock (void) {
+	struct thread *t = thread_current ();
+
+	ASSERT (t->rcu_nesting > 0);
+	barrier ();
+	if (--t->rcu_nesting == 0 && !intr_context () && thread_slice_expired ())
+		thread_yield ();
+}
+
+/* Called by schedule(), with interrupts off, whenever PREV is
+   about to give up the CPU.  Records a quiescent state. */
+void
+rcu_note_context_switch (struct thread *prev) {
+	ASSERT (intr_get_level () == INTR_OFF);
+	ASSERT (prev->rcu_nesting == 0);
+
+	gp_seq++;
+}
+
+/* Waits until every read-side critical section that was in
+   progress when this function was called has completed.  May
+   sleep, so it must not be called from an interrupt handler or
+   inside a read-side critical section. */
+void
+synchronize_rcu (void) {
+	int64_t start;
+
+	ASSERT (!intr_context ());
+	ASSERT (thread_current ()->rcu_nesting == 0);
+
+	start = gp_seq;
+	while (gp_seq == start) {
+		thread_yield ();
+		barrier ();
+	}
+}
+
+/* Arranges for FUNC to be called with HEAD after a grace period
+   has elapsed, from a kernel thread.  May be called from an
+   interrupt handler. */
+void
+call_rcu (struct rcu_head *head, rcu_callback_func *func) {
+	enum intr_level old_level;
+	bool was_empty;
+
+	ASSERT (head != NULL);
+	ASSERT (func != NULL);
+
+	head->func = func;
+	old_level = intr_disable ();
+	was_empty = list_empty (&cb_list);
+	list_push_back (&cb_list, &head->elem);
+	intr_set_level (old_level);
+
+	if (was_empty)
+		sema_up (&cb_ready);
+}
+
+/* Runs queued callbacks in batches, one grace period per
+   batch. */
+static void
+rcu_thread (void *aux UNUSED) {
+	for (;;) {
+		struct list batch;
+		enum intr_level old_level;
+
+		sema_down (&cb_ready);
+
+		/* Take every callback queued so far. */
+		list_init (&batch);
+		old_level = intr_disable ();
+		if (!list_empty (&cb_list))
+			list_splice (list_end (&batch), list_begin (&cb_list),
+					list_end (&cb_list));
+		intr_set_level (old_level);
+
+		synchronize_rcu ();
+		while (!list_empty (&batch)) {
+			struct rcu_head *head =
+				list_entry (list_pop_front (&batch), struct rcu_head, elem);
+			head->func (head);
+		}
+	}
+}
+
+/* Inserts ELEM just before BEFORE, publishing it to concurrent
+   readers only once its own links are set. */
+void
+rcu_list_insert (struct list_elem *before, struct list_elem *elem) {
+	ASSERT (before != NULL);
+	ASSERT (elem != NULL);
+
+	elem->prev = before->prev;
+	elem->next = before;
+	rcu_assign_pointer (before->prev->next, elem);
+	before->prev = elem;
+}
+
+/* Inserts ELEM at the beginning of LIST. */
+void
+rcu_list_push_front (struct list *list, struct list_elem *elem) {
+	rcu_list_insert (list_begin (list), elem);
+}
+
+/* Inserts ELEM at the end of LIST. */
+void
+rcu_list_push_back (struct list *list, struct list_elem *elem) {
+	rcu_list_insert (list_end (list), elem);
+}
+
+/* Unlinks ELEM from its list.  ELEM's own links are left intact,
+   so readers already positioned on ELEM can still move past it.
+   ELEM must not be reused or freed until a grace period has
+   elapsed. */
+void
+rcu_list_remove (struct list_elem *elem) {
+	ASSERT (elem != NULL);
+
+	rcu_assign_pointer (elem->prev->next, elem->next);
+	elem->next->prev = elem->prev;
+}
+
+/* Returns the first element of LIST, for lockless traversal
+   inside a read-side critical section. */
+struct list_elem *
+rcu_list_begin (struct list *list) {
+	ASSERT (list != NULL);
+	return rcu_dereference (list->head.next);
+}
+
+/* Returns the element after ELEM, for lockless traversal inside
+   a read-side critical section. */
+struct list_elem *
+rcu_list_next (struct list_elem *elem) {
+	ASSERT (elem != NULL);
+	return rcu_dereference (elem->next);
+}
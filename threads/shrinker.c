@@ -0,0 +1,96 @@
+#include "threads/shrinker.h"
+#include <debug.h>
+#include <stdio.h>
+#include "threads/interrupt.h"
+#include "threads/synch.h"
+
+/* Registered shrinkers.  SHRINKERS_LOCK is held while shrinkers
+   run, and shrink_memory() only try-acquires it, so a thread
+   that finds another already shrinking does not wait for it, and
+   a shrinker that somehow ended up allocating would not
+   deadlock. */
+static struct list shrinkers;
+static struct lock shrinkers_lock;
+static bool shrinkers_initialized;
+
+/* Initializes the shrinker list the first time it is needed. */
+static void
+init_shrinkers (void) {
+	enum intr_level old_level = intr_disable ();
+
+	if (!shrinkers_initialized) {
+		list_init (&shrinkers);
+		lock_init_named (&shrinkers_lock, "shrinkers");
+		shrinkers_initialized = true;
+	}
+	intr_set_level (old_level);
+}
+
+/* Adds S, whose COUNT, SCAN, and NAME must be set, to the
+   shrinkers that shrink_memory() calls. */
+void
+shrinker_register (struct shrinker *s) {
+	ASSERT (s->count != NULL && s->scan != NULL);
+
+	init_shrinkers ();
+	s->freed_cnt = 0;
+	lock_acquire (&shrinkers_lock);
+	list_push_back (&shrinkers, &s->elem);
+	lock_release (&shrinkers_lock);
+}
+
+/* Removes S from the registered shrinkers. */
+void
+shrinker_unregister (struct shrinker *s) {
+	lock_acquire (&shrinkers_lock);
+	list_remove (&s->elem);
+	lock_release (&shrinkers_lock);
+}
+
+/* Asks the registered shrinkers to free at least PAGE_CNT pages,
+   and returns how many they freed, which may be fewer or more.
+   Returns 0 at once if called from an interrupt handler or while
+   another thread is shrinking. */
+size_t
+shrink_memory (size_t page_cnt) {
+	struct list_elem *e;
+	size_t freed = 0;
+
+	if (intr_context () || !shrinkers_initialized)
+		return 0;
+	if (lock_held_by_current_thread (&shrinkers_lock)
+			|| !lock_try_acquire (&shrinkers_lock))
+		return 0;
+
+	for (e = list_begin (&shrinkers); e != list_end (&shrinkers)
+			&& freed < page_cnt; e = list_next (e)) {
+		struct shrinker *s = list_entry (e, struct shrinker, elem);
+		size_t cnt;
+
+		if (s->count (s) == 0)
+			continue;
+		cnt = s->scan (s, page_cnt - freed);
+		s->freed_cnt += cnt;
+		freed += cnt;
+	}
+	lock_release (&shrinkers_lock);
+	return freed;
+}
+
+/* Prints how many pages each shrinker has freed. */
+void
+shrinker_print_stats (void) {
+	struct list_elem *e;
+
+	if (!shrinkers_initialized)
+		return;
+
+	lock_acquire (&shrinkers_lock);
+	for (e = list_begin (&shrinkers); e != list_end (&shrinkers);
+			e = list_next (e)) {
+		struct shrinker *s = list_entry (e, struct shrinker, elem);
+		printf ("Shrinker: %s: %zu pages freed, %zu freeable\n", s->name,
+				s->freed_cnt, s->count (s));
+	}
+	lock_release (&shrinkers_lock);
+}
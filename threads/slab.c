@@ -0,0 +1,378 @@
+#include "threads/slab.h"
+#include <debug.h>
+#include <list.h>
+#include <round.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+#include "threads/interrupt.h"
+#include "threads/malloc.h"
+#include "threads/palloc.h"
+#include "threads/shrinker.h"
+#include "threads/synch.h"
+#include "threads/vaddr.h"
+
+/* Slab allocator.
+
+   Each slab is one page from the kernel pool.  It starts with a
+   `struct slab' header, followed by an array of free-list links
+   (one index per object) and then the objects themselves.  The
+   free list is threaded through the link array rather than
+   through the objects, so that a freed object keeps the state
+   its constructor (or its last user) left it in.
+
+   A cache keeps its slabs on three lists by how many of their
+   objects are free.  Allocation takes from a partially used
+   slab if there is one.  A slab whose objects are all free is
+   returned to the page allocator, except that each cache keeps
+   one such slab around so that a workload hovering around a slab
+   boundary does not allocate and free a page on every call.
+   Under memory pressure, a shrinker gives back those empty slabs
+   too. */
+
+/* Magic number for detecting slab corruption. */
+#define SLAB_MAGIC 0x51ab51ab
+
+/* Marks the end of a slab's free list. */
+#define SLAB_END UINT16_MAX
+
+/* An object cache. */
+struct kmem_cache {
+	char name[16];              /* Cache and lock name. */
+	struct list_elem elem;      /* Element in `caches'. */
+	struct lock lock;           /* Protects everything below. */
+	size_t obj_size;            /* Requested object size. */
+	size_t stride;              /* OBJ_SIZE rounded up to alignment. */
+	size_t objs_per_slab;       /* Objects in each slab. */
+	size_t first_ofs;           /* Offset of first object in a slab. */
+	kmem_ctor_func *ctor;       /* Constructor, or null. */
+	struct list partial_slabs;  /* Slabs with some free objects. */
+	struct list full_slabs;     /* Slabs with no free objects. */
+	struct list empty_slabs;    /* Slabs with only free objects. */
+
+	/* Statistics. */
+	size_t slab_cnt;            /* Slabs currently allocated. */
+	size_t active_cnt;          /* Objects currently allocated. */
+	size_t peak_cnt;            /* Maximum of ACTIVE_CNT. */
+	unsigned long long alloc_cnt;   /* Calls to kmem_cache_alloc(). */
+	unsigned long long free_cnt;    /* Calls to kmem_cache_free(). */
+};
+
+/* Slab header, at the start of each slab's page. */
+struct slab {
+	unsigned magic;             /* Always set to SLAB_MAGIC. */
+	struct kmem_cache *cache;   /* Owning cache. */
+	struct list_elem elem;      /* Element in one of the cache's lists. */
+	size_t free_cnt;            /* Number of free objects. */
+	uint16_t free_head;         /* First free object, or SLAB_END. */
+	uint16_t next[];            /* Next free object after each one. */
+};
+
+/* All caches, for kmem_cache_print_stats().  Protected by
+   disabling interrupts. */
+static struct list caches;
+static bool caches_initialized;
+
+static struct shrinker slab_shrinker;
+
+static struct slab *slab_create (struct kmem_cache *);
+static struct slab *obj_to_slab (struct kmem_cache *, void *);
+static void *slab_obj (struct kmem_cache *, struct slab *, size_t idx);
+
+/* Creates and returns a cache named NAME for objects of SIZE
+   bytes aligned to ALIGN bytes, which must be a power of two, or
+   0 for pointer alignment.  If CTOR is nonnull, it is called on
+   each object once, when the object's slab is created.  Returns
+   a null pointer if memory is not available. */
+struct kmem_cache *
+kmem_cache_create (const char *name, size_t size, size_t align,
+		kmem_ctor_func *ctor) {
+	struct kmem_cache *c;
+	enum intr_level old_level;
+	bool first = false;
+	size_t n;
+
+	ASSERT (name != NULL);
+	ASSERT (size > 0);
+	if (align == 0)
+		align = sizeof (void *);
+	ASSERT ((align & (align - 1)) == 0);
+
+	c = malloc (sizeof *c);
+	if (c == NULL)
+		return NULL;
+	strlcpy (c->name, name, sizeof c->name);
+	lock_init_named (&c->lock, c->name);
+	c->obj_size = size;
+	c->stride = ROUND_UP (size, align);
+	c->ctor = ctor;
+	list_init (&c->partial_slabs);
+	list_init (&c->full_slabs);
+	list_init (&c->empty_slabs);
+	c->slab_cnt = c->active_cnt = c->peak_cnt = 0;
+	c->alloc_cnt = c->free_cnt = 0;
+
+	/* Fit as many objects as possible, with their free-list
+	   links, after the header. */
+	n = (PGSIZE - sizeof (struct slab)) / (c->stride + sizeof (uint16_t));
+	while (n > 0 && ROUND_UP (sizeof (struct slab) + n * sizeof (uint16_t),
+				align) + n * c->stride > PGSIZE)
+		n--;
+	ASSERT (n > 0 && n < SLAB_END);
+	c->objs_per_slab = n;
+	c->first_ofs = ROUND_UP (sizeof (struct slab) + n * sizeof (uint16_t),
+			align);
+
+	old_level = intr_disable ();
+	if (!caches_initialized) {
+		list_init (&caches);
+		caches_initialized = true;
+		first = true;
+	}
+	list_push_back (&caches, &c->elem);
+	intr_set_level (old_level);
+
+	if (first)
+		shrinker_register (&slab_shrinker);
+	return c;
+}
+
+/* Destroys cache C, all of whose objects must have been freed. */
+void
+kmem_cache_destroy (struct kmem_cache *c) {
+	enum intr_level old_level;
+
+	if (c == NULL)
+		return;
+
+	ASSERT (c->active_cnt == 0);
+	ASSERT (list_empty (&c->partial_slabs));
+	ASSERT (list_empty (&c->full_slabs));
+	while (!list_empty (&c->empty_slabs))
+		palloc_free_page (list_entry (list_pop_front (&c->empty_slabs),
+					struct slab, elem));
+
+	old_level = intr_disable ();
+	list_remove (&c->elem);
+	intr_set_level (old_level);
+	free (c);
+}
+
+/* Obtains and returns an object from cache C.
+   Returns a null pointer if memory is not available. */
+void *
+kmem_cache_alloc (struct kmem_cache *c) {
+	struct slab *s;
+	size_t idx;
+
+	ASSERT (c != NULL);
+
+	lock_acquire (&c->lock);
+	if (list_empty (&c->partial_slabs)) {
+		if (!list_empty (&c->empty_slabs))
+			s = list_entry (list_pop_front (&c->empty_slabs), struct slab, elem);
+		else {
+			s = slab_create (c);
+			if (s == NULL) {
+				lock_release (&c->lock);
+				return NULL;
+			}
+		}
+		list_push_front (&c->partial_slabs, &s->elem);
+	}
+
+	s = list_entry (list_front (&c->partial_slabs), struct slab, elem);
+	ASSERT (s->free_cnt > 0);
+	idx = s->free_head;
+	s->free_head = s->next[idx];
+	if (--s->free_cnt == 0) {
+		list_remove (&s->elem);
+		list_push_front (&c->full_slabs, &s->elem);
+	}
+
+	c->alloc_cnt++;
+	if (++c->active_cnt > c->peak_cnt)
+		c->peak_cnt = c->active_cnt;
+	lock_release (&c->lock);
+	return slab_obj (c, s, idx);
+}
+
+/* Returns OBJ, which must have been obtained from
+   kmem_cache_alloc(C), to cache C. */
+void
+kmem_cache_free (struct kmem_cache *c, void *obj) {
+	struct slab *s;
+	size_t idx;
+
+	if (obj == NULL)
+		return;
+
+	s = obj_to_slab (c, obj);
+	idx = ((uint8_t *) obj - (uint8_t *) s - c->first_ofs) / c->stride;
+
+#ifndef NDEBUG
+	/* Clear the object to help detect use-after-free bugs, unless
+	   it must stay constructed. */
+	if (c->ctor == NULL)
+		memset (obj, 0xcc, c->obj_size);
+#endif
+
+	lock_acquire (&c->lock);
+	s->next[idx] = s->free_head;
+	s->free_head = idx;
+	s->free_cnt++;
+	if (s->free_cnt == c->objs_per_slab) {
+		/* Keep one empty slab, give back the rest. */
+		list_remove (&s->elem);
+		if (list_empty (&c->empty_slabs))
+			list_push_front (&c->empty_slabs, &s->elem);
+		else {
+			palloc_free_page (s);
+			c->slab_cnt--;
+		}
+	} else if (s->free_cnt == 1) {
+		list_remove (&s->elem);
+		list_push_front (&c->partial_slabs, &s->elem);
+	}
+
+	c->free_cnt++;
+	c->active_cnt--;
+	lock_release (&c->lock);
+}
+
+/* Prints statistics for each cache that has been used. */
+void
+kmem_cache_print_stats (void) {
+	struct list_elem *e;
+	bool header = false;
+
+	if (!caches_initialized)
+		return;
+
+	for (e = list_begin (&caches); e != list_end (&caches); e = list_next (e)) {
+		struct kmem_cache *c = list_entry (e, struct kmem_cache, elem);
+
+		if (c->alloc_cnt == 0)
+			continue;
+		if (!header) {
+			printf ("Slab: %-16s %6s %8s %8s %6s %10s %10s\n", "cache", "size",
+					"active", "peak", "slabs", "allocs", "frees");
+			header = true;
+		}
+		printf ("Slab: %-16s %6zu %8zu %8zu %6zu %10llu %10llu\n", c->name,
+				c->obj_size, c->active_cnt, c->peak_cnt, c->slab_cnt,
+				c->alloc_cnt, c->free_cnt);
+	}
+}
+
+/* Returns the number of empty slabs that the caches keep,
+   skipping caches whose locks are taken, as slab_shrink_scan()
+   would. */
+static size_t
+slab_shrink_count (struct shrinker *s UNUSED) {
+	enum intr_level old_level = intr_disable ();
+	struct list_elem *e;
+	size_t cnt = 0;
+
+	for (e = list_begin (&caches); e != list_end (&caches); e = list_next (e)) {
+		struct kmem_cache *c = list_entry (e, struct kmem_cache, elem);
+
+		if (lock_held_by_current_thread (&c->lock)
+				|| !lock_try_acquire (&c->lock))
+			continue;
+		cnt += list_size (&c->empty_slabs);
+		lock_release (&c->lock);
+	}
+	intr_set_level (old_level);
+	return cnt;
+}
+
+/* Frees up to PAGE_CNT of the empty slabs that the caches keep,
+   skipping caches whose locks are taken.  Interrupts stay off
+   while walking CACHES, and the slabs are freed after. */
+static size_t
+slab_shrink_scan (struct shrinker *s UNUSED, size_t page_cnt) {
+	struct list victims;
+	struct list_elem *e;
+	enum intr_level old_level;
+	size_t cnt = 0;
+
+	list_init (&victims);
+	old_level = intr_disable ();
+	for (e = list_begin (&caches); e != list_end (&caches) && cnt < page_cnt;
+			e = list_next (e)) {
+		struct kmem_cache *c = list_entry (e, struct kmem_cache, elem);
+
+		if (lock_held_by_current_thread (&c->lock)
+				|| !lock_try_acquire (&c->lock))
+			continue;
+		while (!list_empty (&c->empty_slabs) && cnt < page_cnt) {
+			list_push_back (&victims, list_pop_front (&c->empty_slabs));
+			c->slab_cnt--;
+			cnt++;
+		}
+		lock_release (&c->lock);
+	}
+	intr_set_level (old_level);
+
+	while (!list_empty (&victims))
+		palloc_free_page (list_entry (list_pop_front (&victims),
+					struct slab, elem));
+	return cnt;
+}
+
+static struct shrinker slab_shrinker = {
+	.count = slab_shrink_count,
+	.scan = slab_shrink_scan,
+	.name = "slab",
+};
+
+/* Allocates and initializes a new slab for cache C, which must
+   be locked.  Returns a null pointer if memory is not
+   available. */
+static struct slab *
+slab_create (struct kmem_cache *c) {
+	struct slab *s;
+	size_t i;
+
+	ASSERT (lock_held_by_current_thread (&c->lock));
+
+	s = palloc_get_page (0);
+	if (s == NULL)
+		return NULL;
+
+	s->magic = SLAB_MAGIC;
+	s->cache = c;
+	s->free_cnt = c->objs_per_slab;
+	s->free_head = 0;
+	for (i = 0; i < c->objs_per_slab; i++) {
+		s->next[i] = i + 1 < c->objs_per_slab ? i + 1 : SLAB_END;
+		if (c->ctor != NULL)
+			c->ctor (slab_obj (c, s, i));
+	}
+	c->slab_cnt++;
+	return s;
+}
+
+/* Returns the slab that OBJ, an object of cache C, is inside. */
+static struct slab *
+obj_to_slab (struct kmem_cache *c, void *obj) {
+	struct slab *s = pg_round_down (obj);
+
+	/* Check that the slab is valid. */
+	ASSERT (s->magic == SLAB_MAGIC);
+	ASSERT (s->cache == c);
+
+	/* Check that the object is properly aligned for the slab. */
+	ASSERT (pg_ofs (obj) >= c->first_ofs);
+	ASSERT ((pg_ofs (obj) - c->first_ofs) % c->stride == 0);
+
+	return s;
+}
+
+/* Returns the IDX'th object within slab S of cache C. */
+static void *
+slab_obj (struct kmem_cache *c, struct slab *s, size_t idx) {
+	ASSERT (idx < c->objs_per_slab);
+	return (uint8_t *) s + c->first_ofs + idx * c->stride;
+}
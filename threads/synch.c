@@ -30,7 +30,36 @@
 #include <stdio.h>
 #include <string.h>
 #include "threads/interrupt.h"
+#include "devices/timer.h"
 #include "threads/thread.h"
+#include "intrinsic.h"
+
+/* Lock profiling.
+   Semaphores and locks initialized with a name are linked into
+   NAMED_SYNCS.  Once lock_profile_start() has been called, each
+   down or acquire of a named object updates its `struct
+   sync_stats', and power_off() prints the PROFILE_TOP_CNT most
+   contended ones.  The statistics come from a fixed pool, so
+   that unnamed objects pay only for a null pointer and early
+   boot code can name its locks before malloc() works; once the
+   pool runs out, further names are ignored.  Named objects must
+   never be freed (in practice, they are static or live inside
+   static structures). */
+#define NAMED_MAX 128
+static struct sync_stats named_pool[NAMED_MAX];
+static size_t named_cnt;
+static struct list named_syncs;
+static bool named_syncs_initialized;
+static bool lock_profiling;
+static size_t profile_top_cnt;
+
+static struct sync_stats *register_named (const char *name);
+
+/* Returns true if statistics should be recorded for STATS. */
+static inline bool
+is_profiled (const struct sync_stats *stats) {
+	return lock_profiling && stats != NULL;
+}
 
 /* Initializes semaphore SEMA to VALUE.  A semaphore is a
    nonnegative integer along with two atomic operators for
@@ -47,6 +76,63 @@ sema_init (struct semaphore *sema, unsigned value) {
 
 	sema->value = value;
 	list_init (&sema->waiters);
+	sema->stats = NULL;
+}
+
+/* Initializes semaphore SEMA to VALUE, like sema_init(), and
+   records contention statistics for it under NAME while lock
+   profiling is on.  SEMA must never be freed. */
+void
+sema_init_named (struct semaphore *sema, unsigned value, const char *name) {
+	ASSERT (name != NULL);
+
+	sema_init (sema, value);
+	sema->stats = register_named (name);
+}
+
+/* Waits for SEMA's value to become positive and then
+   decrements it, giving up at timer tick DEADLINE.  A DEADLINE of
+   INT64_MAX means to wait forever.  Returns true if SEMA was
+   decremented, false if the deadline passed first. */
+static bool
+sema_down_until (struct semaphore *sema, int64_t deadline) {
+	enum intr_level old_level;
+	uint64_t wait_start = 0;
+	bool success = true;
+
+	ASSERT (sema != NULL);
+	ASSERT (!intr_context ());
+
+	old_level = intr_disable ();
+	if (is_profiled (sema->stats)) {
+		sema->stats->acquire_cnt++;
+		if (sema->value == 0) {
+			sema->stats->contend_cnt++;
+			wait_start = rdtsc ();
+		}
+	}
+	while (sema->value == 0) {
+		if (deadline != INT64_MAX && timer_ticks () >= deadline) {
+			success = false;
+			break;
+		}
+		list_push_back (&sema->waiters, &thread_current ()->elem);
+		if (deadline == INT64_MAX)
+			thread_block ();
+		else
+			thread_block_timeout (deadline);
+	}
+	if (success)
+		sema->value--;
+	if (wait_start != 0) {
+		uint64_t wait = rdtsc () - wait_start;
+
+		sema->stats->wait_total += wait;
+		if (wait > sema->stats->wait_max)
+			sema->stats->wait_max = wait;
+	}
+	intr_set_level (old_level);
+	return success;
 }
 
 /* Down or "P" operation on a semaphore.  Waits for SEMA's value
@@ -59,18 +145,23 @@ sema_init (struct semaphore *sema, unsigned value) {
    sema_down function. */
 void
 sema_down (struct semaphore *sema) {
-	enum intr_level old_level;
+	sema_down_until (sema, INT64_MAX);
+}
 
-	ASSERT (sema != NULL);
-	ASSERT (!intr_context ());
+/* Down or "P" operation on a semaphore, giving up after TICKS
+   timer ticks.  Returns true if SEMA was decremented, false if
+   the timeout expired first.  A TICKS of zero or less behaves
+   like sema_try_down().
 
-	old_level = intr_disable ();
-	while (sema->value == 0) {
-		list_push_back (&sema->waiters, &thread_current ()->elem);
-		thread_block ();
-	}
-	sema->value--;
-	intr_set_level (old_level);
+   The thread waits on SEMA and on the timer at once and is woken
+   by whichever comes first, so no polling is involved.  Like
+   sema_down(), this function may sleep, so it must not be
+   called within an interrupt handler. */
+bool
+sema_down_timeout (struct semaphore *sema, int64_t ticks) {
+	if (ticks <= 0)
+		return sema_try_down (sema);
+	return sema_down_until (sema, timer_ticks () + ticks);
 }
 
 /* Down or "P" operation on a semaphore, but only if the
@@ -89,6 +180,8 @@ sema_try_down (struct semaphore *sema) {
 	if (sema->value > 0)
 	{
 		sema->value--;
+		if (is_profiled (sema->stats))
+			sema->stats->acquire_cnt++;
 		success = true;
 	}
 	else
@@ -171,9 +264,21 @@ lock_init (struct lock *lock) {
 	ASSERT (lock != NULL);
 
 	lock->holder = NULL;
+	lock->hold_start = 0;
 	sema_init (&lock->semaphore, 1);
 }
 
+/* Initializes LOCK, like lock_init(), and records contention
+   statistics for it under NAME while lock profiling is on.  LOCK
+   must never be freed. */
+void
+lock_init_named (struct lock *lock, const char *name) {
+	ASSERT (name != NULL);
+
+	lock_init (lock);
+	lock->semaphore.stats = register_named (name);
+}
+
 /* Acquires LOCK, sleeping until it becomes available if
    necessary.  The lock must not already be held by the current
    thread.
@@ -190,6 +295,28 @@ lock_acquire (struct lock *lock) {
 
 	sema_down (&lock->semaphore);
 	lock->holder = thread_current ();
+	if (is_profiled (lock->semaphore.stats))
+		lock->hold_start = rdtsc ();
+}
+
+/* Acquires LOCK like lock_acquire(), but gives up after TICKS
+   timer ticks.  Returns true if LOCK was acquired, false if the
+   timeout expired first.
+
+   This function may sleep, so it must not be called within an
+   interrupt handler. */
+bool
+lock_acquire_timeout (struct lock *lock, int64_t ticks) {
+	ASSERT (lock != NULL);
+	ASSERT (!intr_context ());
+	ASSERT (!lock_held_by_current_thread (lock));
+
+	if (!sema_down_timeout (&lock->semaphore, ticks))
+		return false;
+	lock->holder = thread_current ();
+	if (is_profiled (lock->semaphore.stats))
+		lock->hold_start = rdtsc ();
+	return true;
 }
 
 /* Tries to acquires LOCK and returns true if successful or false
@@ -206,8 +333,11 @@ lock_try_acquire (struct lock *lock) {
 	ASSERT (!lock_held_by_current_thread (lock));
 
 	success = sema_try_down (&lock->semaphore);
-	if (success)
+	if (success) {
 		lock->holder = thread_current ();
+		if (is_profiled (lock->semaphore.stats))
+			lock->hold_start = rdtsc ();
+	}
 	return success;
 }
 
@@ -222,6 +352,14 @@ lock_release (struct lock *lock) {
 	ASSERT (lock != NULL);
 	ASSERT (lock_held_by_current_thread (lock));
 
+	if (is_profiled (lock->semaphore.stats) && lock->hold_start != 0) {
+		struct sync_stats *stats = lock->semaphore.stats;
+		uint64_t hold = rdtsc () - lock->hold_start;
+
+		if (hold > stats->hold_max)
+			stats->hold_max = hold;
+	}
+	lock->hold_start = 0;
 	lock->holder = NULL;
 	sema_up (&lock->semaphore);
 }
@@ -288,6 +426,41 @@ cond_wait (struct condition *cond, struct lock *lock) {
 	lock_acquire (lock);
 }
 
+/* Like cond_wait(), but stops waiting for COND after TICKS
+   timer ticks.  LOCK is reacquired before returning in either
+   case.  Returns true if COND was signaled, false if the timeout
+   expired first.
+
+   This function may sleep, so it must not be called within an
+   interrupt handler. */
+bool
+cond_timedwait (struct condition *cond, struct lock *lock, int64_t ticks) {
+	struct semaphore_elem waiter;
+	bool signaled;
+
+	ASSERT (cond != NULL);
+	ASSERT (lock != NULL);
+	ASSERT (!intr_context ());
+	ASSERT (lock_held_by_current_thread (lock));
+
+	sema_init (&waiter.semaphore, 0);
+	list_push_back (&cond->waiters, &waiter.elem);
+	lock_release (lock);
+	signaled = sema_down_timeout (&waiter.semaphore, ticks);
+	lock_acquire (lock);
+
+	/* A signal may have arrived between the timeout and
+	   reacquiring LOCK.  cond_signal() takes WAITER off the list
+	   and ups its semaphore atomically under LOCK, so either we
+	   can still consume that signal or WAITER is still listed. */
+	if (!signaled) {
+		signaled = sema_try_down (&waiter.semaphore);
+		if (!signaled)
+			list_remove (&waiter.elem);
+	}
+	return signaled;
+}
+
 /* If any threads are waiting on COND (protected by LOCK), then
    this function signals one of them to wake up from its wait.
    LOCK must be held before calling this function.
@@ -321,3 +494,77 @@ cond_broadcast (struct condition *cond, struct lock *lock) {
 	while (!list_empty (&cond->waiters))
 		cond_signal (cond, lock);
 }
+
+/* Takes statistics for an object named NAME from the pool and
+   adds them to the list of named objects.  Returns them, or a
+   null pointer if the pool is used up. */
+static struct sync_stats *
+register_named (const char *name) {
+	enum intr_level old_level = intr_disable ();
+	struct sync_stats *stats = NULL;
+
+	if (!named_syncs_initialized) {
+		list_init (&named_syncs);
+		named_syncs_initialized = true;
+	}
+	if (named_cnt < NAMED_MAX) {
+		stats = &named_pool[named_cnt++];
+		stats->name = name;
+		list_push_back (&named_syncs, &stats->elem);
+	}
+	intr_set_level (old_level);
+	return stats;
+}
+
+/* Starts recording contention statistics for every named
+   semaphore and lock, and arranges for lock_print_stats() to
+   report the TOP_CNT most contended ones at power off. */
+void
+lock_profile_start (size_t top_cnt) {
+	profile_top_cnt = top_cnt;
+	lock_profiling = true;
+}
+
+/* Orders sync_stats by decreasing contention count, breaking
+   ties by total wait time. */
+static bool
+more_contended (const struct list_elem *a_, const struct list_elem *b_,
+		void *aux UNUSED) {
+	const struct sync_stats *a = list_entry (a_, struct sync_stats, elem);
+	const struct sync_stats *b = list_entry (b_, struct sync_stats, elem);
+
+	if (a->contend_cnt != b->contend_cnt)
+		return a->contend_cnt > b->contend_cnt;
+	return a->wait_total > b->wait_total;
+}
+
+/* Prints the most contended named semaphores and locks, if lock
+   profiling was started.  Wait and hold times are in CPU
+   cycles. */
+void
+lock_print_stats (void) {
+	struct list_elem *e;
+	size_t i;
+
+	if (!lock_profiling)
+		return;
+
+	/* Stop recording, so that printing (which takes the console
+	   lock) does not perturb the numbers being printed. */
+	lock_profiling = false;
+	if (!named_syncs_initialized)
+		return;
+	list_sort (&named_syncs, more_contended, NULL);
+
+	printf ("Locks: top %zu contended\n", profile_top_cnt);
+	printf ("%-16s %10s %10s %14s %14s %14s\n", "name", "acquires",
+			"contended", "wait total", "wait max", "hold max");
+	for (e = list_begin (&named_syncs), i = 0;
+			e != list_end (&named_syncs) && i < profile_top_cnt;
+			e = list_next (e), i++) {
+		struct sync_stats *s = list_entry (e, struct sync_stats, elem);
+		printf ("%-16s %10llu %10llu %14llu %14llu %14llu\n", s->name,
+				s->acquire_cnt, s->contend_cnt, s->wait_total,
+				s->wait_max, s->hold_max);
+	}
+}
@@ -3,7 +3,13 @@ threads_SRC += threads/thread.c		# Thread management core.
 threads_SRC += threads/interrupt.c	# Interrupt core.
 threads_SRC += threads/intr-stubs.S	# Interrupt stubs.
 threads_SRC += threads/synch.c		# Synchronization.
+threads_SRC += threads/rcu.c		# Read-copy-update.
 threads_SRC += threads/palloc.c		# Page allocator.
 threads_SRC += threads/malloc.c		# Subpage allocator.
+threads_SRC += threads/slab.c		# Object caches.
+threads_SRC += threads/heapprof.c	# Heap profiler.
+threads_SRC += threads/vmalloc.c	# Virtually contiguous allocator.
+threads_SRC += threads/shrinker.c	# Memory-pressure callbacks.
+threads_SRC += threads/ksm.c		# Same-page merging.
 threads_SRC += threads/start.S		# Startup code.
 threads_SRC += threads/mmu.c		    # Memory management unit related things.
@@ -7,7 +7,9 @@
 #include "threads/flags.h"
 #include "threads/interrupt.h"
 #include "threads/intr-stubs.h"
+#include "threads/malloc.h"
 #include "threads/palloc.h"
+#include "threads/rcu.h"
 #include "threads/synch.h"
 #include "threads/vaddr.h"
 #include "intrinsic.h"
@@ -88,8 +90,20 @@ static uint64_t gdt[3] = { 0, 0x00af9a000000ffff, 0x00cf92000000ffff };
 /*** list_less_func parameter in list_insert_ordered() function. ***/
 static bool timer_comparator (const struct list_elem *x, 
 const struct list_elem *y, void *aux UNUSED) {
-	return list_entry(x, struct thread, elem) -> alarm <= 
-			list_entry(y, struct thread, elem) -> alarm;
+	return list_entry(x, struct thread, sleep_elem) -> alarm <= 
+			list_entry(y, struct thread, sleep_elem) -> alarm;
+}
+
+/*** Put the current thread into sleep_list until tick TICKS.
+	 Interrupts must be off. ***/
+static void
+sleep_until (int64_t ticks) {
+	struct thread *sleeper = thread_current ();
+
+	ASSERT (intr_get_level () == INTR_OFF);
+	sleeper -> alarm = ticks;
+	earliest_time(sleeper -> alarm);
+	list_insert_ordered(&sleep_list, &sleeper -> sleep_elem, timer_comparator, NULL);
 }
 
 /*** Sleep thread : save interrupt history -> update wake-up time 
@@ -98,36 +112,64 @@ const struct list_elem *y, void *aux UNUSED) {
 void
 thread_sleep (int64_t ticks) {
 	
-	struct thread *sleeper = thread_current();
 	enum intr_level old_level;
 	old_level = intr_disable();
 
-	sleeper -> alarm = ticks;
-	earliest_time(sleeper -> alarm);
-	list_insert_ordered(&sleep_list, &sleeper -> elem, timer_comparator, NULL);
+	sleep_until (ticks);
 	thread_block();
 	
 	intr_set_level(old_level);
 }
 
+/* Blocks the current thread, like thread_block(), but also
+   arranges for it to be woken at timer tick TICKS if nothing
+   else wakes it first.  The caller must already have put the
+   thread's `elem' on a wait list (such as a semaphore's
+   waiters); on timeout it is removed from that list, so the
+   thread is only ever woken once.
+
+   Returns true if the thread was woken by thread_unblock()
+   before the deadline, false if the deadline passed.  Must be
+   called with interrupts turned off. */
+bool
+thread_block_timeout (int64_t ticks) {
+	struct thread *t = thread_current ();
+
+	ASSERT (!intr_context ());
+	ASSERT (intr_get_level () == INTR_OFF);
+
+	t->timed_wait = true;
+	t->timed_out = false;
+	sleep_until (ticks);
+	thread_block ();
+	return !t->timed_out;
+}
+
 /*** Waking up sleeping thread. ***/
 void
 thread_wakeup (int64_t ticks) {
 	
-	if (list_empty(&sleep_list)) {
-		earliest_wake_up_tick = INT64_MAX;
-	}
-	else {
-		/*** Wake up every threads which have to wake up using while loop. ***/
-		while (ticks >= earliest_wake_up_tick) {
-			struct thread *thread = list_entry(list_begin(&sleep_list), struct thread, elem);
-			list_pop_front(&sleep_list);
-			thread_unblock(thread);
-			earliest_wake_up_tick = list_entry(list_begin(&sleep_list), struct thread, elem) -> alarm;
+	if (ticks < earliest_wake_up_tick)
+		return;
+
+	/*** Wake up every threads which have to wake up using while loop. ***/
+	while (!list_empty(&sleep_list)) {
+		struct thread *thread = list_entry(list_front(&sleep_list), struct thread, sleep_elem);
+		if (thread -> alarm > ticks)
+			break;
+		list_pop_front(&sleep_list);
+
+		/*** A timed wait expired: take the thread off its wait list. ***/
+		if (thread -> timed_wait) {
+			list_remove(&thread -> elem);
+			thread -> timed_wait = false;
+			thread -> timed_out = true;
 		}
-
+		thread_unblock(thread);
 	}
-	
+
+	earliest_wake_up_tick = list_empty(&sleep_list) ? INT64_MAX
+		: list_entry(list_front(&sleep_list), struct thread, sleep_elem) -> alarm;
 }
 
 
@@ -166,7 +208,7 @@ thread_init (void) {
 	lgdt (&gdt_ds);
 
 	/* Init the globla thread context */
-	lock_init (&tid_lock);
+	lock_init_named (&tid_lock, "tid");
 	list_init (&ready_list);
 	list_init (&destruction_req);
 
@@ -212,11 +254,20 @@ thread_tick (void) {
 	else
 		kernel_ticks++;
 
-	/* Enforce preemption. */
-	if (++thread_ticks >= TIME_SLICE)
+	/* Enforce preemption.  A thread inside an RCU read-side
+	   critical section is not preempted; rcu_read_unlock() yields
+	   on its behalf instead. */
+	if (++thread_ticks >= TIME_SLICE && t->rcu_nesting == 0)
 		intr_yield_on_return ();
 }
 
+/* Returns true if the running thread has used up its time
+   slice. */
+bool
+thread_slice_expired (void) {
+	return thread_ticks >= TIME_SLICE;
+}
+
 /* Prints thread statistics. */
 void
 thread_print_stats (void) {
@@ -303,6 +354,12 @@ thread_unblock (struct thread *t) {
 
 	old_level = intr_disable ();
 	ASSERT (t->status == THREAD_BLOCKED);
+
+	/* Woken before the deadline of a timed wait: cancel it. */
+	if (t->timed_wait) {
+		list_remove (&t->sleep_elem);
+		t->timed_wait = false;
+	}
 	list_push_back (&ready_list, &t->elem);
 	t->status = THREAD_READY;
 	intr_set_level (old_level);
@@ -347,6 +404,7 @@ thread_exit (void) {
 #ifdef USERPROG
 	process_cleanup ();
 #endif
+	malloc_thread_exit ();
 
 	/* Just set our status to dying and schedule another process.
 	   We will be destroyed during the call to schedule_tail(). */
@@ -415,10 +473,11 @@ thread_get_recent_cpu (void) {
    The idle thread is initially put on the ready list by
    thread_start().  It will be scheduled once initially, at which
    point it initializes idle_thread, "up"s the semaphore passed
-   to it to enable thread_start() to continue, and immediately
-   blocks.  After that, the idle thread never appears in the
-   ready list.  It is returned by next_thread_to_run() as a
-   special case when the ready list is empty. */
+   to it to enable thread_start() to continue, and blocks.  After
+   that, the idle thread never appears in the ready list.  It is
+   returned by next_thread_to_run() as a special case when the
+   ready list is empty.  Each time it runs, it clears free pages
+   for later PAL_ZERO requests before blocking again. */
 static void
 idle (void *idle_started_ UNUSED) {
 	struct semaphore *idle_started = idle_started_;
@@ -427,6 +486,9 @@ idle (void *idle_started_ UNUSED) {
 	sema_up (idle_started);
 
 	for (;;) {
+		/* Use the spare time to clear free pages. */
+		palloc_zero_idle ();
+
 		/* Let someone else run. */
 		intr_disable ();
 		thread_block ();
@@ -609,6 +671,7 @@ schedule (void) {
 	ASSERT (intr_get_level () == INTR_OFF);
 	ASSERT (curr->status != THREAD_RUNNING);
 	ASSERT (is_thread (next));
+	rcu_note_context_switch (curr);
 	/* Mark us as running. */
 	next->status = THREAD_RUNNING;
 
@@ -0,0 +1,176 @@
+#include "threads/vmalloc.h"
+#include <debug.h>
+#include <list.h>
+#include <round.h>
+#include "threads/init.h"
+#include "threads/malloc.h"
+#include "threads/mmu.h"
+#include "threads/palloc.h"
+#include "threads/synch.h"
+#include "threads/vaddr.h"
+
+/* Virtual area allocator.
+
+   The areas in use are kept on a list sorted by address, and a
+   new area goes in the first gap that is large enough (first
+   fit).  Each area is followed by an unmapped guard page, so
+   that running off the end of one faults instead of corrupting
+   the next.
+
+   The range's page directory is created by vmalloc_init() in
+   base_pml4, under the PDPT that the direct map already uses, so
+   it is reachable from every pml4, including those created
+   before a page was mapped.  Page tables below it are allocated
+   as needed and kept.
+
+   Unmapping must flush the TLB in every address space, which is
+   expensive with PCIDs, so vfree() clears all of an area's
+   mappings and flushes once.  The area's frames and addresses are
+   only reused after that flush. */
+
+/* A mapped area. */
+struct vm_area {
+	struct list_elem elem;      /* Element in `areas'. */
+	uint8_t *addr;              /* First page. */
+	size_t page_cnt;            /* Pages mapped, excluding guard. */
+};
+
+static struct list areas;       /* Areas in use, sorted by address. */
+static struct lock areas_lock;  /* Protects AREAS. */
+
+static uint8_t *reserve (struct vm_area *);
+static void unmap_area (struct vm_area *);
+
+/* Creates the page directory for the vmalloc() range.  Must be
+   called after paging_init(). */
+void
+vmalloc_init (void) {
+	ASSERT (base_pml4[PML4 ((uint64_t) VMALLOC_START)] & PTE_P);
+	ASSERT (PML4 ((uint64_t) VMALLOC_START)
+			== PML4 ((uint64_t) VMALLOC_END - 1));
+
+	/* Creates the page directory, and one page table. */
+	if (pml4e_walk (base_pml4, (uint64_t) VMALLOC_START, 1) == NULL)
+		PANIC ("vmalloc_init: out of memory");
+
+	list_init (&areas);
+	lock_init_named (&areas_lock, "vmalloc");
+}
+
+/* Obtains and returns a block of at least SIZE bytes that is
+   contiguous in kernel virtual memory but not necessarily in
+   physical memory, starting at a page boundary.  Returns a null
+   pointer if memory or address space is not available. */
+void *
+vmalloc (size_t size) {
+	struct vm_area *a;
+	size_t i;
+
+	if (size == 0)
+		return NULL;
+
+	a = malloc (sizeof *a);
+	if (a == NULL)
+		return NULL;
+	a->page_cnt = DIV_ROUND_UP (size, PGSIZE);
+	if (reserve (a) == NULL) {
+		free (a);
+		return NULL;
+	}
+
+	for (i = 0; i < a->page_cnt; i++) {
+		void *kpage = palloc_get_page (0);
+
+		if (kpage == NULL || !kernel_map_page (a->addr + i * PGSIZE, kpage)) {
+			palloc_free_page (kpage);
+			vfree (a->addr);
+			return NULL;
+		}
+	}
+	return a->addr;
+}
+
+/* Frees block P, which must have been allocated with vmalloc(). */
+void
+vfree (void *p) {
+	struct list_elem *e;
+	struct vm_area *a = NULL;
+
+	if (p == NULL)
+		return;
+	ASSERT (is_vmalloc_vaddr (p));
+
+	lock_acquire (&areas_lock);
+	for (e = list_begin (&areas); e != list_end (&areas); e = list_next (e)) {
+		a = list_entry (e, struct vm_area, elem);
+		if (a->addr == p)
+			break;
+	}
+	lock_release (&areas_lock);
+	ASSERT (e != list_end (&areas));
+
+	/* The area stays on AREAS, so its addresses cannot be handed
+	   out again, until the TLB no longer maps them. */
+	unmap_area (a);
+
+	lock_acquire (&areas_lock);
+	list_remove (&a->elem);
+	lock_release (&areas_lock);
+	free (a);
+}
+
+/* Finds address space for area A, which has its PAGE_CNT set,
+   adds A to AREAS, and sets and returns its ADDR.  Returns a null
+   pointer if the range has no large enough gap. */
+static uint8_t *
+reserve (struct vm_area *a) {
+	struct list_elem *e;
+	uint8_t *addr = VMALLOC_START;
+	size_t size = (a->page_cnt + 1) * PGSIZE;
+
+	if (a->page_cnt >= (size_t) (VMALLOC_END - VMALLOC_START) / PGSIZE)
+		return NULL;
+
+	lock_acquire (&areas_lock);
+	for (e = list_begin (&areas); e != list_end (&areas); e = list_next (e)) {
+		struct vm_area *b = list_entry (e, struct vm_area, elem);
+
+		if ((size_t) (b->addr - addr) >= size)
+			break;
+		addr = b->addr + (b->page_cnt + 1) * PGSIZE;
+	}
+	if ((size_t) (VMALLOC_END - addr) < size)
+		addr = NULL;
+	else {
+		a->addr = addr;
+		list_insert (e, &a->elem);
+	}
+	lock_release (&areas_lock);
+	return addr;
+}
+
+/* Unmaps the pages of area A, flushes the TLB, and frees the
+   frames that were mapped.  Pages of A need not be mapped. */
+static void
+unmap_area (struct vm_area *a) {
+	void *frames = NULL;
+	size_t i;
+
+	/* Chain the frames through their first words, which are still
+	   reachable through the direct map. */
+	for (i = 0; i < a->page_cnt; i++) {
+		void **kpage = kernel_clear_page (a->addr + i * PGSIZE);
+
+		if (kpage != NULL) {
+			*kpage = frames;
+			frames = kpage;
+		}
+	}
+	kernel_tlb_flush (a->addr, a->page_cnt);
+
+	while (frames != NULL) {
+		void *next = *(void **) frames;
+		palloc_free_page (frames);
+		frames = next;
+	}
+}
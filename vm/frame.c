@@ -0,0 +1,167 @@
+#include "vm/frame.h"
+#include <debug.h>
+#include <list.h>
+#include <stdio.h>
+#include <string.h>
+#include "threads/mmu.h"
+#include "threads/palloc.h"
+#include "threads/vaddr.h"
+#include "vm/swap.h"
+#include "vm/vm.h"
+
+/* The frame table: every frame that holds a user page, linked
+   through the LRU element of its struct page, whose MAPPING is
+   the struct vm_entry of the page it holds.
+
+   When the user pool runs dry, frame_alloc() takes a frame from
+   some page with the clock algorithm.  The hand sweeps the table,
+   clearing each page's accessed bit and passing over the pages
+   that had it set; the first page found with it clear is
+   evicted.  A clean file page is simply dropped, since it can be
+   read again; any other page is written to swap.
+
+   A frame shared by several entries after fork is owned, in the
+   table, by one of them, and is passed on to another sharer when
+   that one lets go of it. */
+
+struct lock frame_lock;
+
+static struct list frames;          /* Frame table. */
+static struct list_elem *hand;      /* Next frame to examine. */
+static size_t frame_cnt;            /* Frames in the table. */
+static size_t evict_cnt;            /* Pages evicted. */
+
+/* Initializes the frame table. */
+void
+frame_init (void) {
+	lock_init_named (&frame_lock, "frame");
+	list_init (&frames);
+	hand = list_end (&frames);
+}
+
+/* Moves the clock hand past E, wrapping around. */
+static struct list_elem *
+advance (struct list_elem *e) {
+	e = list_next (e);
+	return e != list_end (&frames) ? e : list_begin (&frames);
+}
+
+/* Evicts a page chosen by the clock algorithm and returns its
+   frame, taken out of the frame table.  Returns a null pointer
+   if there is no page to evict or swap is full. */
+static void *
+evict (void) {
+	size_t i;
+
+	if (hand == list_end (&frames))
+		hand = list_begin (&frames);
+
+	/* Two sweeps clear every accessed bit, so if a page can be
+	   evicted at all, one will be. */
+	for (i = 0; i < 2 * frame_cnt; i++, hand = advance (hand)) {
+		struct page *page = list_entry (hand, struct page, lru);
+		struct vm_entry *e = page->mapping;
+		void *kpage = page_to_kva (page);
+		bool dirty;
+
+		/* Still being loaded, or shared copy-on-write. */
+		if (e->kpage != kpage || page->refcnt > 1)
+			continue;
+
+		if (pml4_is_accessed (e->pml4, e->upage)) {
+			pml4_set_accessed (e->pml4, e->upage, false);
+			continue;
+		}
+
+		/* Unmap first, so that the page cannot change while it is
+		   being written, and no write can slip in after its dirty
+		   bit is read. */
+		pml4_clear_page (e->pml4, e->upage);
+		dirty = pml4_is_dirty (e->pml4, e->upage);
+		if (e->type != VM_FILE || dirty) {
+			size_t slot = swap_out (kpage);
+
+			if (slot == SWAP_ERROR) {
+				pml4_set_page (e->pml4, e->upage, kpage, e->writable);
+				pml4_set_dirty (e->pml4, e->upage, dirty);
+				return NULL;
+			}
+			e->type = VM_ANON;
+			e->swap_slot = slot;
+		}
+		e->kpage = NULL;
+
+		hand = advance (hand);
+		list_remove (&page->lru);
+		frame_cnt--;
+		if (frame_cnt == 0)
+			hand = list_end (&frames);
+		page->flags &= ~PAGE_LRU;
+		page->mapping = NULL;
+		evict_cnt++;
+		return kpage;
+	}
+	return NULL;
+}
+
+/* Returns a frame for the page of E, zeroed if ZERO is true,
+   evicting another page if necessary, and adds it to the frame
+   table.  The frame is not evicted until E->kpage is set to it.
+   Returns a null pointer if no frame can be had.  The caller
+   must hold frame_lock. */
+void *
+frame_alloc (struct vm_entry *e, bool zero) {
+	struct page *page;
+	void *kpage;
+
+	ASSERT (lock_held_by_current_thread (&frame_lock));
+
+	kpage = palloc_get_page (PAL_USER | (zero ? PAL_ZERO : 0));
+	if (kpage == NULL) {
+		kpage = evict ();
+		if (kpage == NULL)
+			return NULL;
+		if (zero)
+			memset (kpage, 0, PGSIZE);
+	}
+
+	/* Insert just behind the hand, so the new page gets a full
+	   sweep before it is considered. */
+	page = kva_to_page (kpage);
+	page->mapping = e;
+	page->flags |= PAGE_LRU;
+	list_insert (hand, &page->lru);
+	frame_cnt++;
+	return kpage;
+}
+
+/* Removes frame KPAGE from the frame table and frees it.  The
+   caller must hold frame_lock and must already have unmapped
+   it. */
+void
+frame_free (void *kpage) {
+	struct page *page = kva_to_page (kpage);
+
+	ASSERT (lock_held_by_current_thread (&frame_lock));
+	ASSERT (page->flags & PAGE_LRU);
+
+	if (hand == &page->lru)
+		hand = list_next (hand);
+	list_remove (&page->lru);
+	frame_cnt--;
+	page->flags &= ~PAGE_LRU;
+	page->mapping = NULL;
+	page_put (page);
+}
+
+/* Returns the number of pages evicted so far. */
+size_t
+frame_evict_count (void) {
+	return evict_cnt;
+}
+
+/* Prints frame table statistics. */
+void
+frame_print_stats (void) {
+	printf ("Frames: %zu in use, %zu evicted\n", frame_cnt, evict_cnt);
+}
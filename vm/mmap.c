@@ -0,0 +1,67 @@
+#include "vm/mmap.h"
+#include <round.h>
+#include <stdint.h>
+#include "filesys/file.h"
+#include "filesys/inode.h"
+#include "threads/thread.h"
+#include "threads/vaddr.h"
+#include "vm/vm.h"
+
+/* Maps LENGTH bytes of FILE, starting at OFFSET, at ADDR in the
+   running process, read/write if WRITABLE is nonzero.  The
+   mapping shares frames with every other mapping of the file,
+   and the bytes of its last page past the end of the file read
+   as zeros and are never written back.  It lasts until
+   do_munmap() or process exit, even if FILE is closed.
+
+   Returns ADDR if successful, or a null pointer if ADDR or OFFSET
+   is not page-aligned, the file or LENGTH is empty, the range
+   overlaps pages already set up, or memory allocation failed. */
+void *
+do_mmap (void *addr, size_t length, int writable, struct file *file,
+		off_t offset) {
+	struct supplemental_page_table *spt = &thread_current ()->spt;
+	size_t page_cnt = DIV_ROUND_UP (length, PGSIZE);
+	uint8_t *upage = addr;
+	struct inode *inode;
+	size_t i;
+
+	if (upage == NULL || pg_ofs (upage) != 0 || length == 0
+			|| offset < 0 || offset % PGSIZE != 0 || file == NULL)
+		return NULL;
+	if (!is_user_vaddr (upage) || page_cnt > (KERN_BASE - (uint64_t) upage)
+			/ PGSIZE)
+		return NULL;
+	inode = file_get_inode (file);
+	if (inode_length (inode) == 0)
+		return NULL;
+	for (i = 0; i < page_cnt; i++)
+		if (spt_find_page (spt, upage + i * PGSIZE) != NULL)
+			return NULL;
+
+	for (i = 0; i < page_cnt; i++)
+		if (!vm_alloc_mmap (upage + i * PGSIZE, writable, inode,
+					offset + i * PGSIZE)) {
+			while (i-- > 0)
+				vm_free_page (upage + i * PGSIZE);
+			return NULL;
+		}
+	spt_find_page (spt, upage)->mmap_cnt = page_cnt;
+	return addr;
+}
+
+/* Unmaps the mapping that do_mmap() set up at ADDR, writing back
+   the pages written through it.  Does nothing if no mapping
+   starts at ADDR. */
+void
+do_munmap (void *addr) {
+	struct vm_entry *e = spt_find_page (&thread_current ()->spt, addr);
+	size_t page_cnt, i;
+
+	if (e == NULL || e->type != VM_MMAP || e->upage != addr
+			|| e->mmap_cnt == 0)
+		return;
+	page_cnt = e->mmap_cnt;
+	for (i = 0; i < page_cnt; i++)
+		vm_free_page ((uint8_t *) addr + i * PGSIZE);
+}
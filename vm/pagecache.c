@@ -0,0 +1,645 @@
+#include "vm/pagecache.h"
+#include <debug.h>
+#include <hash.h>
+#include <list.h>
+#include <round.h>
+#include <stdio.h>
+#include <string.h>
+#include "filesys/inode.h"
+#include "threads/malloc.h"
+#include "threads/mmu.h"
+#include "threads/palloc.h"
+#include "threads/shrinker.h"
+#include "threads/synch.h"
+#include "threads/thread.h"
+#include "threads/vaddr.h"
+#include "vm/vm.h"
+
+/* Readahead.
+
+   A fault that misses the cache right after the page before it,
+   or that hits a page marked as a readahead trigger, asks the
+   "readahead" thread to read the next RA_PAGES pages, and marks
+   the page halfway into that window as the next trigger.  A
+   sequential reader thus finds each page already read, and keeps
+   the readahead thread one window ahead of it. */
+#define RA_PAGES 16             /* Pages per readahead window. */
+
+/* Reclaim.
+
+   Each cached page keeps a list of the VM_MMAP entries that map
+   it, so that its mappings can be torn down when its frame is
+   wanted back.  Pages are considered least recently used first,
+   and a page that one of its mappings has touched since it was
+   last considered gets a second chance, as in the frame table's
+   clock.  The shrinker, which must not block, only frees pages
+   that are clean in the cache and in every mapping's PTE.  When
+   a fault finds the user pool empty, reclaim() also takes dirty
+   pages, writing them back first. */
+
+/* A cached page.  Its frame holds one reference for the cache,
+   one for each mapping in MAPPERS, and one for each caller of
+   get() or peek() that has yet to map it, and its struct page's
+   MAPPING points back here. */
+struct pc_page {
+	struct hash_elem elem;      /* Element in CACHE. */
+	struct list_elem lru_elem;  /* Element in LRU. */
+	struct inode *inode;        /* File. */
+	size_t idx;                 /* Page index within file. */
+	void *kpage;                /* Frame. */
+	struct list mappers;        /* vm_entries that map it. */
+	bool loading;               /* Being read?  Wait on LOADED. */
+	bool dirty;                 /* Written since last written back? */
+	bool ra_mark;               /* Triggers the next readahead. */
+};
+
+/* A readahead request. */
+struct ra_request {
+	struct list_elem elem;      /* Element in RA_QUEUE. */
+	struct inode *inode;        /* File, reopened for the request. */
+	size_t idx;                 /* First page to read. */
+};
+
+static struct lock pc_lock;     /* Protects everything below. */
+static struct condition loaded; /* Signaled when a read completes. */
+static struct hash cache;       /* All cached pages. */
+static struct list lru;         /* Cached pages, least recent first. */
+static struct list ra_queue;    /* Readahead requests. */
+static struct semaphore ra_ready;   /* Up'd for each request queued. */
+
+/* Statistics. */
+static size_t hit_cnt, miss_cnt, ra_cnt, writeback_cnt, shrink_cnt;
+static size_t reclaim_cnt, unmap_cnt;
+
+static hash_hash_func pc_hash;
+static hash_less_func pc_less;
+static thread_func ra_thread;
+static struct shrinker pc_shrinker;
+static void *reclaim (void);
+
+/* Initializes the page cache and starts the readahead thread. */
+void
+pagecache_init (void) {
+	lock_init_named (&pc_lock, "pagecache");
+	cond_init (&loaded);
+	if (!hash_init (&cache, pc_hash, pc_less, NULL))
+		PANIC ("pagecache: cannot allocate cache");
+	list_init (&lru);
+	list_init (&ra_queue);
+	sema_init (&ra_ready, 0);
+	shrinker_register (&pc_shrinker);
+	if (thread_create ("readahead", PRI_DEFAULT, ra_thread, NULL)
+			== TID_ERROR)
+		PANIC ("pagecache: cannot create readahead thread");
+}
+
+/* Returns the cached page IDX of INODE, or a null pointer if
+   there is none.  PC_LOCK must be held. */
+static struct pc_page *
+lookup (struct inode *inode, size_t idx) {
+	struct pc_page key;
+	struct hash_elem *e;
+
+	key.inode = inode;
+	key.idx = idx;
+	e = hash_find (&cache, &key.elem);
+	return e != NULL ? hash_entry (e, struct pc_page, elem) : NULL;
+}
+
+/* Returns the number of pages in INODE. */
+static size_t
+inode_pages (struct inode *inode) {
+	return DIV_ROUND_UP (inode_length (inode), PGSIZE);
+}
+
+/* Adds page IDX of INODE to the cache in frame KPAGE, marked as
+   loading, and returns it, or returns a null pointer if memory
+   allocation failed.  PC_LOCK must be held. */
+static struct pc_page *
+insert (struct inode *inode, size_t idx, void *kpage) {
+	struct pc_page *p = malloc (sizeof *p);
+
+	if (p == NULL)
+		return NULL;
+	p->inode = inode;
+	p->idx = idx;
+	p->kpage = kpage;
+	p->loading = true;
+	p->dirty = false;
+	p->ra_mark = false;
+	list_init (&p->mappers);
+	hash_insert (&cache, &p->elem);
+	list_push_back (&lru, &p->lru_elem);
+	palloc_set_owner (kpage, 1, p);
+	return p;
+}
+
+/* Removes P from the cache and drops the cache's reference to
+   its frame.  PC_LOCK must be held. */
+static void
+evict (struct pc_page *p) {
+	hash_delete (&cache, &p->elem);
+	list_remove (&p->lru_elem);
+	page_put (kva_to_page (p->kpage));
+	free (p);
+}
+
+/* Reads P's page from its file into its frame, without holding
+   PC_LOCK, and wakes up anyone waiting for it.  The part of the
+   page past the end of the file is zeroed. */
+static void
+load (struct pc_page *p) {
+	off_t ofs = (off_t) p->idx * PGSIZE;
+	off_t length = inode_length (p->inode);
+	off_t read_bytes = length - ofs < PGSIZE ? length - ofs : PGSIZE;
+
+	if (read_bytes < 0)
+		read_bytes = 0;
+	read_bytes = inode_read_at (p->inode, p->kpage, read_bytes, ofs);
+	memset ((uint8_t *) p->kpage + read_bytes, 0, PGSIZE - read_bytes);
+
+	lock_acquire (&pc_lock);
+	p->loading = false;
+	cond_broadcast (&loaded, &pc_lock);
+	lock_release (&pc_lock);
+}
+
+/* Asks the readahead thread to read the pages of INODE starting
+   at IDX, and marks the page halfway into them as the next
+   trigger. */
+static void
+readahead (struct inode *inode, size_t idx) {
+	struct ra_request *r;
+
+	if (idx >= inode_pages (inode))
+		return;
+	r = malloc (sizeof *r);
+	if (r == NULL)
+		return;
+	r->inode = inode_reopen (inode);
+	r->idx = idx;
+
+	lock_acquire (&pc_lock);
+	list_push_back (&ra_queue, &r->elem);
+	lock_release (&pc_lock);
+	sema_up (&ra_ready);
+}
+
+/* Returns the frame of page IDX of INODE, reading it if it is not
+   cached yet, with a new reference for the caller, who must pass
+   it on to attach().  May start readahead.  Returns a null
+   pointer if no frame could be had. */
+static void *
+get (struct inode *inode, size_t idx) {
+	struct pc_page *p;
+	void *kpage = NULL;
+	bool trigger;
+
+	lock_acquire (&pc_lock);
+	p = lookup (inode, idx);
+	if (p == NULL) {
+		/* Allocate without PC_LOCK, since the allocator may call
+		   our shrinker, and then look again. */
+		lock_release (&pc_lock);
+		kpage = palloc_get_page (PAL_USER);
+		lock_acquire (&pc_lock);
+		if (kpage == NULL)
+			kpage = reclaim ();
+		p = lookup (inode, idx);
+		if (p == NULL && kpage == NULL) {
+			lock_release (&pc_lock);
+			return NULL;
+		}
+	}
+
+	if (p == NULL) {
+		p = insert (inode, idx, kpage);
+		if (p == NULL) {
+			lock_release (&pc_lock);
+			palloc_free_page (kpage);
+			return NULL;
+		}
+		miss_cnt++;
+		trigger = idx == 0 || lookup (inode, idx - 1) != NULL;
+		page_get (kva_to_page (kpage));
+		lock_release (&pc_lock);
+		load (p);
+	} else {
+		hit_cnt++;
+		list_remove (&p->lru_elem);
+		list_push_back (&lru, &p->lru_elem);
+		trigger = p->ra_mark;
+		p->ra_mark = false;
+
+		/* Take our reference first, so that the page is not shrunk
+		   between being loaded and our waking up. */
+		page_get (kva_to_page (p->kpage));
+		while (p->loading)
+			cond_wait (&loaded, &pc_lock);
+		lock_release (&pc_lock);
+		if (kpage != NULL)
+			palloc_free_page (kpage);
+	}
+
+	if (trigger)
+		readahead (inode, idx + 1);
+	return p->kpage;
+}
+
+/* Returns the frame of page IDX of INODE with a new reference
+   for the caller, like get(), if it is cached and loaded.
+   Otherwise, returns a null pointer without reading anything. */
+static void *
+peek (struct inode *inode, size_t idx) {
+	struct pc_page *p;
+	bool trigger = false;
+
+	lock_acquire (&pc_lock);
+	p = lookup (inode, idx);
+	if (p != NULL && !p->loading) {
+		hit_cnt++;
+		list_remove (&p->lru_elem);
+		list_push_back (&lru, &p->lru_elem);
+		trigger = p->ra_mark;
+		p->ra_mark = false;
+		page_get (kva_to_page (p->kpage));
+	} else
+		p = NULL;
+	lock_release (&pc_lock);
+
+	/* A page mapped ahead of the reader still keeps readahead
+	   going. */
+	if (trigger)
+		readahead (inode, idx + 1);
+	return p != NULL ? p->kpage : NULL;
+}
+
+/* Maps VM_MMAP page E to cached frame KPAGE, which holds a
+   reference from get() or peek() that passes to the mapping.
+   Drops the reference instead if E is already mapped or its PTE
+   cannot be set.  Returns true if E is now mapped. */
+static bool
+attach (struct vm_entry *e, void *kpage) {
+	struct page *page = kva_to_page (kpage);
+	struct pc_page *p = page->mapping;
+
+	lock_acquire (&pc_lock);
+	if (e->kpage == NULL
+			&& pml4_set_page (e->pml4, e->upage, kpage, e->writable)) {
+		e->kpage = kpage;
+		list_push_back (&p->mappers, &e->pc_elem);
+	} else
+		page_put (page);
+	lock_release (&pc_lock);
+	return e->kpage != NULL;
+}
+
+/* Maps VM_MMAP page E to its page's frame in the cache, reading
+   the page if it is not cached yet.  Returns true if successful
+   or if E was already mapped, false if no frame could be had or
+   memory allocation failed. */
+bool
+pagecache_map (struct vm_entry *e) {
+	void *kpage = get (e->inode, e->ofs / PGSIZE);
+
+	return kpage != NULL && attach (e, kpage);
+}
+
+/* Maps VM_MMAP page E like pagecache_map(), but only if its page
+   is already cached and loaded.  Returns true if E was mapped. */
+bool
+pagecache_map_cached (struct vm_entry *e) {
+	void *kpage = peek (e->inode, e->ofs / PGSIZE);
+
+	return kpage != NULL && attach (e, kpage);
+}
+
+/* Unmaps VM_MMAP page E, if it is mapped, and drops its
+   reference to the cached frame.  Returns true if E wrote to the
+   page, which is then dirty in the cache. */
+bool
+pagecache_unmap (struct vm_entry *e) {
+	bool dirty = false;
+
+	lock_acquire (&pc_lock);
+	if (e->kpage != NULL) {
+		struct page *page = kva_to_page (e->kpage);
+		struct pc_page *p = page->mapping;
+
+		dirty = pml4_is_dirty (e->pml4, e->upage);
+		pml4_clear_page (e->pml4, e->upage);
+		list_remove (&e->pc_elem);
+		e->kpage = NULL;
+		if (dirty)
+			p->dirty = true;
+		page_put (page);
+	}
+	lock_release (&pc_lock);
+	return dirty;
+}
+
+/* Writes P's page back to its file, except for the part past the
+   end of the file, if it is dirty.  PC_LOCK must be held, and is
+   released while writing. */
+static void
+write_back (struct pc_page *p) {
+	off_t ofs = (off_t) p->idx * PGSIZE;
+	off_t length = inode_length (p->inode);
+
+	if (!p->dirty || p->loading)
+		return;
+	p->dirty = false;
+	if (ofs >= length)
+		return;
+
+	/* Hold a reference so the shrinker leaves it alone. */
+	page_get (kva_to_page (p->kpage));
+	lock_release (&pc_lock);
+	inode_write_at (p->inode, p->kpage,
+			length - ofs < PGSIZE ? length - ofs : PGSIZE, ofs);
+	lock_acquire (&pc_lock);
+	page_put (kva_to_page (p->kpage));
+	writeback_cnt++;
+}
+
+/* Returns true if nothing but the cache and P's mappings holds a
+   reference to P's frame, so that it may be reclaimed once they
+   are gone.  PC_LOCK must be held. */
+static bool
+is_idle (struct pc_page *p) {
+	return !p->loading
+		&& (size_t) kva_to_page (p->kpage)->refcnt
+			== list_size (&p->mappers) + 1;
+}
+
+/* Returns true if a mapping of P has used it since the last call,
+   and clears the mappings' accessed bits.  PC_LOCK must be
+   held. */
+static bool
+was_accessed (struct pc_page *p) {
+	struct list_elem *e;
+	bool accessed = false;
+
+	for (e = list_begin (&p->mappers); e != list_end (&p->mappers);
+			e = list_next (e)) {
+		struct vm_entry *m = list_entry (e, struct vm_entry, pc_elem);
+
+		if (pml4_is_accessed (m->pml4, m->upage)) {
+			pml4_set_accessed (m->pml4, m->upage, false);
+			accessed = true;
+		}
+	}
+	return accessed;
+}
+
+/* Returns true if a mapping of P has written to it.  PC_LOCK must
+   be held. */
+static bool
+is_mapped_dirty (struct pc_page *p) {
+	struct list_elem *e;
+
+	for (e = list_begin (&p->mappers); e != list_end (&p->mappers);
+			e = list_next (e)) {
+		struct vm_entry *m = list_entry (e, struct vm_entry, pc_elem);
+
+		if (pml4_is_dirty (m->pml4, m->upage))
+			return true;
+	}
+	return false;
+}
+
+/* Unmaps every mapping of P, marking P dirty if any of them wrote
+   to it.  A later fault maps the page again.  PC_LOCK must be
+   held. */
+static void
+unmap_all (struct pc_page *p) {
+	while (!list_empty (&p->mappers)) {
+		struct vm_entry *m = list_entry (list_pop_front (&p->mappers),
+				struct vm_entry, pc_elem);
+
+		if (pml4_is_dirty (m->pml4, m->upage))
+			p->dirty = true;
+		pml4_clear_page (m->pml4, m->upage);
+		m->kpage = NULL;
+		page_put (kva_to_page (p->kpage));
+		unmap_cnt++;
+	}
+}
+
+/* Removes P from the cache and returns its frame, with the
+   cache's reference, for reuse.  PC_LOCK must be held. */
+static void *
+take (struct pc_page *p) {
+	void *kpage = p->kpage;
+
+	hash_delete (&cache, &p->elem);
+	list_remove (&p->lru_elem);
+	free (p);
+	palloc_set_owner (kpage, 1, NULL);
+	reclaim_cnt++;
+	return kpage;
+}
+
+/* Takes a frame back from the cache, unmapping its page and
+   writing it back first if need be.  Returns the frame, out of
+   the cache, or a null pointer if no page could be taken.
+   PC_LOCK must be held, and is released while writing. */
+static void *
+reclaim (void) {
+	size_t i, sweep = 2 * list_size (&lru);
+
+	/* Two sweeps clear every accessed bit, as in the frame
+	   table. */
+	for (i = 0; i < sweep && !list_empty (&lru); i++) {
+		struct pc_page *p = list_entry (list_pop_front (&lru),
+				struct pc_page, lru_elem);
+		struct inode *inode;
+		void *kpage = NULL;
+
+		list_push_back (&lru, &p->lru_elem);
+		if (!is_idle (p) || was_accessed (p))
+			continue;
+		unmap_all (p);
+		if (!p->dirty)
+			return take (p);
+
+		/* Keep the inode open, and so P cached, while PC_LOCK is
+		   released.  P may be mapped again meanwhile.  An inode
+		   being closed for the last time is about to purge P
+		   itself. */
+		inode = inode_try_reopen (p->inode);
+		if (inode == NULL)
+			continue;
+		write_back (p);
+		if (!p->dirty && is_idle (p) && list_empty (&p->mappers))
+			kpage = take (p);
+		lock_release (&pc_lock);
+		inode_close (inode);
+		lock_acquire (&pc_lock);
+		if (kpage != NULL)
+			return kpage;
+	}
+	return NULL;
+}
+
+/* Writes page IDX of INODE back to the file if it is cached and
+   dirty. */
+void
+pagecache_writeback (struct inode *inode, size_t idx) {
+	struct pc_page *p;
+
+	lock_acquire (&pc_lock);
+	p = lookup (inode, idx);
+	if (p != NULL)
+		write_back (p);
+	lock_release (&pc_lock);
+}
+
+/* Drops every cached page of INODE, which nothing may map any
+   more, first writing back the dirty ones if WRITEBACK is true.
+   Called when INODE is closed for the last time.  Mappings may
+   extend past the end of the file, so pages are found by walking
+   the whole cache rather than by index. */
+void
+pagecache_purge (struct inode *inode, bool writeback) {
+	struct list_elem *e, *next;
+
+	lock_acquire (&pc_lock);
+
+	/* Writing back releases PC_LOCK, so start over after each. */
+	e = writeback ? list_begin (&lru) : list_end (&lru);
+	while (e != list_end (&lru)) {
+		struct pc_page *p = list_entry (e, struct pc_page, lru_elem);
+
+		if (p->inode == inode && p->dirty) {
+			ASSERT (!p->loading);
+			write_back (p);
+			e = list_begin (&lru);
+		} else
+			e = list_next (e);
+	}
+
+	for (e = list_begin (&lru); e != list_end (&lru); e = next) {
+		struct pc_page *p = list_entry (e, struct pc_page, lru_elem);
+
+		next = list_next (e);
+		if (p->inode == inode) {
+			ASSERT (!p->loading && list_empty (&p->mappers));
+			ASSERT (kva_to_page (p->kpage)->refcnt == 1);
+			evict (p);
+		}
+	}
+	lock_release (&pc_lock);
+}
+
+/* Reads the pages that readahead requests ask for. */
+static void
+ra_thread (void *aux UNUSED) {
+	for (;;) {
+		struct ra_request *r;
+		size_t idx, end;
+
+		sema_down (&ra_ready);
+		lock_acquire (&pc_lock);
+		r = list_entry (list_pop_front (&ra_queue), struct ra_request, elem);
+		lock_release (&pc_lock);
+
+		end = r->idx + RA_PAGES;
+		if (end > inode_pages (r->inode))
+			end = inode_pages (r->inode);
+		for (idx = r->idx; idx < end; idx++) {
+			void *kpage = palloc_get_page (PAL_USER);
+			struct pc_page *p;
+
+			if (kpage == NULL)
+				break;
+			lock_acquire (&pc_lock);
+			if (lookup (r->inode, idx) != NULL
+					|| (p = insert (r->inode, idx, kpage)) == NULL) {
+				lock_release (&pc_lock);
+				palloc_free_page (kpage);
+				continue;
+			}
+			p->ra_mark = idx == r->idx + RA_PAGES / 2;
+			ra_cnt++;
+			lock_release (&pc_lock);
+			load (p);
+		}
+		inode_close (r->inode);
+		free (r);
+	}
+}
+
+/* Returns roughly how many cached pages could be freed. */
+static size_t
+pc_count (struct shrinker *s UNUSED) {
+	return hash_size (&cache);
+}
+
+/* Frees up to PAGE_CNT clean cached pages, least recently used
+   first, unmapping them from any mappings that have not used
+   them lately.  Dirty pages are left for reclaim(), since writing
+   them back would block.  Skips the work if PC_LOCK is busy,
+   since shrinkers must not block. */
+static size_t
+pc_scan (struct shrinker *s UNUSED, size_t page_cnt) {
+	struct list_elem *e, *next;
+	size_t cnt = 0;
+
+	if (lock_held_by_current_thread (&pc_lock)
+			|| !lock_try_acquire (&pc_lock))
+		return 0;
+	for (e = list_begin (&lru); e != list_end (&lru) && cnt < page_cnt;
+			e = next) {
+		struct pc_page *p = list_entry (e, struct pc_page, lru_elem);
+
+		next = list_next (e);
+		if (!is_idle (p) || p->dirty || is_mapped_dirty (p)
+				|| was_accessed (p))
+			continue;
+
+		/* A mapping may write to the page until it is unmapped. */
+		unmap_all (p);
+		if (!p->dirty) {
+			evict (p);
+			cnt++;
+		}
+	}
+	shrink_cnt += cnt;
+	lock_release (&pc_lock);
+	return cnt;
+}
+
+static struct shrinker pc_shrinker = {
+	.count = pc_count,
+	.scan = pc_scan,
+	.name = "pagecache",
+};
+
+/* Prints page cache statistics. */
+void
+pagecache_print_stats (void) {
+	printf ("Page cache: %zu pages, %zu hits, %zu misses, %zu read ahead, "
+			"%zu written back, %zu shrunk, %zu reclaimed, %zu unmapped\n",
+			hash_size (&cache), hit_cnt, miss_cnt, ra_cnt, writeback_cnt,
+			shrink_cnt, reclaim_cnt, unmap_cnt);
+}
+
+/* Returns a hash of cached page P. */
+static unsigned
+pc_hash (const struct hash_elem *p_, void *aux UNUSED) {
+	const struct pc_page *p = hash_entry (p_, struct pc_page, elem);
+	return hash_bytes (&p->inode, sizeof p->inode) ^ hash_int (p->idx);
+}
+
+/* Returns true if cached page A precedes cached page B. */
+static bool
+pc_less (const struct hash_elem *a_, const struct hash_elem *b_,
+		void *aux UNUSED) {
+	const struct pc_page *a = hash_entry (a_, struct pc_page, elem);
+	const struct pc_page *b = hash_entry (b_, struct pc_page, elem);
+
+	if (a->inode != b->inode)
+		return a->inode < b->inode;
+	return a->idx < b->idx;
+}
@@ -0,0 +1,91 @@
+#include "vm/swap.h"
+#include <bitmap.h>
+#include <debug.h>
+#include <stdio.h>
+#include "devices/disk.h"
+#include "threads/synch.h"
+#include "threads/vaddr.h"
+
+/* Swap space on hd1:1, divided into page-sized slots. */
+
+/* Sectors per slot. */
+#define SLOT_SECTORS (PGSIZE / DISK_SECTOR_SIZE)
+
+static struct disk *swap_disk;
+static struct bitmap *used_map;     /* Slots in use. */
+static struct lock swap_lock;       /* Protects USED_MAP. */
+
+static size_t out_cnt, in_cnt;      /* Pages written and read. */
+
+/* Finds the swap disk and sets up its slots.  Without a swap
+   disk, swap_out() always fails. */
+void
+swap_init (void) {
+	size_t slot_cnt = 0;
+
+	lock_init_named (&swap_lock, "swap");
+	swap_disk = disk_get (1, 1);
+	if (swap_disk != NULL)
+		slot_cnt = disk_size (swap_disk) / SLOT_SECTORS;
+	used_map = bitmap_create (slot_cnt);
+	if (used_map == NULL)
+		PANIC ("swap: cannot allocate slot bitmap");
+}
+
+/* Writes the page at KPAGE to a free swap slot and returns the
+   slot, or SWAP_ERROR if swap is full. */
+size_t
+swap_out (const void *kpage) {
+	size_t slot, i;
+
+	lock_acquire (&swap_lock);
+	slot = bitmap_scan_and_flip (used_map, 0, 1, false);
+	lock_release (&swap_lock);
+	if (slot == BITMAP_ERROR)
+		return SWAP_ERROR;
+
+	for (i = 0; i < SLOT_SECTORS; i++)
+		disk_write (swap_disk, slot * SLOT_SECTORS + i,
+				(const uint8_t *) kpage + i * DISK_SECTOR_SIZE);
+	out_cnt++;
+	return slot;
+}
+
+/* Reads swap slot SLOT into the page at KPAGE, keeping the
+   slot. */
+void
+swap_read (size_t slot, void *kpage) {
+	size_t i;
+
+	ASSERT (bitmap_test (used_map, slot));
+
+	for (i = 0; i < SLOT_SECTORS; i++)
+		disk_read (swap_disk, slot * SLOT_SECTORS + i,
+				(uint8_t *) kpage + i * DISK_SECTOR_SIZE);
+	in_cnt++;
+}
+
+/* Reads swap slot SLOT into the page at KPAGE and frees the
+   slot. */
+void
+swap_in (size_t slot, void *kpage) {
+	swap_read (slot, kpage);
+	swap_free (slot);
+}
+
+/* Frees swap slot SLOT without reading it. */
+void
+swap_free (size_t slot) {
+	lock_acquire (&swap_lock);
+	ASSERT (bitmap_test (used_map, slot));
+	bitmap_reset (used_map, slot);
+	lock_release (&swap_lock);
+}
+
+/* Prints swap statistics. */
+void
+swap_print_stats (void) {
+	printf ("Swap: %zu of %zu slots in use, %zu pages written, %zu read\n",
+			bitmap_count (used_map, 0, bitmap_size (used_map), true),
+			bitmap_size (used_map), out_cnt, in_cnt);
+}
@@ -0,0 +1,5 @@
+vm_SRC  = vm/vm.c		# Supplemental page table and page faults.
+vm_SRC += vm/frame.c		# Frame table and eviction.
+vm_SRC += vm/swap.c		# Swap slots.
+vm_SRC += vm/pagecache.c	# File page cache and readahead.
+vm_SRC += vm/mmap.c		# File mappings.
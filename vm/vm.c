@@ -0,0 +1,563 @@
+#include "vm/vm.h"
+#include <debug.h>
+#include <stdio.h>
+#include <string.h>
+#include "filesys/file.h"
+#include "filesys/inode.h"
+#include "threads/malloc.h"
+#include "threads/mmu.h"
+#include "threads/palloc.h"
+#include "threads/thread.h"
+#include "threads/vaddr.h"
+#include "vm/frame.h"
+#include "vm/pagecache.h"
+#include "vm/swap.h"
+
+/* Size of the window of pages mapped around a fault. */
+unsigned vm_fault_around = 16;
+
+/* Statistics. */
+static size_t fault_cnt;        /* Faults handled. */
+static size_t file_cnt;         /* Pages read from files. */
+static size_t zero_cnt;         /* Zero pages given frames. */
+static size_t share_cnt;        /* Frames shared by fork. */
+static size_t cow_cnt;          /* Pages copied on write. */
+static size_t mmap_cnt;         /* Mapped pages faulted in. */
+static size_t around_cnt;       /* Pages mapped around faults. */
+
+static hash_hash_func entry_hash;
+static hash_less_func entry_less;
+static hash_action_func entry_destroy;
+static struct vm_entry *alloc_entry (struct supplemental_page_table *,
+		void *upage, enum vm_type, bool writable);
+
+/* Initializes the frame table and swap.  Must be called after
+   disk_init(). */
+void
+vm_init (void) {
+	frame_init ();
+	swap_init ();
+	pagecache_init ();
+}
+
+/* Initializes SPT to empty. */
+void
+supplemental_page_table_init (struct supplemental_page_table *spt) {
+	if (!hash_init (&spt->entries, entry_hash, entry_less, NULL))
+		PANIC ("vm: cannot allocate supplemental page table");
+}
+
+/* Frees SPT and every frame it refers to, unmapping them from
+   the running thread's page map.  Must be called before the page
+   map is destroyed. */
+void
+supplemental_page_table_kill (struct supplemental_page_table *spt) {
+	lock_acquire (&frame_lock);
+	hash_destroy (&spt->entries, entry_destroy);
+	lock_release (&frame_lock);
+}
+
+/* Makes E, from the parent's table, and its copy D, in the
+   running thread's, share E's frame read-only.  Returns true if successful, false
+   if memory allocation failed. */
+static bool
+share_page (struct vm_entry *e, struct vm_entry *d) {
+	struct page *page = kva_to_page (e->kpage);
+
+	if (!pml4_set_page (d->pml4, d->upage, e->kpage, false))
+		return false;
+
+	/* The frame may differ from the file by now, and once shared
+	   no single PTE's dirty bit can tell. */
+	if (e->type == VM_FILE && e->writable
+			&& pml4_is_dirty (e->pml4, e->upage))
+		e->type = VM_ANON;
+	d->type = e->type;
+	if (e->writable)
+		pml4_protect_range (e->pml4, e->upage, 1, false);
+
+	page_get (page);
+	d->kpage = e->kpage;
+	d->sharer = e->sharer;
+	e->sharer = d;
+	share_cnt++;
+	return true;
+}
+
+/* Copies SRC, the parent's table, into DST, the running
+   thread's, for fork.  Resident pages are shared copy-on-write,
+   pages in swap are read into frames of their own, and the rest
+   are set up to be loaded on demand, as in the parent.  Returns
+   true if successful, false if memory allocation failed. */
+bool
+supplemental_page_table_copy (struct supplemental_page_table *dst,
+		struct supplemental_page_table *src) {
+	struct hash_iterator i;
+	bool success = true;
+
+	ASSERT (dst == &thread_current ()->spt);
+
+	lock_acquire (&frame_lock);
+	hash_first (&i, &src->entries);
+	while (success && hash_next (&i)) {
+		struct vm_entry *e = hash_entry (hash_cur (&i), struct vm_entry, elem);
+		struct vm_entry *d = alloc_entry (dst, e->upage, e->type, e->writable);
+
+		if (d == NULL) {
+			success = false;
+			break;
+		}
+		d->inode = inode_reopen (e->inode);
+		d->ofs = e->ofs;
+		d->read_bytes = e->read_bytes;
+
+		if (e->type == VM_MMAP) {
+			/* Faults in the child map the same cached frames. */
+			d->mmap_cnt = e->mmap_cnt;
+		} else if (e->kpage != NULL)
+			success = share_page (e, d);
+		else if (e->type == VM_ANON) {
+			void *kpage = frame_alloc (d, false);
+
+			if (kpage != NULL) {
+				swap_read (e->swap_slot, kpage);
+				if (pml4_set_page (d->pml4, d->upage, kpage, d->writable))
+					d->kpage = kpage;
+				else
+					frame_free (kpage);
+			}
+			success = d->kpage != NULL;
+		}
+	}
+	lock_release (&frame_lock);
+	return success;
+}
+
+/* For same-page merging: makes the entry that owns KPAGE, a
+   frame-table frame mapped by it alone, share SHARED, another
+   frame-table frame with the same contents, read-only, as if
+   forked, and frees KPAGE. */
+void
+vm_merge_frame (void *kpage, void *shared) {
+	struct vm_entry *e = kva_to_page (kpage)->mapping;
+	struct vm_entry *s = kva_to_page (shared)->mapping;
+	bool dirty, success;
+
+	ASSERT (lock_held_by_current_thread (&frame_lock));
+	ASSERT (e->kpage == kpage && e->sharer == e && s->kpage == shared);
+
+	pml4_clear_page (e->pml4, e->upage);
+	dirty = pml4_is_dirty (e->pml4, e->upage);
+	success = pml4_set_page (e->pml4, e->upage, shared, false);
+	ASSERT (success);
+
+	/* As in share_page(). */
+	if (e->type == VM_FILE && dirty)
+		e->type = VM_ANON;
+	if (s->type == VM_FILE && pml4_is_dirty (s->pml4, s->upage))
+		s->type = VM_ANON;
+
+	page_get (kva_to_page (shared));
+	e->kpage = shared;
+	e->sharer = s->sharer;
+	s->sharer = e;
+	frame_free (kpage);
+}
+
+/* Returns the entry for the page that contains user virtual
+   address VA in SPT, or a null pointer if there is none. */
+struct vm_entry *
+spt_find_page (struct supplemental_page_table *spt, void *va) {
+	struct vm_entry key;
+	struct hash_elem *e;
+
+	key.upage = pg_round_down (va);
+	e = hash_find (&spt->entries, &key.elem);
+	return e != NULL ? hash_entry (e, struct vm_entry, elem) : NULL;
+}
+
+/* Adds an entry of TYPE for UPAGE to SPT, in the running
+   thread's page map, and returns it.  Returns a null pointer if
+   UPAGE is already in the table or memory allocation failed. */
+static struct vm_entry *
+alloc_entry (struct supplemental_page_table *spt, void *upage,
+		enum vm_type type, bool writable) {
+	struct vm_entry *e;
+
+	ASSERT (pg_ofs (upage) == 0);
+	ASSERT (is_user_vaddr (upage));
+
+	e = malloc (sizeof *e);
+	if (e == NULL)
+		return NULL;
+	e->pml4 = thread_current ()->pml4;
+	e->upage = upage;
+	e->type = type;
+	e->writable = writable;
+	e->kpage = NULL;
+	e->sharer = e;
+	e->inode = NULL;
+	e->ofs = 0;
+	e->read_bytes = 0;
+	e->mmap_cnt = 0;
+	e->swap_slot = SWAP_ERROR;
+	if (hash_insert (&spt->entries, &e->elem) != NULL) {
+		free (e);
+		return NULL;
+	}
+	return e;
+}
+
+/* Sets up UPAGE as a page of zeros, to be given a frame when it
+   is first touched.  Returns true if successful, false if UPAGE
+   is already set up or memory allocation failed. */
+bool
+vm_alloc_zero (void *upage, bool writable) {
+	return alloc_entry (&thread_current ()->spt, upage, VM_ZERO,
+			writable) != NULL;
+}
+
+/* Sets up UPAGE to be loaded, when it is first touched, with
+   READ_BYTES bytes of FILE starting at offset OFS followed by
+   zeros.  The page holds FILE's inode open, so FILE itself may
+   be closed at any time.  A read-only whole page is mapped from
+   the page cache instead, so that it is shared.  Returns true if successful, false if UPAGE
+   is already set up or memory allocation failed. */
+bool
+vm_alloc_file (void *upage, bool writable, struct file *file, off_t ofs,
+		size_t read_bytes) {
+	struct vm_entry *e;
+
+	ASSERT (read_bytes <= PGSIZE);
+
+	if (!writable && read_bytes == PGSIZE && ofs % PGSIZE == 0)
+		return vm_alloc_mmap (upage, false, file_get_inode (file), ofs);
+
+	e = alloc_entry (&thread_current ()->spt, upage, VM_FILE, writable);
+	if (e == NULL)
+		return false;
+	e->inode = inode_reopen (file_get_inode (file));
+	e->ofs = ofs;
+	e->read_bytes = read_bytes;
+	return true;
+}
+
+/* Sets up UPAGE to map the page at offset OFS in INODE, which
+   must be page-aligned, through the page cache.  Returns true if
+   successful, false if UPAGE is already set up or memory
+   allocation failed. */
+bool
+vm_alloc_mmap (void *upage, bool writable, struct inode *inode, off_t ofs) {
+	struct vm_entry *e;
+
+	ASSERT (ofs % PGSIZE == 0);
+
+	e = alloc_entry (&thread_current ()->spt, upage, VM_MMAP, writable);
+	if (e == NULL)
+		return false;
+	e->inode = inode_reopen (inode);
+	e->ofs = ofs;
+	return true;
+}
+
+/* Removes UPAGE from the running thread's supplemental page
+   table, unmapping it and writing it back or freeing its frame
+   or swap slot as needed.  Does nothing if UPAGE is not in the
+   table. */
+void
+vm_free_page (void *upage) {
+	struct supplemental_page_table *spt = &thread_current ()->spt;
+	struct vm_entry *e;
+
+	lock_acquire (&frame_lock);
+	e = spt_find_page (spt, upage);
+	if (e != NULL) {
+		hash_delete (&spt->entries, &e->elem);
+		entry_destroy (&e->elem, NULL);
+	}
+	lock_release (&frame_lock);
+}
+
+/* Sets up a segment starting at offset OFS in FILE at address
+   UPAGE to be loaded on demand.  In total, READ_BYTES + ZERO_BYTES
+   bytes of virtual memory are set up: the READ_BYTES bytes at
+   UPAGE come from FILE, and the ZERO_BYTES bytes after them are
+   zeroed.  The pages are writable by the user process if
+   WRITABLE is true, read-only otherwise.  Nothing is read now.
+
+   This is the lazy counterpart of load_segment() in
+   userprog/process.c.  Returns true if successful, false if
+   memory allocation failed or a page was already set up. */
+bool
+vm_load_segment (struct file *file, off_t ofs, uint8_t *upage,
+		size_t read_bytes, size_t zero_bytes, bool writable) {
+	ASSERT ((read_bytes + zero_bytes) % PGSIZE == 0);
+	ASSERT (pg_ofs (upage) == 0);
+	ASSERT (ofs % PGSIZE == 0);
+
+	while (read_bytes > 0 || zero_bytes > 0) {
+		size_t page_read_bytes = read_bytes < PGSIZE ? read_bytes : PGSIZE;
+		size_t page_zero_bytes = PGSIZE - page_read_bytes;
+		bool success = page_read_bytes > 0
+			? vm_alloc_file (upage, writable, file, ofs, page_read_bytes)
+			: vm_alloc_zero (upage, writable);
+
+		if (!success)
+			return false;
+		read_bytes -= page_read_bytes;
+		zero_bytes -= page_zero_bytes;
+		ofs += page_read_bytes;
+		upage += PGSIZE;
+	}
+	return true;
+}
+
+/* Maps VM_MMAP page E to its frame in the page cache.  The frame
+   table plays no part, so FRAME_LOCK is not needed.  Returns true
+   if successful, false if memory allocation failed. */
+static bool
+claim_mmap (struct vm_entry *e) {
+	if (e->kpage != NULL)
+		return true;
+	if (!pagecache_map (e))
+		return false;
+	mmap_cnt++;
+	return true;
+}
+
+/* Gives UPAGE, which must be in the running thread's
+   supplemental page table, a frame with its contents, and maps
+   it, evicting another page if need be.  Returns true if
+   successful or if UPAGE was already resident, false if no frame
+   could be had or reading failed. */
+bool
+vm_claim_page (void *upage) {
+	struct thread *t = thread_current ();
+	struct vm_entry *e = spt_find_page (&t->spt, upage);
+	bool success = false;
+	void *kpage;
+
+	if (e == NULL)
+		return false;
+	if (e->type == VM_MMAP)
+		return claim_mmap (e);
+
+	lock_acquire (&frame_lock);
+	if (e->kpage != NULL) {
+		lock_release (&frame_lock);
+		return true;
+	}
+
+	kpage = frame_alloc (e, e->type == VM_ZERO);
+	if (kpage == NULL)
+		goto done;
+	if (e->type == VM_FILE) {
+		if (inode_read_at (e->inode, kpage, e->read_bytes, e->ofs)
+				!= (off_t) e->read_bytes)
+			goto done;
+		memset ((uint8_t *) kpage + e->read_bytes, 0, PGSIZE - e->read_bytes);
+		file_cnt++;
+	} else if (e->type == VM_ANON) {
+		swap_in (e->swap_slot, kpage);
+		e->swap_slot = SWAP_ERROR;
+	} else
+		zero_cnt++;
+
+	if (!pml4_set_page (t->pml4, e->upage, kpage, e->writable))
+		goto done;
+	e->kpage = kpage;
+
+	/* A zero page's contents now exist only in its frame. */
+	if (e->type == VM_ZERO)
+		e->type = VM_ANON;
+	success = true;
+
+ done:
+	if (!success && kpage != NULL)
+		frame_free (kpage);
+	lock_release (&frame_lock);
+	return success;
+}
+
+/* Takes E out of the ring of entries that share its frame.  If
+   E owned the frame in the frame table, the next sharer takes it
+   over.  Returns false if E was not sharing its frame. */
+static bool
+unshare (struct vm_entry *e) {
+	struct page *page = kva_to_page (e->kpage);
+	struct vm_entry *prev = e;
+
+	ASSERT (lock_held_by_current_thread (&frame_lock));
+
+	if (e->sharer == e)
+		return false;
+	while (prev->sharer != e)
+		prev = prev->sharer;
+	prev->sharer = e->sharer;
+	if (page->mapping == e)
+		page->mapping = e->sharer;
+	e->sharer = e;
+	return true;
+}
+
+/* Handles a write fault on E's resident, read-only page, which
+   E may write: copies the page if it is shared, or makes it
+   writable again if E is its last sharer.  Returns true if
+   successful, false if no frame could be had. */
+static bool
+copy_on_write (struct vm_entry *e) {
+	struct page *old;
+	void *kpage;
+	bool success = true;
+
+	lock_acquire (&frame_lock);
+	if (e->kpage == NULL) {
+		/* Evicted meanwhile. */
+		lock_release (&frame_lock);
+		return vm_claim_page (e->upage);
+	}
+
+	old = kva_to_page (e->kpage);
+	if (old->refcnt == 1)
+		pml4_protect_range (e->pml4, e->upage, 1, true);
+	else {
+		kpage = frame_alloc (e, false);
+		if (kpage != NULL) {
+			memcpy (kpage, e->kpage, PGSIZE);
+			pml4_clear_page (e->pml4, e->upage);
+			if (pml4_set_page (e->pml4, e->upage, kpage, true)) {
+				/* The last sharer of a merged frame owns it in the
+				   frame table, while KSM holds the other reference. */
+				if (unshare (e))
+					page_put (old);
+				else
+					frame_free (e->kpage);
+				e->kpage = kpage;
+				if (e->type == VM_FILE)
+					e->type = VM_ANON;
+				cow_cnt++;
+			} else {
+				pml4_set_page (e->pml4, e->upage, e->kpage, false);
+				frame_free (kpage);
+				success = false;
+			}
+		} else
+			success = false;
+	}
+	lock_release (&frame_lock);
+	return success;
+}
+
+/* Maps the pages in the aligned window of vm_fault_around pages
+   around E, a VM_MMAP page that was just faulted in, that are
+   VM_MMAP pages too and are already in the page cache. */
+static void
+fault_around (struct vm_entry *e) {
+	struct supplemental_page_table *spt = &thread_current ()->spt;
+	uint64_t window = (uint64_t) vm_fault_around * PGSIZE;
+	uint8_t *start = (uint8_t *) ((uint64_t) e->upage & ~(window - 1));
+	uint8_t *upage;
+
+	for (upage = start; upage < start + window; upage += PGSIZE) {
+		struct vm_entry *n;
+
+		if (upage == e->upage || !is_user_vaddr (upage))
+			continue;
+		n = spt_find_page (spt, upage);
+		if (n == NULL || n->type != VM_MMAP || n->kpage != NULL)
+			continue;
+		if (pagecache_map_cached (n))
+			around_cnt++;
+	}
+}
+
+/* Handles a page fault at ADDR in the running thread, given the
+   faulting frame F and whether the fault came from user code
+   (USER), was a write (WRITE), and was to a page that is not
+   present (NOT_PRESENT).  Returns true if the page was loaded and
+   the faulting instruction can be restarted, false if the access
+   was invalid. */
+bool
+vm_try_handle_fault (struct intr_frame *f UNUSED, void *addr,
+		bool user UNUSED, bool write, bool not_present) {
+	struct vm_entry *e;
+
+	if (addr == NULL || !is_user_vaddr (addr))
+		return false;
+	e = spt_find_page (&thread_current ()->spt, addr);
+	if (e == NULL || (write && !e->writable))
+		return false;
+	fault_cnt++;
+	if (!not_present)
+		return write && copy_on_write (e);
+	if (!vm_claim_page (e->upage))
+		return false;
+	if (e->type == VM_MMAP && vm_fault_around > 1)
+		fault_around (e);
+	return true;
+}
+
+/* Stores demand paging statistics in STATS. */
+void
+vm_get_stats (struct vm_stats *stats) {
+	stats->fault_cnt = fault_cnt;
+	stats->file_cnt = file_cnt;
+	stats->zero_cnt = zero_cnt;
+	stats->share_cnt = share_cnt;
+	stats->cow_cnt = cow_cnt;
+	stats->mmap_cnt = mmap_cnt;
+	stats->around_cnt = around_cnt;
+	stats->evict_cnt = frame_evict_count ();
+}
+
+/* Prints demand paging statistics. */
+void
+vm_print_stats (void) {
+	printf ("VM: %zu page faults, %zu pages mapped around them "
+			"(window %u), %zu pages read from files, %zu zero pages\n",
+			fault_cnt, around_cnt, vm_fault_around, file_cnt, zero_cnt);
+	printf ("VM: %zu frames shared by fork, %zu copied on write, "
+			"%zu mapped file pages\n", share_cnt, cow_cnt, mmap_cnt);
+	frame_print_stats ();
+	swap_print_stats ();
+	pagecache_print_stats ();
+}
+
+/* Returns a hash of the page entry E. */
+static unsigned
+entry_hash (const struct hash_elem *e_, void *aux UNUSED) {
+	const struct vm_entry *e = hash_entry (e_, struct vm_entry, elem);
+	return hash_bytes (&e->upage, sizeof e->upage);
+}
+
+/* Returns true if entry A precedes entry B. */
+static bool
+entry_less (const struct hash_elem *a_, const struct hash_elem *b_,
+		void *aux UNUSED) {
+	const struct vm_entry *a = hash_entry (a_, struct vm_entry, elem);
+	const struct vm_entry *b = hash_entry (b_, struct vm_entry, elem);
+	return a->upage < b->upage;
+}
+
+/* Unmaps and frees the frame or swap slot of entry E, if any,
+   writing back a dirty mapped file page, closes its file, and
+   frees E. */
+static void
+entry_destroy (struct hash_elem *e_, void *aux UNUSED) {
+	struct vm_entry *e = hash_entry (e_, struct vm_entry, elem);
+
+	if (e->type == VM_MMAP) {
+		if (pagecache_unmap (e))
+			pagecache_writeback (e->inode, e->ofs / PGSIZE);
+	} else if (e->kpage != NULL) {
+		if (e->pml4 != NULL)
+			pml4_clear_page (e->pml4, e->upage);
+		if (unshare (e))
+			page_put (kva_to_page (e->kpage));
+		else
+			frame_free (e->kpage);
+	} else if (e->type == VM_ANON && e->swap_slot != SWAP_ERROR)
+		swap_free (e->swap_slot);
+	inode_close (e->inode);
+	free (e);
+}